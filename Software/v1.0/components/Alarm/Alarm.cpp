@@ -0,0 +1,304 @@
+/*
+
+
+
+
+*/
+
+#include "Alarm.h"
+
+static const char *TAG = "Alarm";
+
+static const char *rule_names[alarm_rules] = {"high", "low", "rate"};
+
+/* Null, because instance will be initialized on demand. */
+Alarm *Alarm::inst = 0;
+
+//
+Alarm::Alarm()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Alarm(): failed to create semaphore");
+    Metrics *metrics = Metrics::instance();
+    this->_events_metric = metrics->counter("alarm_events_total", "", "alarms raised or cleared");
+    this->_dropped_metric = metrics->counter("alarm_dropped_total", "", "events overwritten before they reached the card");
+}
+
+//
+Alarm *Alarm::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Alarm(): creating instance");
+        inst = SINGLETON_NEW(Alarm);
+    }
+    return inst;
+}
+
+// name of @rule as /alarms and ALARM_FILE print it
+const char *Alarm::ruleName(alarm_rule rule)
+{
+    return (rule < alarm_rules) ? rule_names[rule] : "";
+}
+
+// limits from the settings, called by the storage task on its settings poll - never per reading
+esp_err_t Alarm::loadSettings(void)
+{
+    Settings *settings = Settings::instance();
+    double set_point = 0, low = 0, hysteresis = 0, delay = 0, rate = 0, rate_window = ALARM_RATE_WINDOW;
+    char units[SETTINGS_MAX_VAL] = {0};
+    alarm_limits limits;
+
+    settings->getParameter(&set_point, "set_point");
+    settings->getParameter(&low, "alarm_low");
+    settings->getParameter(&hysteresis, "alarm_hysteresis");
+    settings->getParameter(&delay, "alarm_delay");
+    settings->getParameter(&rate, "alarm_rate");
+    settings->getParameter(&rate_window, "alarm_rate_window");
+    settings->getParameter(units, sizeof(units), "units"); // limits are in the units the file is written in
+
+    limits.high = (set_point > 0) ? (tension_t)lround(set_point * TENSION_SCALE) : TENSION_NONE;
+    limits.low = (low > 0) ? (tension_t)lround(low * TENSION_SCALE) : TENSION_NONE;
+    limits.hysteresis = (hysteresis > 0) ? (tension_t)lround(hysteresis * TENSION_SCALE) : 0;
+    limits.rate = (rate > 0) ? (float)(rate * TENSION_SCALE) : 0;
+    limits.rate_window_s = (rate_window > 0) ? (float)rate_window : 0;
+    limits.delay_us = (delay > 0) ? (int64_t)(delay * US_PER_SEC) : 0;
+    limits.units = tension_unit_parse(units, strnlen(units, sizeof(units)));
+
+    SEMAPHORE_TAKE();
+    this->_limits = limits;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// run the rules of @data's channel on one parsed frame, constant time whatever the frame rate
+esp_err_t Alarm::check(const SensorData *data)
+{
+    if (data == NULL || data->channel >= SENSOR_CHANNELS || data->units == unit_none || data->timestamp <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE();
+    const alarm_limits *limits = &this->_limits;
+    alarm_channel *ch = &this->_channel[data->channel];
+    tension_t value = tension_convert(data->tension, data->units, limits->units);
+    int64_t time_us = data->timestamp;
+
+    // slope to the previous frame, filtered with a weight from the time between them so uneven frames count right
+    if (ch->last_us > 0 && time_us > ch->last_us)
+    {
+        float dt = (float)(time_us - ch->last_us) / US_PER_SEC;
+        float slope = (float)(value - ch->last) / dt;
+        ch->rate += (slope - ch->rate) * dt / (limits->rate_window_s + dt);
+    }
+    else if (time_us < ch->last_us) // clock stepped back
+        ch->rate = 0;
+    ch->last_us = time_us;
+    ch->last = value;
+    ch->units = (limits->units == unit_none) ? data->units : limits->units;
+
+    bool on = (limits->high != TENSION_NONE);
+    this->_rule(data->channel, alarm_high, on && value >= limits->high,
+                on && value > limits->high - limits->hysteresis, value, time_us);
+    on = (limits->low != TENSION_NONE);
+    this->_rule(data->channel, alarm_low, on && value <= limits->low,
+                on && value < limits->low + limits->hysteresis, value, time_us);
+    on = (limits->rate > 0);
+    float rate = fabsf(ch->rate);
+    this->_rule(data->channel, alarm_rate, on && rate >= limits->rate,
+                on && rate > limits->rate * ALARM_RATE_CLEAR / 100, (tension_t)lroundf(ch->rate), time_us);
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// raise @rule once it was @exceeded for the delay, clear it when it no longer @holds - the lock is taken
+void Alarm::_rule(int channel, alarm_rule rule, bool exceeded, bool holds, tension_t value, int64_t time_us)
+{
+    alarm_channel *ch = &this->_channel[channel];
+
+    if (ch->active[rule])
+    {
+        if (!holds)
+        {
+            ch->active[rule] = false;
+            this->_event(channel, rule, false, value, time_us);
+        }
+        ch->pending_us[rule] = 0;
+        return;
+    }
+    if (!exceeded)
+    {
+        ch->pending_us[rule] = 0;
+        return;
+    }
+    if (ch->pending_us[rule] == 0 || time_us < ch->pending_us[rule])
+        ch->pending_us[rule] = time_us;
+    if (time_us - ch->pending_us[rule] >= this->_limits.delay_us)
+    {
+        ch->active[rule] = true;
+        this->_event(channel, rule, true, value, time_us);
+    }
+}
+
+// add a transition to the ring - the lock is taken
+void Alarm::_event(int channel, alarm_rule rule, bool active, tension_t value, int64_t time_us)
+{
+    alarm_event *event = &this->_events[this->_seq % ALARM_EVENTS];
+    event->time_us = time_us;
+    event->value = value;
+    event->channel = channel;
+    event->rule = rule;
+    event->active = active ? 1 : 0;
+    event->units = this->_channel[channel].units;
+    this->_seq++;
+    Metrics::instance()->inc(this->_events_metric);
+    // the external LED blinks fast while anything is raised
+    bool raised = false;
+    for (int c = 0; c < SENSOR_CHANNELS; c++)
+    {
+        for (int r = 0; r < alarm_rules; r++)
+            raised |= this->_channel[c].active[r];
+    }
+    Status::instance()->setAlarm(raised);
+    ESP_LOGW(TAG, "channel %d %s alarm %s", channel, rule_names[rule], active ? "raised" : "cleared");
+}
+
+// sequence of the newest event, a client passes it back as since= - a single aligned word, read without the lock
+uint32_t Alarm::seq(void)
+{
+    return this->_seq;
+}
+
+// bit (1 << alarm_rule) set for every rule raised on @channel
+uint32_t Alarm::active(int channel)
+{
+    uint32_t mask = 0;
+    if (channel < 0 || channel >= SENSOR_CHANNELS)
+        return 0;
+    SEMAPHORE_TAKE();
+    for (int r = 0; r < alarm_rules; r++)
+    {
+        if (this->_channel[channel].active[r])
+            mask |= 1UL << r;
+    }
+    SEMAPHORE_GIVE();
+    return mask;
+}
+
+// "time,channel,rule,state,value,units" line of @event
+int Alarm::_formatEvent(char *buff, size_t len, const alarm_event *event)
+{
+    char time_str[TIME_FORMAT_MS_LEN], value[TENSION_TEXT_LEN];
+
+    if (System::instance()->getTimeStringMs(time_str, sizeof(time_str), event->time_us) != ESP_OK)
+        time_str[0] = '\0';
+    tension_format(value, sizeof(value), event->value);
+    return snprintf(buff, len, "%s,%u,%s,%s,%s,%s%s\n", time_str, event->channel, rule_names[event->rule],
+                    event->active ? "raised" : "cleared", value, tension_unit_name((tension_unit)event->units),
+                    (event->rule == alarm_rate) ? "/s" : "");
+}
+
+// append events not yet logged to ALARM_FILE - the caller has the card mounted and no file open
+esp_err_t Alarm::flush(void)
+{
+    SDCard *card = SDCard::instance();
+    alarm_event out[ALARM_EVENTS];
+    char line[ALARM_LINE_LEN];
+    uint64_t size = 0;
+    uint32_t from, to;
+    int n = 0;
+
+    SEMAPHORE_TAKE();
+    to = this->_seq;
+    from = this->_written;
+    if (to - from > ALARM_EVENTS)
+    { // overwritten in the ring while the card was away
+        Metrics::instance()->inc(this->_dropped_metric, to - from - ALARM_EVENTS);
+        from = to - ALARM_EVENTS;
+    }
+    for (uint32_t s = from; s != to; s++)
+        out[n++] = this->_events[s % ALARM_EVENTS];
+    SEMAPHORE_GIVE();
+    if (n == 0)
+        return ESP_OK;
+
+    bool created = (card->getFileSize(ALARM_FILE, &size) != ESP_OK || size == 0);
+    if (card->openFile(ALARM_FILE, "a") != ESP_OK)
+        return ESP_FAIL;
+    esp_err_t rc = created ? card->writeFile("Datetime,Channel,Rule,State,Value,Units\n", 40) : ESP_OK;
+    for (int i = 0; i < n && rc == ESP_OK; i++)
+    {
+        int len = this->_formatEvent(line, sizeof(line), &out[i]);
+        rc = card->writeFile(line, (len < (int)sizeof(line)) ? len : sizeof(line) - 1);
+    }
+    if (card->closeFile() != ESP_OK || rc != ESP_OK)
+    { // the events are written again with the next flush, a partial write may repeat a few lines
+        ESP_LOGE(TAG, "flush(): failed to write %s", ALARM_FILE);
+        return ESP_FAIL;
+    }
+    SEMAPHORE_TAKE();
+    this->_written = to;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// stream the raised alarms and the events after @since as JSON
+esp_err_t Alarm::write(alarm_writer_t writer, void *ctx, uint32_t since)
+{
+    char line[ALARM_LINE_LEN];
+    alarm_event event;
+    uint32_t mask[SENSOR_CHANNELS], seq, first;
+    bool row = false;
+    int len;
+
+    SEMAPHORE_TAKE();
+    seq = this->_seq;
+    for (int c = 0; c < SENSOR_CHANNELS; c++)
+    {
+        mask[c] = 0;
+        for (int r = 0; r < alarm_rules; r++)
+            mask[c] |= this->_channel[c].active[r] ? (1UL << r) : 0;
+    }
+    SEMAPHORE_GIVE();
+
+    len = snprintf(line, sizeof(line), "{\"seq\":%u,\"scale\":%d,\"active\":[", seq, TENSION_SCALE);
+    esp_err_t rc = writer(ctx, line, len);
+    for (int c = 0; c < Sensor::channels() && rc == ESP_OK; c++)
+    {
+        for (int r = 0; r < alarm_rules && rc == ESP_OK; r++)
+        {
+            if (!(mask[c] & (1UL << r)))
+                continue;
+            len = snprintf(line, sizeof(line), "%s[%d,\"%s\"]", row ? "," : "", c, rule_names[r]);
+            rc = writer(ctx, line, len);
+            row = true;
+        }
+    }
+    if (rc == ESP_OK)
+        rc = writer(ctx, "],\"events\":[", 12);
+
+    // one event copied per lock, the sensor tasks are never held up by a slow client
+    first = (seq > ALARM_EVENTS) ? seq - ALARM_EVENTS : 0;
+    row = false;
+    for (uint32_t s = (since > first) ? since : first; s < seq && rc == ESP_OK; s++)
+    {
+        bool kept = false;
+        SEMAPHORE_TAKE();
+        if (this->_seq - s <= ALARM_EVENTS)
+        {
+            event = this->_events[s % ALARM_EVENTS];
+            kept = true;
+        }
+        SEMAPHORE_GIVE();
+        if (!kept)
+            continue;
+        len = snprintf(line, sizeof(line), "%s[%u,%lld,%u,\"%s\",%u,%d,\"%s%s\"]", row ? "," : "", s + 1,
+                       event.time_us / 1000, event.channel, rule_names[event.rule], event.active, event.value,
+                       tension_unit_name((tension_unit)event.units), (event.rule == alarm_rate) ? "/s" : "");
+        rc = writer(ctx, line, len);
+        row = true;
+    }
+    if (rc != ESP_OK)
+        return ESP_FAIL;
+    return writer(ctx, "]}", 2);
+}
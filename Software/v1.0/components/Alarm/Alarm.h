@@ -0,0 +1,128 @@
+/*
+
+
+
+
+*/
+
+#ifndef ALARM_H
+#define ALARM_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "System.h"
+#include "TimeFormat.h"
+#include "Status.h"
+#include "Settings.h"
+#include "Sensor.h"
+#include "SDCard.h"
+#include "Metrics.h"
+
+#define ALARM_EVENTS 64          // raised / cleared events kept in RAM, a power of two so seq wraps cleanly
+#define ALARM_FILE "alarms.log"  // event log on the card, appended by Storage::write()
+#define ALARM_LINE_LEN 96
+#define ALARM_RATE_CLEAR 80      // percent of the rate limit a rate alarm clears below
+#define ALARM_RATE_WINDOW 1.0    // seconds the rate is smoothed over without "alarm_rate_window"
+
+// condition a channel is checked for
+enum alarm_rule : uint8_t
+{
+    alarm_high, // at or above set_point
+    alarm_low,  // at or below alarm_low
+    alarm_rate, // rising or falling faster than alarm_rate per second
+    alarm_rules
+};
+
+// one transition of a rule, value is the reading (hundredths per second for alarm_rate)
+struct alarm_event
+{
+    int64_t time_us;
+    tension_t value;
+    uint8_t channel;
+    uint8_t rule;
+    uint8_t active; // 1 - raised, 0 - cleared
+    uint8_t units;
+};
+
+// thresholds from the settings, converted once per reload
+struct alarm_limits
+{
+    tension_t high;       // TENSION_NONE - rule off
+    tension_t low;        // TENSION_NONE - rule off
+    tension_t hysteresis; // a level alarm clears this far back inside the limit
+    float rate;           // hundredths per second, 0 - rule off
+    float rate_window_s;  // smoothing time constant of the rate
+    int64_t delay_us;     // a limit must be exceeded this long before the alarm is raised
+    tension_unit units;   // limits are in these units, unit_none - as measured
+};
+
+// rule state of one channel, updated in constant time per reading
+struct alarm_channel
+{
+    int64_t pending_us[alarm_rules]; // condition met since, 0 - not met
+    bool active[alarm_rules];
+    int64_t last_us;                 // previous reading, 0 - none yet
+    tension_t last;
+    tension_unit units;              // the readings are compared in
+    float rate;                      // smoothed hundredths per second
+};
+
+// exported JSON output, called once per row
+typedef esp_err_t (*alarm_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Tension alarms
+
+  check() is called by the sensor tasks with every parsed frame and
+  updates a fixed amount of state per channel: high and low limits with
+  hysteresis, a rate of change smoothed by an exponential filter, and a
+  minimum time a limit must be exceeded before the alarm is raised. The
+  result does not depend on the logging interval or on how often
+  clients poll. Transitions go into a ring numbered by a running
+  sequence, which /alarms streams and /measurement reports so pages
+  notice a new event on their next poll, and are appended to ALARM_FILE
+  in the storage task's card session. Limits come from the settings:
+  set_point (high), alarm_low, alarm_hysteresis, alarm_delay [s],
+  alarm_rate [units/s] and alarm_rate_window [s], 0 turns a rule off.
+*/
+class Alarm
+{
+public:
+    static Alarm *instance(void);
+    esp_err_t loadSettings(void);
+    esp_err_t check(const SensorData *data);
+    uint32_t seq(void);
+    uint32_t active(int channel);
+    esp_err_t flush(void);
+    esp_err_t write(alarm_writer_t writer, void *ctx, uint32_t since);
+    static const char *ruleName(alarm_rule rule);
+
+private:
+    static Alarm *inst;
+    Alarm();
+    Alarm(const Alarm *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    alarm_limits _limits = {TENSION_NONE, TENSION_NONE, 0, 0, ALARM_RATE_WINDOW, 0, unit_none};
+    alarm_channel _channel[SENSOR_CHANNELS] = {};
+    alarm_event _events[ALARM_EVENTS];
+    uint32_t _seq = 0;     // events added, the newest one's sequence
+    uint32_t _written = 0; // events up to this sequence are in ALARM_FILE
+    int _events_metric = -1, _dropped_metric = -1;
+
+    void _rule(int channel, alarm_rule rule, bool exceeded, bool holds, tension_t value, int64_t time_us);
+    void _event(int channel, alarm_rule rule, bool active, tension_t value, int64_t time_us);
+    int _formatEvent(char *buff, size_t len, const alarm_event *event);
+};
+
+#endif // Alarm.h
@@ -0,0 +1,153 @@
+/*
+
+
+
+
+*/
+
+#include "Compression.h"
+
+static const char *TAG = "Compression";
+
+//
+Compression::Compression()
+{
+    SensorData defaults = SENSOR_DEFAULTS();
+    this->_archive = defaults;
+    this->_pending = defaults;
+}
+
+// set deadband (gauge units) and maximum silent interval (sec), deadband <= 0 disables compression - flush() first, the trend is reset
+esp_err_t Compression::init(double deadband, uint32_t max_interval)
+{
+    if (deadband < 0 || max_interval == 0)
+    {
+        ESP_LOGE(TAG, "init(): invalid deadband %.2f or interval %u", deadband, max_interval);
+        return ESP_ERR_INVALID_ARG;
+    }
+    this->_deadband = deadband * TENSION_SCALE;
+    this->_max_interval = max_interval;
+    this->reset();
+    ESP_LOGI(TAG, "init(): deadband %.2f, max interval %u s", deadband, max_interval);
+    return ESP_OK;
+}
+
+//
+bool Compression::enabled(void)
+{
+    return this->_deadband > 0;
+}
+
+// push a new sample, up to COMPRESSION_MAX_OUT samples to be stored are written into @out - returns count
+int Compression::feed(const SensorData *in, SensorData *out)
+{
+    if (!this->enabled())
+    {
+        out[0] = *in;
+        return 1;
+    }
+
+    int64_t t = in->timestamp;
+    int count = 0;
+
+    // first sample or gauge changed mode / units - archive straight away
+    if (!this->_has_archive || !this->_sameState(in, &this->_archive))
+    {
+        if (this->_has_pending)
+            out[count++] = this->_pending;
+        this->_setArchive(in, t);
+        out[count++] = *in;
+        return count;
+    }
+
+    // samples sharing a timestamp cannot be placed on the trend line
+    if (t <= (this->_has_pending ? this->_pending_time : this->_archive_time))
+        return 0;
+
+    if (!this->_has_pending)
+    {
+        this->_pending = *in;
+        this->_pending_time = t;
+        this->_has_pending = true;
+        return 0;
+    }
+
+    // the pending sample becomes an intermediate point - swing the doors onto it
+    double v0 = this->_archive.tension;
+    double dt = (double)(this->_pending_time - this->_archive_time) / US_PER_SEC;
+    double lower = (this->_pending.tension - this->_deadband - v0) / dt;
+    double upper = (this->_pending.tension + this->_deadband - v0) / dt;
+    if (lower < this->_slope_min)
+        lower = this->_slope_min;
+    if (upper > this->_slope_max)
+        upper = this->_slope_max;
+
+    // slope of the line from the archived sample to the new one
+    dt = (double)(t - this->_archive_time) / US_PER_SEC;
+    double slope = (in->tension - v0) / dt;
+
+    if (slope >= lower && slope <= upper && (t - this->_archive_time) <= (int64_t)this->_max_interval * US_PER_SEC)
+    {
+        this->_slope_min = lower;
+        this->_slope_max = upper;
+    }
+    else
+    {
+        // doors opened - the pending sample ends the segment
+        out[count++] = this->_pending;
+        this->_setArchive(&this->_pending, this->_pending_time);
+    }
+    this->_pending = *in;
+    this->_pending_time = t;
+    this->_has_pending = true;
+    return count;
+}
+
+// emit the sample held back for the current segment (file closed or rotated)
+bool Compression::flush(SensorData *out)
+{
+    if (!this->enabled() || !this->_has_pending)
+        return false;
+    *out = this->_pending;
+    this->_setArchive(&this->_pending, this->_pending_time);
+    return true;
+}
+
+// forget the trend, next sample is archived unconditionally
+void Compression::reset(void)
+{
+    this->_has_archive = false;
+    this->_has_pending = false;
+    this->_slope_min = -DBL_MAX;
+    this->_slope_max = DBL_MAX;
+}
+
+// file header line stating the reconstruction error bound
+esp_err_t Compression::getHeader(char *buff, size_t len)
+{
+    if (buff == NULL || len < COMPRESSION_HEADER_LEN)
+        return ESP_ERR_INVALID_ARG;
+    memset(buff, 0, len);
+    if (!this->enabled())
+        return ESP_OK;
+    snprintf(buff, len, "# swinging-door compression: interpolation error <= %.2f, max interval %u s\r\n",
+             this->_deadband / TENSION_SCALE, this->_max_interval);
+    return ESP_OK;
+}
+
+//
+void Compression::_setArchive(const SensorData *data, int64_t t)
+{
+    this->_archive = *data;
+    this->_archive_time = t;
+    this->_has_archive = true;
+    this->_has_pending = false;
+    this->_slope_min = -DBL_MAX;
+    this->_slope_max = DBL_MAX;
+}
+
+// samples with different units or peak hold value start a new segment
+bool Compression::_sameState(const SensorData *a, const SensorData *b)
+{
+    return a->peak_tension == b->peak_tension && a->units == b->units;
+}
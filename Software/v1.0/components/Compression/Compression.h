@@ -0,0 +1,61 @@
+/*
+
+
+
+
+*/
+
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <string.h>
+#include <time.h>
+#include <float.h>
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "Sensor.h"
+
+#define COMPRESSION_HEADER_LEN 96
+#define COMPRESSION_MAX_INTERVAL 60 // default maximum silent interval, sec
+#define COMPRESSION_MAX_OUT 2       // samples feed() can emit at once
+
+/*
+  Swinging-door trend compression
+
+  A sample is archived only when no straight line from the last archived
+  sample can pass within +/- deadband of every sample received since.
+  Linear interpolation between archived rows reconstructs the original
+  signal with an error no larger than the deadband, and a row is always
+  emitted at least every max_interval seconds.
+*/
+class Compression
+{
+public:
+    Compression();
+    esp_err_t init(double deadband, uint32_t max_interval);
+    bool enabled(void);
+    int feed(const SensorData *in, SensorData *out);
+    bool flush(SensorData *out);
+    void reset(void);
+    esp_err_t getHeader(char *buff, size_t len);
+
+private:
+    double _deadband = 0.0; // fixed point tension units
+    uint32_t _max_interval = COMPRESSION_MAX_INTERVAL;
+
+    bool _has_archive = false;
+    bool _has_pending = false;
+    SensorData _archive;
+    SensorData _pending;
+    int64_t _archive_time = 0; // epoch microseconds
+    int64_t _pending_time = 0;
+    double _slope_min = -DBL_MAX;
+    double _slope_max = DBL_MAX;
+
+    void _setArchive(const SensorData *data, int64_t t);
+    bool _sameState(const SensorData *a, const SensorData *b);
+};
+
+#endif // Compression.h
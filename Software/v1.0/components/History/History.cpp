@@ -0,0 +1,265 @@
+/*
+
+
+
+
+*/
+
+#include "History.h"
+
+static const char *TAG = "History";
+
+/* Null, because instance will be initialized on demand. */
+History *History::inst = 0;
+
+//
+History::History()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "History(): failed to create semaphore");
+}
+
+//
+History *History::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "History(): creating instance");
+        inst = SINGLETON_NEW(History);
+    }
+    return inst;
+}
+
+// sequence of the newest sample, a client passes it back as since= - a single aligned word, read without the lock
+uint32_t History::seq(void)
+{
+    return this->_seq;
+}
+
+// add one sample of the storage task's tick
+esp_err_t History::add(const SensorData *data)
+{
+    if (data == NULL || data->channel >= SENSOR_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    Sample *slot = &this->_recent[this->_seq % HISTORY_RECENT];
+    if (this->_pack(data, slot))
+    {
+        this->_seq++;
+        this->_rollup(data->timestamp, slot);
+    }
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// sequences above this one are still in the ring, sample seq lives at _recent[(seq - 1) % HISTORY_RECENT]
+uint32_t History::_first(void)
+{
+    uint32_t first = (this->_seq > HISTORY_RECENT) ? this->_seq - HISTORY_RECENT : 0;
+    return (first > this->_dropped) ? first : this->_dropped;
+}
+
+// pack @data against the ring's base, moving the base when it does not fit - the ring is dropped after a jump of weeks
+bool History::_pack(const SensorData *data, Sample *out)
+{
+    if (sample_pack(data, this->_base_us, out))
+        return true;
+
+    int64_t min_us = data->timestamp, max_us = data->timestamp;
+    for (uint32_t s = this->_first(); s < this->_seq; s++)
+    {
+        int64_t time_us = sample_time_us(&this->_recent[s % HISTORY_RECENT], this->_base_us);
+        min_us = (time_us < min_us) ? time_us : min_us;
+        max_us = (time_us > max_us) ? time_us : max_us;
+    }
+    int64_t base_us = sample_base(min_us);
+    if ((max_us - base_us) / 1000 > UINT32_MAX)
+    {
+        ESP_LOGW(TAG, "_pack(): clock jumped, %u samples dropped", this->_seq - this->_first());
+        this->_dropped = this->_seq;
+    }
+    else
+    {
+        int64_t shift_ms = (base_us - this->_base_us) / 1000;
+        for (uint32_t s = this->_first(); s < this->_seq; s++)
+            this->_recent[s % HISTORY_RECENT].time_ms = (uint32_t)((int64_t)this->_recent[s % HISTORY_RECENT].time_ms - shift_ms);
+    }
+    this->_base_us = base_us;
+    return sample_pack(data, this->_base_us, out);
+}
+
+// fold @in into its channel's rollup, closing the previous one on a new interval or a unit change
+void History::_rollup(int64_t time_us, const Sample *in)
+{
+    history_acc *acc = &this->_acc[in->channel];
+    int32_t value = sample_get_24(in->tension);
+    uint32_t time_s = (time_us > 0) ? (uint32_t)(time_us / US_PER_SEC) : 0;
+
+    time_s -= time_s % HISTORY_ROLLUP_SEC;
+    if (acc->count > 0 && (acc->time_s != time_s || acc->units != in->units))
+        this->_closeRollup(acc, in->channel);
+    if (acc->count == 0)
+    {
+        acc->sum = 0;
+        acc->min = value;
+        acc->max = value;
+        acc->time_s = time_s;
+        acc->units = in->units;
+    }
+    acc->sum += value;
+    acc->min = (value < acc->min) ? value : acc->min;
+    acc->max = (value > acc->max) ? value : acc->max;
+    acc->count++;
+}
+
+//
+void History::_closeRollup(history_acc *acc, uint8_t channel)
+{
+    HistoryRollup *out = &this->_rollups[this->_rollup_count % HISTORY_ROLLUPS];
+    int64_t half = acc->count / 2;
+    int64_t mean = ((acc->sum >= 0) ? acc->sum + half : acc->sum - half) / (int64_t)acc->count;
+
+    out->time_s = acc->time_s;
+    sample_put_24(out->mean, (int32_t)mean);
+    sample_put_24(out->min, acc->min);
+    sample_put_24(out->max, acc->max);
+    out->units = acc->units;
+    out->channel = channel;
+    out->count = (acc->count > UINT16_MAX) ? UINT16_MAX : (uint16_t)acc->count;
+    this->_rollup_count++;
+    acc->count = 0;
+}
+
+// stream samples after @since as compact JSON, rows of one @channel or all (-1), the newest @limit (0 - all)
+esp_err_t History::write(history_writer_t writer, void *ctx, uint32_t since, int channel, uint32_t limit)
+{
+    char line[HISTORY_LINE_LEN];
+    uint32_t first, to, from = since;
+    int64_t oldest_us = INT64_MAX;
+    int len;
+
+    SEMAPHORE_TAKE();
+    first = this->_first();
+    to = this->_seq;
+    if (from > to) // restarted since the client's last request - it gets everything
+        from = 0;
+    if (first < to)
+        oldest_us = sample_time_us(&this->_recent[first % HISTORY_RECENT], this->_base_us);
+    if (limit > 0)
+    {
+        uint32_t s = to, found = 0;
+        while (s > from && s > first && found < limit)
+        {
+            s--;
+            if (channel < 0 || this->_recent[s % HISTORY_RECENT].channel == channel)
+                found++;
+        }
+        from = s;
+    }
+    SEMAPHORE_GIVE();
+
+    len = snprintf(line, sizeof(line), "{\"seq\":%u,\"scale\":%d,\"step\":%d,\"units\":[", to, TENSION_SCALE, HISTORY_ROLLUP_SEC);
+    if (writer(ctx, line, len) != ESP_OK)
+        return ESP_FAIL;
+    for (int u = 0; u < unit_count; u++)
+    {
+        len = snprintf(line, sizeof(line), "%s\"%s\"", (u > 0) ? "," : "", tension_unit_name((tension_unit)u));
+        if (writer(ctx, line, len) != ESP_OK)
+            return ESP_FAIL;
+    }
+    if (writer(ctx, "],\"rollups\":[", 13) != ESP_OK)
+        return ESP_FAIL;
+    // the gap reaches past the full rate ring - minutes before its oldest sample
+    if (from < first && this->_writeRollups(writer, ctx, channel, oldest_us) != ESP_OK)
+        return ESP_FAIL;
+    if (writer(ctx, "],\"samples\":[", 13) != ESP_OK)
+        return ESP_FAIL;
+    if (this->_writeSamples(writer, ctx, channel, from, to) != ESP_OK)
+        return ESP_FAIL;
+    return writer(ctx, "]}", 2);
+}
+
+// rows [dt_s, channel, mean, min, max, unit, count] of rollups starting before @until_us, dt from the previous row
+esp_err_t History::_writeRollups(history_writer_t writer, void *ctx, int channel, int64_t until_us)
+{
+    HistoryRollup chunk[HISTORY_CHUNK];
+    char line[HISTORY_LINE_LEN];
+    uint32_t next, to, last_s = 0;
+    bool first_row = true;
+
+    SEMAPHORE_TAKE();
+    to = this->_rollup_count;
+    next = (to > HISTORY_ROLLUPS) ? to - HISTORY_ROLLUPS : 0;
+    SEMAPHORE_GIVE();
+
+    while (next < to)
+    {
+        int n = 0;
+        SEMAPHORE_TAKE();
+        if (this->_rollup_count > HISTORY_ROLLUPS && next < this->_rollup_count - HISTORY_ROLLUPS)
+            next = this->_rollup_count - HISTORY_ROLLUPS; // overwritten while sending
+        for (; n < HISTORY_CHUNK && next + n < to; n++)
+            chunk[n] = this->_rollups[(next + n) % HISTORY_ROLLUPS];
+        SEMAPHORE_GIVE();
+        if (n == 0)
+            break;
+        next += n;
+        for (int i = 0; i < n; i++)
+        {
+            if ((channel >= 0 && chunk[i].channel != channel) || (int64_t)chunk[i].time_s * US_PER_SEC >= until_us)
+                continue;
+            int len = snprintf(line, sizeof(line), "%s[%d,%u,%d,%d,%d,%u,%u]", first_row ? "" : ",",
+                               (int)(chunk[i].time_s - last_s), (unsigned)chunk[i].channel, sample_get_24(chunk[i].mean),
+                               sample_get_24(chunk[i].min), sample_get_24(chunk[i].max), (unsigned)chunk[i].units, (unsigned)chunk[i].count);
+            if (writer(ctx, line, len) != ESP_OK)
+                return ESP_FAIL;
+            last_s = chunk[i].time_s;
+            first_row = false;
+        }
+    }
+    return ESP_OK;
+}
+
+// rows [dt_ms, channel, tension, peak | null, unit] of sequences @from + 1 .. @to, dt from the previous row
+esp_err_t History::_writeSamples(history_writer_t writer, void *ctx, int channel, uint32_t from, uint32_t to)
+{
+    Sample chunk[HISTORY_CHUNK];
+    char line[HISTORY_LINE_LEN], peak_text[12];
+    int64_t base_us = 0, last_ms = 0;
+    bool first_row = true;
+
+    while (from < to)
+    {
+        int n = 0;
+        SEMAPHORE_TAKE();
+        if (from < this->_first())
+            from = this->_first(); // overwritten while sending
+        for (; n < HISTORY_CHUNK && from + n < to; n++)
+            chunk[n] = this->_recent[(from + n) % HISTORY_RECENT];
+        base_us = this->_base_us;
+        SEMAPHORE_GIVE();
+        if (n == 0)
+            break;
+        from += n;
+        for (int i = 0; i < n; i++)
+        {
+            if (channel >= 0 && chunk[i].channel != channel)
+                continue;
+            int64_t time_ms = sample_time_us(&chunk[i], base_us) / 1000;
+            int32_t peak = sample_get_24(chunk[i].peak);
+            if (peak == SAMPLE_TENSION_NONE)
+                strcpy(peak_text, "null");
+            else
+                snprintf(peak_text, sizeof(peak_text), "%d", peak);
+            int len = snprintf(line, sizeof(line), "%s[%lld,%u,%d,%s,%u]", first_row ? "" : ",",
+                               (long long)(time_ms - last_ms), chunk[i].channel, sample_get_24(chunk[i].tension),
+                               peak_text, chunk[i].units);
+            if (writer(ctx, line, len) != ESP_OK)
+                return ESP_FAIL;
+            last_ms = time_ms;
+            first_row = false;
+        }
+    }
+    return ESP_OK;
+}
@@ -0,0 +1,102 @@
+/*
+
+
+
+
+*/
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "System.h"
+#include "Sensor.h"
+
+#define HISTORY_RECENT 2048     // samples at the logging interval, 34 min at the default 1 s - a power of two so seq wraps cleanly
+#define HISTORY_ROLLUPS 1440    // one per channel and minute, 24 h of one channel
+#define HISTORY_ROLLUP_SEC 60
+#define HISTORY_CHUNK 32        // entries copied per lock while streaming
+#define HISTORY_LINE_LEN 96
+
+// min / mean / max of one channel over HISTORY_ROLLUP_SEC, 16 bytes
+struct __attribute__((packed)) HistoryRollup
+{
+    uint32_t time_s; // epoch seconds of the interval start
+    uint8_t mean[3]; // int24 hundredths like Sample
+    uint8_t min[3];
+    uint8_t max[3];
+    uint8_t units : 4;
+    uint8_t channel : 4;
+    uint16_t count;  // samples in the interval, saturates at 65535 - 1 kHz over HISTORY_ROLLUP_SEC
+};
+
+static_assert(sizeof(HistoryRollup) == 16, "HistoryRollup is meant to stay 16 bytes");
+static_assert(unit_count <= 16 && SENSOR_CHANNELS <= 16, "units and channel of HistoryRollup are 4 bits");
+
+// the rollup a channel is building
+struct history_acc
+{
+    int64_t sum;
+    int32_t min;
+    int32_t max;
+    uint32_t time_s;
+    uint32_t count; // 0 - nothing collected
+    uint8_t units;
+};
+
+// exported JSON output, called once per row
+typedef esp_err_t (*history_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Recent history
+
+  Every sample the storage task takes (before compression) goes into a
+  ring of packed Samples numbered by a running sequence, and into a
+  per channel one minute min / mean / max rollup kept in a second, longer
+  ring. A client asks for everything after the last sequence it has: a
+  new page gets the whole window, a reconnecting one only the gap, and
+  rollups are added when the gap reaches past the full rate ring.
+  Output is streamed in chunks copied under the lock, so a slow client
+  never holds up the storage task.
+*/
+class History
+{
+public:
+    static History *instance(void);
+    esp_err_t add(const SensorData *data);
+    uint32_t seq(void);
+    esp_err_t write(history_writer_t writer, void *ctx, uint32_t since, int channel, uint32_t limit);
+
+private:
+    static History *inst;
+    History();
+    History(const History *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    Sample _recent[HISTORY_RECENT];
+    int64_t _base_us = 0;   // epoch microseconds _recent[] counts from
+    uint32_t _seq = 0;      // samples added, the newest one's sequence
+    uint32_t _dropped = 0;  // sequences before this one were discarded on a clock jump
+    HistoryRollup _rollups[HISTORY_ROLLUPS];
+    uint32_t _rollup_count = 0; // rollups closed, ring position
+    history_acc _acc[SENSOR_CHANNELS] = {};
+
+    uint32_t _first(void);
+    bool _pack(const SensorData *data, Sample *out);
+    void _rollup(int64_t time_us, const Sample *in);
+    void _closeRollup(history_acc *acc, uint8_t channel);
+    esp_err_t _writeRollups(history_writer_t writer, void *ctx, int channel, int64_t until_us);
+    esp_err_t _writeSamples(history_writer_t writer, void *ctx, int channel, uint32_t from, uint32_t to);
+};
+
+#endif // History.h
@@ -0,0 +1,131 @@
+/*
+
+
+
+
+*/
+
+#include "Journal.h"
+
+static const char *TAG = "Journal";
+
+static RTC_NOINIT_ATTR JournalBlock journal;
+
+/* Null, because instance will be initialized on demand. */
+Journal *Journal::inst = 0;
+
+//
+Journal::Journal()
+{
+}
+
+// only storage_task touches the journal - no semaphore
+Journal *Journal::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Journal(): creating instance");
+        inst = SINGLETON_NEW(Journal);
+    }
+    return inst;
+}
+
+// check the journal left by the previous run, called once at boot
+esp_err_t Journal::init(void)
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+
+    if (reason == ESP_RST_POWERON || reason == ESP_RST_UNKNOWN || !this->_validate())
+    {
+        ESP_LOGI(TAG, "init(): no journal to recover (reset reason %d)", reason);
+        this->_format();
+        return ESP_OK;
+    }
+    ESP_LOGW(TAG, "init(): recovered %u samples for %s (reset reason %d)", journal.count, journal.file_name, reason);
+    return ESP_OK;
+}
+
+// journal one sample, ESP_ERR_NO_MEM when full
+esp_err_t Journal::append(const Sample *data)
+{
+    uint32_t count = journal.count;
+    if (count >= JOURNAL_LEN)
+        return ESP_ERR_NO_MEM;
+    journal.entries[count].data = *data;
+    journal.entries[count].crc = crc32_le(0, (const uint8_t *)&journal.entries[count].data, sizeof(Sample));
+    journal.count = count + 1; // single word store - entry visible only when complete
+    return ESP_OK;
+}
+
+// samples are on the card in @file_name - empty the journal, later entries count from @base_us
+esp_err_t Journal::commit(const char *file_name, int64_t base_us)
+{
+    journal.count = 0;
+    journal.base_crc = 0;
+    journal.base_us = base_us;
+    journal.base_crc = crc32_le(0, (const uint8_t *)&journal.base_us, sizeof(journal.base_us));
+    if (file_name == NULL)
+        return ESP_OK;
+    if (strncmp(journal.file_name, file_name, MAX_FILE_NAME) != 0)
+    {
+        journal.name_crc = 0;
+        strncpy(journal.file_name, file_name, MAX_FILE_NAME - 1);
+        journal.file_name[MAX_FILE_NAME - 1] = '\0';
+        journal.name_crc = crc32_le(0, (const uint8_t *)journal.file_name, MAX_FILE_NAME);
+    }
+    return ESP_OK;
+}
+
+// copy journaled samples into @data and their base into @base_us, returns number of samples
+int Journal::restore(Sample *data, int len, int64_t *base_us)
+{
+    int count = (journal.count < (uint32_t)len) ? journal.count : len;
+    for (int i = 0; i < count; i++)
+        data[i] = journal.entries[i].data;
+    *base_us = journal.base_us;
+    return count;
+}
+
+// file being written before the reset, ESP_ERR_NOT_FOUND if none
+esp_err_t Journal::getFileName(char *buff, size_t len)
+{
+    if (buff == NULL || len < MAX_FILE_NAME)
+        return ESP_ERR_INVALID_ARG;
+    if (journal.file_name[0] == '\0')
+        return ESP_ERR_NOT_FOUND;
+    strncpy(buff, journal.file_name, len);
+    return ESP_OK;
+}
+
+//
+void Journal::_format(void)
+{
+    memset(&journal, 0, sizeof(journal));
+    journal.name_crc = crc32_le(0, (const uint8_t *)journal.file_name, MAX_FILE_NAME);
+    journal.base_crc = crc32_le(0, (const uint8_t *)&journal.base_us, sizeof(journal.base_us));
+    journal.magic = JOURNAL_MAGIC;
+}
+
+// RTC memory contents after a reset - every committed entry must check out
+bool Journal::_validate(void)
+{
+    if (journal.magic != JOURNAL_MAGIC || journal.count > JOURNAL_LEN)
+        return false;
+    if (journal.name_crc != crc32_le(0, (const uint8_t *)journal.file_name, MAX_FILE_NAME))
+        return false;
+    if (journal.base_crc != crc32_le(0, (const uint8_t *)&journal.base_us, sizeof(journal.base_us)))
+    { // reset during a commit - the entries were on the card already
+        journal.count = 0;
+        return true;
+    }
+    for (uint32_t i = 0; i < journal.count; i++)
+    {
+        if (journal.entries[i].crc != crc32_le(0, (const uint8_t *)&journal.entries[i].data, sizeof(Sample)))
+        {
+            ESP_LOGW(TAG, "_validate(): entry %u corrupted, dropping the rest", i);
+            journal.count = i;
+            break;
+        }
+    }
+    return true;
+}
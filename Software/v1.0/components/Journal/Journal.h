@@ -0,0 +1,71 @@
+/*
+
+
+
+
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <string.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_system.h"
+#include "esp32/rom/crc.h"
+
+#include "Sensor.h"
+#include "SDCard.h"
+
+#define JOURNAL_LEN 32 // samples kept between flushes, >= DATA_POINTS
+#define JOURNAL_MAGIC 0x4A524E35 // changes with the Sample or block layout
+
+struct JournalEntry
+{
+    Sample data;
+    uint32_t crc;
+};
+
+// layout of the RTC slow memory block, survives everything but power-on
+struct JournalBlock
+{
+    uint32_t magic;
+    uint32_t count; // committed entries, updated after the entry is written
+    char file_name[MAX_FILE_NAME];
+    uint32_t name_crc;
+    int64_t base_us; // entry times count from here, set on commit
+    uint32_t base_crc;
+    JournalEntry entries[JOURNAL_LEN];
+};
+
+/*
+  Write-ahead journal in RTC slow memory
+
+  Samples are appended here before they are buffered for the SD card and
+  dropped once the card write completes. After a software, watchdog or
+  brownout reset the samples are replayed and the file that was being
+  written is named so its tail can be repaired. Entries are packed
+  Samples relative to the base of the caller's buffer, given on commit.
+*/
+class Journal
+{
+public:
+    static Journal *instance(void);
+    esp_err_t init(void);
+    esp_err_t append(const Sample *data);
+    esp_err_t commit(const char *file_name, int64_t base_us);
+    int restore(Sample *data, int len, int64_t *base_us);
+    esp_err_t getFileName(char *buff, size_t len);
+
+private:
+    static Journal *inst;
+    Journal();
+    Journal(const Journal *obj);
+
+    void _format(void);
+    bool _validate(void);
+};
+
+#endif // Journal.h
@@ -0,0 +1,436 @@
+/*
+
+
+
+
+*/
+
+#include "Memory.h"
+
+static const char *TAG = "Memory";
+
+static const char *site_names[mem_site_num] = {"json", "sdcard", "server", "other"};
+
+#define MEMORY_MAGIC 0xA110
+
+// in front of every tagged block, keeps 8 byte alignment
+struct mem_header
+{
+    uint32_t size;
+    uint16_t site;
+    uint16_t magic;
+};
+
+/* Null, because instance will be initialized on demand. */
+Memory *Memory::inst = 0;
+std::atomic<uint32_t> Memory::_failed_allocs{0};
+#ifdef CONFIG_STATIC_MEMORY
+std::atomic<bool> Memory::_sealed{false};
+std::atomic<uint32_t> Memory::_sealed_allocs{0};
+std::atomic<void *> Memory::_sealed_caller{NULL};
+TaskHandle_t Memory::_watched[MEMORY_WATCH_TASKS] = {};
+
+// every heap call of the application goes through these, see CMakeLists.txt
+extern "C"
+{
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t num, size_t size);
+    void *__real_realloc(void *ptr, size_t size);
+
+    void *__wrap_malloc(size_t size)
+    {
+        Memory::heapCall(__builtin_return_address(0));
+        return __real_malloc(size);
+    }
+
+    void *__wrap_calloc(size_t num, size_t size)
+    {
+        Memory::heapCall(__builtin_return_address(0));
+        return __real_calloc(num, size);
+    }
+
+    void *__wrap_realloc(void *ptr, size_t size)
+    {
+        Memory::heapCall(__builtin_return_address(0));
+        return __real_realloc(ptr, size);
+    }
+}
+
+// exceptions are off, a failed new aborts like the default one
+void *operator new(size_t size)
+{
+    Memory::heapCall(__builtin_return_address(0));
+    void *ptr = __real_malloc(size);
+    if (ptr == NULL)
+        abort();
+    return ptr;
+}
+
+void *operator new[](size_t size)
+{
+    Memory::heapCall(__builtin_return_address(0));
+    void *ptr = __real_malloc(size);
+    if (ptr == NULL)
+        abort();
+    return ptr;
+}
+#endif
+
+//
+Memory::Memory()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Memory(): failed to create semaphore");
+}
+
+//
+Memory *Memory::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Memory(): creating instance");
+        inst = SINGLETON_NEW(Memory);
+    }
+    return inst;
+}
+
+// register the series and the hooks, call before anything uses cJSON
+esp_err_t Memory::init(void)
+{
+    char labels[METRICS_LABELS_LEN];
+    Metrics *metrics = Metrics::instance();
+
+    for (int i = 0; i < mem_site_num; i++)
+    {
+        snprintf(labels, sizeof(labels), "site=\"%s\"", site_names[i]);
+        this->_sites[i].allocs_id = metrics->counter("heap_allocs_total", labels, "tagged allocations");
+        this->_sites[i].failures_id = metrics->counter("heap_alloc_failures_total", labels, "tagged allocations that failed");
+        this->_sites[i].live_id = metrics->gauge("heap_live_bytes", labels, "bytes held by a site");
+    }
+    this->_largest_id = metrics->gauge("heap_min_largest_block_bytes", NULL, "low water mark of the largest free block");
+    this->_frag_id = metrics->gauge("heap_fragmentation_permille", NULL, "long term average of 1 - largest block / free");
+    this->_trend_id = metrics->gauge("heap_largest_block_trend_bytes_per_hour", NULL, "slope of the hourly largest block minima");
+#ifdef CONFIG_STATIC_MEMORY
+    this->_sealed_id = metrics->counter("heap_sealed_allocs_total", NULL, "heap calls by application tasks after boot");
+#endif
+
+    cJSON_Hooks hooks = {};
+    hooks.malloc_fn = &Memory::_jsonMalloc;
+    hooks.free_fn = &Memory::_jsonFree;
+    cJSON_InitHooks(&hooks);
+
+    esp_err_t ret = heap_caps_register_failed_alloc_callback(&Memory::_failedAlloc);
+    if (ret != ESP_OK)
+        ESP_LOGW(TAG, "init(): failed to register the alloc callback");
+    return ret;
+}
+
+// malloc charged to @site, free with release()
+void *Memory::alloc(size_t size, mem_site site)
+{
+    _site *s = &this->_sites[site];
+    mem_header *header;
+#ifdef CONFIG_STATIC_MEMORY
+    if (site == mem_site_json)
+        header = (mem_header *)this->_arenaAlloc(sizeof(mem_header) + size);
+    else
+#endif
+        header = (mem_header *)::malloc(sizeof(mem_header) + size);
+    if (header == NULL)
+    {
+        s->failures.fetch_add(1, std::memory_order_relaxed);
+        Metrics::instance()->inc(s->failures_id);
+        return NULL;
+    }
+    header->size = size;
+    header->site = site;
+    header->magic = MEMORY_MAGIC;
+    s->allocs.fetch_add(1, std::memory_order_relaxed);
+    s->bytes.fetch_add(size, std::memory_order_relaxed);
+    Metrics::instance()->inc(s->allocs_id);
+    return header + 1;
+}
+
+// zeroed alloc()
+void *Memory::calloc(size_t num, size_t size, mem_site site)
+{
+    if (size != 0 && num > SIZE_MAX / size)
+        return NULL;
+    void *ptr = this->alloc(num * size, site);
+    if (ptr != NULL)
+        memset(ptr, 0, num * size);
+    return ptr;
+}
+
+// free a block from alloc() / calloc()
+void Memory::release(void *ptr)
+{
+    if (ptr == NULL)
+        return;
+    mem_header *header = (mem_header *)ptr - 1;
+    if (header->magic != MEMORY_MAGIC || header->site >= mem_site_num)
+    {
+        ESP_LOGE(TAG, "release(): %p was not allocated by alloc()", ptr);
+        return;
+    }
+    _site *s = &this->_sites[header->site];
+    s->frees.fetch_add(1, std::memory_order_relaxed);
+    s->freed_bytes.fetch_add(header->size, std::memory_order_relaxed);
+    header->magic = 0; // catches a double release
+#ifdef CONFIG_STATIC_MEMORY
+    if (this->_arenaRelease(header))
+        return;
+#endif
+    ::free(header);
+}
+
+// end of boot - from now on heap calls of the watched tasks are reported
+esp_err_t Memory::seal(void)
+{
+#ifdef CONFIG_STATIC_MEMORY
+    _sealed.store(true);
+    ESP_LOGI(TAG, "seal(): %u bytes free, heap sealed", heap_caps_get_free_size(MALLOC_CAP_8BIT));
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// report heap calls made by @task after seal(), call before seal()
+esp_err_t Memory::watchTask(TaskHandle_t task)
+{
+#ifdef CONFIG_STATIC_MEMORY
+    for (int i = 0; i < MEMORY_WATCH_TASKS; i++)
+    {
+        if (_watched[i] == NULL || _watched[i] == task)
+        {
+            _watched[i] = task;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NO_MEM;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// sample the heap, update the trend and the memory_overflow flag
+esp_err_t Memory::check(void)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t free_size = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t largest = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    float fragmentation = (free_size > 0) ? 1.0f - (float)largest / free_size : 1.0f;
+    bool overflow = false;
+
+    SEMAPHORE_TAKE();
+    memory_stats *stats = &this->_stats;
+    stats->free = free_size;
+    stats->min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    stats->largest = largest;
+    stats->failed_allocs = _failed_allocs.load(std::memory_order_relaxed);
+    if (this->_last_check_us == 0)
+    { // first call
+        stats->min_largest = largest;
+        stats->fragmentation = fragmentation;
+        stats->hours_left = -1;
+        this->_sample_start_us = now;
+        this->_sample_min = largest;
+    }
+    else
+    {
+        float alpha = (float)(now - this->_last_check_us) / US_PER_SEC / MEMORY_FRAG_TAU_S;
+        stats->fragmentation += ((alpha < 1.0f) ? alpha : 1.0f) * (fragmentation - stats->fragmentation);
+    }
+    this->_last_check_us = now;
+    if (largest < stats->min_largest)
+        stats->min_largest = largest;
+    if (largest < this->_sample_min)
+        this->_sample_min = largest;
+    if (now - this->_sample_start_us >= MEMORY_SAMPLE_US)
+    {
+        this->_updateTrend();
+        this->_sample_start_us = now;
+        this->_sample_min = largest;
+    }
+
+    if (largest < MEMORY_MIN_BLOCK)
+        overflow = true;
+    else if (stats->fragmentation > MEMORY_FRAG_LIMIT)
+        overflow = true;
+    else if (stats->hours_left >= 0 && stats->hours_left < MEMORY_HORIZON_H)
+        overflow = true;
+
+    Metrics *metrics = Metrics::instance();
+    metrics->set(this->_largest_id, stats->min_largest);
+    metrics->set(this->_frag_id, (int32_t)(stats->fragmentation * 1000));
+    metrics->set(this->_trend_id, (int32_t)stats->trend_bytes_h);
+    for (int i = 0; i < mem_site_num; i++)
+        metrics->set(this->_sites[i].live_id, this->_sites[i].bytes.load(std::memory_order_relaxed) -
+                                                  this->_sites[i].freed_bytes.load(std::memory_order_relaxed));
+#ifdef CONFIG_STATIC_MEMORY
+    uint32_t sealed = _sealed_allocs.load(std::memory_order_relaxed);
+    uint32_t reported = this->_sealed_reported;
+    this->_sealed_reported = sealed;
+    stats->sealed_allocs = sealed;
+    portENTER_CRITICAL(&this->_arena_mux);
+    stats->arena_peak = this->_arena_peak;
+    portEXIT_CRITICAL(&this->_arena_mux);
+#endif
+    SEMAPHORE_GIVE();
+
+    System *system = System::instance();
+#ifdef CONFIG_STATIC_MEMORY
+    if (sealed != reported)
+    {
+        ESP_LOGE(TAG, "check(): %u heap calls after boot, last one from %p",
+                 sealed - reported, _sealed_caller.load(std::memory_order_relaxed));
+        metrics->inc(this->_sealed_id, sealed - reported);
+        system->setErrorFlag(internal_error);
+    }
+#endif
+    if (overflow != system->getErrorFlag(memory_overflow))
+    {
+        ESP_LOGW(TAG, "check(): free %u largest %u fragmentation %.2f trend %.0f B/h",
+                 free_size, largest, this->_stats.fragmentation, this->_stats.trend_bytes_h);
+        if (overflow)
+            system->setErrorFlag(memory_overflow);
+        else
+            system->clearErrorFlag(memory_overflow);
+    }
+    return ESP_OK;
+}
+
+//
+void Memory::getStats(memory_stats *stats)
+{
+    if (this->xSemaphore == NULL || !LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))
+    {
+        memset(stats, 0, sizeof(memory_stats));
+        return;
+    }
+    *stats = this->_stats;
+    LOCK_GIVE(this->xSemaphore);
+}
+
+// counters of the first @len sites
+void Memory::getSiteStats(mem_site_stats *stats, int len)
+{
+    for (int i = 0; i < len && i < mem_site_num; i++)
+    {
+        stats[i].allocs = this->_sites[i].allocs.load(std::memory_order_relaxed);
+        stats[i].frees = this->_sites[i].frees.load(std::memory_order_relaxed);
+        stats[i].failures = this->_sites[i].failures.load(std::memory_order_relaxed);
+        stats[i].bytes = this->_sites[i].bytes.load(std::memory_order_relaxed);
+        stats[i].freed_bytes = this->_sites[i].freed_bytes.load(std::memory_order_relaxed);
+    }
+}
+
+//
+const char *Memory::getSiteName(mem_site site)
+{
+    return (site < mem_site_num) ? site_names[site] : "unknown";
+}
+
+#ifdef CONFIG_STATIC_MEMORY
+// called on every heap call, counts the ones a watched task makes after seal()
+void Memory::heapCall(void *caller)
+{
+    if (!_sealed.load(std::memory_order_relaxed))
+        return;
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < MEMORY_WATCH_TASKS && _watched[i] != NULL; i++)
+    {
+        if (_watched[i] == task)
+        {
+            _sealed_allocs.fetch_add(1, std::memory_order_relaxed);
+            _sealed_caller.store(caller, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+// bump allocation from the JSON arena, NULL when it is full
+void *Memory::_arenaAlloc(size_t size)
+{
+    void *ptr = NULL;
+    size = (size + 7) & ~(size_t)7;
+    portENTER_CRITICAL(&this->_arena_mux);
+    if (size <= MEMORY_JSON_ARENA - this->_arena_top)
+    {
+        ptr = this->_arena + this->_arena_top;
+        this->_arena_top += size;
+        this->_arena_live++;
+        if (this->_arena_top > this->_arena_peak)
+            this->_arena_peak = this->_arena_top;
+    }
+    portEXIT_CRITICAL(&this->_arena_mux);
+    return ptr;
+}
+
+// false if @ptr is not from the arena, space comes back once every block is released
+bool Memory::_arenaRelease(void *ptr)
+{
+    if ((uint8_t *)ptr < this->_arena || (uint8_t *)ptr >= this->_arena + MEMORY_JSON_ARENA)
+        return false;
+    portENTER_CRITICAL(&this->_arena_mux);
+    if (--this->_arena_live == 0)
+        this->_arena_top = 0;
+    portEXIT_CRITICAL(&this->_arena_mux);
+    return true;
+}
+#endif
+
+// close a sample period and refit the largest block trend, called with the lock held
+void Memory::_updateTrend(void)
+{
+    memory_stats *stats = &this->_stats;
+    int n = (stats->samples < MEMORY_SAMPLES) ? stats->samples : MEMORY_SAMPLES;
+    if (n == MEMORY_SAMPLES) // window full, drop the oldest
+        memmove(this->_samples, this->_samples + 1, --n * sizeof(uint32_t));
+    this->_samples[n++] = this->_sample_min;
+    stats->samples++;
+
+    stats->trend_bytes_h = 0;
+    stats->hours_left = -1;
+    if (n < MEMORY_TREND_MIN)
+        return;
+
+    // least squares line through (hour, sample)
+    float mean_x = (n - 1) / 2.0f, mean_y = 0, sxy = 0, sxx = 0;
+    for (int i = 0; i < n; i++)
+        mean_y += this->_samples[i];
+    mean_y /= n;
+    for (int i = 0; i < n; i++)
+    {
+        sxy += (i - mean_x) * (this->_samples[i] - mean_y);
+        sxx += (i - mean_x) * (i - mean_x);
+    }
+    float slope = sxy / sxx;
+    float fitted = mean_y + slope * (n - 1 - mean_x); // trend value now
+    stats->trend_bytes_h = slope;
+    if (slope < 0)
+    {
+        float hours = (fitted - MEMORY_MIN_BLOCK) / -slope;
+        stats->hours_left = (hours > 0) ? (int32_t)hours : 0;
+    }
+}
+
+// heap_caps callback, any failed allocation in the system
+void Memory::_failedAlloc(size_t size, uint32_t caps, const char *function_name)
+{
+    _failed_allocs.fetch_add(1, std::memory_order_relaxed);
+}
+
+//
+void *Memory::_jsonMalloc(size_t size)
+{
+    return Memory::instance()->alloc(size, mem_site_json);
+}
+
+//
+void Memory::_jsonFree(void *ptr)
+{
+    Memory::instance()->release(ptr);
+}
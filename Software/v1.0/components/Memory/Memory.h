@@ -0,0 +1,153 @@
+/*
+
+
+
+
+*/
+
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <string.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "cJSON.h"
+
+#include "System.h"
+#include "Metrics.h"
+
+#define MEMORY_MIN_BLOCK 8192         // largest free block below this is an overflow right away
+#define MEMORY_FRAG_LIMIT 0.6f        // long term fragmentation, 1 - largest block / free
+#define MEMORY_FRAG_TAU_S 3600.0f     // fragmentation average time constant
+#define MEMORY_SAMPLE_US 3600000000LL // trend sample period - 1 hour
+#define MEMORY_SAMPLES 24             // trend window
+#define MEMORY_TREND_MIN 6            // samples before the trend is trusted
+#define MEMORY_HORIZON_H (7 * 24)     // projected exhaustion closer than this raises the flag
+#define MEMORY_JSON_ARENA 32768       // static memory mode: cJSON trees are carved from this
+#define MEMORY_WATCH_TASKS 8          // static memory mode: tasks whose heap calls are reported
+
+// tagged allocation sites
+enum mem_site
+{
+    mem_site_json,   // cJSON trees and printed strings
+    mem_site_sdcard, // directory listings
+    mem_site_server, // request contexts
+    mem_site_other,
+    mem_site_num
+};
+
+// per site allocation counts, live bytes = bytes - freed_bytes
+struct mem_site_stats
+{
+    uint32_t allocs;
+    uint32_t frees;
+    uint32_t failures;
+    uint32_t bytes;
+    uint32_t freed_bytes;
+};
+
+// heap state from the last check()
+struct memory_stats
+{
+    uint32_t free;
+    uint32_t min_free;      // low water mark since boot
+    uint32_t largest;       // largest free block
+    uint32_t min_largest;   // low water mark of the largest block
+    float fragmentation;    // long term average, 0 .. 1
+    float trend_bytes_h;    // largest block slope over the window, bytes per hour
+    int32_t hours_left;     // projected hours until MEMORY_MIN_BLOCK, -1 - not shrinking
+    uint32_t samples;       // trend samples collected
+    uint32_t failed_allocs; // failed allocations anywhere in the heap
+    uint32_t sealed_allocs; // static memory mode: heap calls by watched tasks after seal()
+    uint32_t arena_peak;    // static memory mode: JSON arena high water mark
+};
+
+/*
+  Heap monitor
+
+  Tagged alloc / release wrappers put a small header in front of each
+  block so frees are charged to the site that allocated it; cJSON is
+  routed through them by init(). check() runs with the storage task's
+  settings poll: it averages fragmentation over hours and fits a line
+  through the hourly minima of the largest free block. memory_overflow is raised
+  when the largest block is already too small, when fragmentation stays
+  high, or when the fitted trend reaches the minimum within a week -
+  slow leaks and fragmentation show up long before an allocation fails.
+
+  With CONFIG_STATIC_MEMORY cJSON uses a static arena that resets when
+  its last block is released, and after seal() every malloc / calloc /
+  realloc and operator new made by a watched task is counted and
+  reported by check() as an internal error.
+*/
+class Memory
+{
+public:
+    static Memory *instance(void);
+    esp_err_t init(void);
+    void *alloc(size_t size, mem_site site);
+    void *calloc(size_t num, size_t size, mem_site site);
+    void release(void *ptr);
+    esp_err_t seal(void);
+    esp_err_t watchTask(TaskHandle_t task);
+    esp_err_t check(void);
+    void getStats(memory_stats *stats);
+    void getSiteStats(mem_site_stats *stats, int len);
+    static const char *getSiteName(mem_site site);
+#ifdef CONFIG_STATIC_MEMORY
+    static void heapCall(void *caller);
+#endif
+
+private:
+    static Memory *inst;
+    Memory();
+    Memory(const Memory *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    struct _site
+    {
+        std::atomic<uint32_t> allocs{0}, frees{0}, failures{0}, bytes{0}, freed_bytes{0};
+        int allocs_id = -1, failures_id = -1, live_id = -1;
+    } _sites[mem_site_num];
+    static std::atomic<uint32_t> _failed_allocs;
+
+    memory_stats _stats = {};
+    int64_t _last_check_us = 0;
+    int64_t _sample_start_us = 0;
+    uint32_t _sample_min = 0; // lowest largest block in the running sample period
+    uint32_t _samples[MEMORY_SAMPLES] = {};
+    int _largest_id = -1, _frag_id = -1, _trend_id = -1;
+
+#ifdef CONFIG_STATIC_MEMORY
+    static std::atomic<bool> _sealed;
+    static std::atomic<uint32_t> _sealed_allocs;
+    static std::atomic<void *> _sealed_caller; // return address of the last one
+    static TaskHandle_t _watched[MEMORY_WATCH_TASKS];
+    uint32_t _sealed_reported = 0;
+    int _sealed_id = -1;
+
+    portMUX_TYPE _arena_mux = portMUX_INITIALIZER_UNLOCKED;
+    alignas(8) uint8_t _arena[MEMORY_JSON_ARENA];
+    size_t _arena_top = 0;
+    size_t _arena_peak = 0;
+    uint32_t _arena_live = 0; // blocks out, the arena resets when this drops to 0
+    void *_arenaAlloc(size_t size);
+    bool _arenaRelease(void *ptr);
+#endif
+
+    void _updateTrend(void);
+    static void _failedAlloc(size_t size, uint32_t caps, const char *function_name);
+    static void *_jsonMalloc(size_t size);
+    static void _jsonFree(void *ptr);
+};
+
+#endif // Memory.h
@@ -0,0 +1,241 @@
+/*
+
+
+
+
+*/
+
+#include "Metrics.h"
+
+static const char *TAG = "Metrics";
+
+static const char *type_names[] = {"counter", "gauge", "histogram"};
+
+const int32_t metrics_duration_us[METRICS_DURATION_BUCKETS] = {
+    100, 500, 1000, 5000, 10000, 50000, 100000, 500000, 1000000, 5000000};
+
+/* Null, because instance will be initialized on demand. */
+Metrics *Metrics::inst = 0;
+
+//
+Metrics::Metrics()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Metrics(): failed to create semaphore");
+}
+
+//
+Metrics *Metrics::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Metrics(): creating instance");
+        inst = SINGLETON_NEW(Metrics);
+    }
+    return inst;
+}
+
+// register a monotonic counter, returns its id or -1
+int Metrics::counter(const char *name, const char *labels, const char *help)
+{
+    return this->_register(metric_counter, name, labels, help, NULL, 0);
+}
+
+// register a gauge, returns its id or -1
+int Metrics::gauge(const char *name, const char *labels, const char *help)
+{
+    return this->_register(metric_gauge, name, labels, help, NULL, 0);
+}
+
+// register a histogram with ascending upper bucket @limits, returns its id or -1
+int Metrics::histogram(const char *name, const char *labels, const char *help, const int32_t *limits, int buckets)
+{
+    if (limits == NULL || buckets <= 0 || buckets > METRICS_BUCKETS)
+        return -1;
+    return this->_register(metric_histogram, name, labels, help, limits, buckets);
+}
+
+//
+void Metrics::inc(int id, uint32_t n)
+{
+    if (id < 0 || id >= this->_count.load(std::memory_order_acquire))
+        return;
+    this->_metrics[id].counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+//
+void Metrics::set(int id, int32_t value)
+{
+    if (id < 0 || id >= this->_count.load(std::memory_order_acquire))
+        return;
+    this->_metrics[id].gauge.store(value, std::memory_order_relaxed);
+}
+
+//
+void Metrics::observe(int id, int32_t value)
+{
+    if (id < 0 || id >= this->_count.load(std::memory_order_acquire))
+        return;
+    Metric *metric = &this->_metrics[id];
+    int bucket = 0;
+    while (bucket < metric->buckets && value > metric->limits[bucket])
+        bucket++;
+    portENTER_CRITICAL(&this->_mux);
+    metric->counts[bucket]++;
+    metric->sum += value;
+    metric->count++;
+    portEXIT_CRITICAL(&this->_mux);
+}
+
+// render every series in the Prometheus text format through @writer
+esp_err_t Metrics::write(metrics_writer_t writer, void *ctx)
+{
+    char line[METRICS_LINE_LEN], labels[METRICS_LABELS_LEN + 24];
+    uint32_t counts[METRICS_BUCKETS + 1], count;
+    uint64_t sum;
+    int total = this->_count.load(std::memory_order_acquire);
+
+    for (int i = 0; i < total; i++)
+    {
+        Metric *metric = &this->_metrics[i];
+        const char *sep = strlen(metric->labels) ? "," : "";
+        bool described = false;
+        for (int j = 0; j < i && !described; j++)
+            described = strcmp(this->_metrics[j].name, metric->name) == 0;
+        if (!described)
+        {
+            snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n",
+                     metric->name, metric->help, metric->name, type_names[metric->type]);
+            if (writer(ctx, line, strlen(line)) != ESP_OK)
+                return ESP_FAIL;
+        }
+
+        if (metric->type == metric_counter)
+            snprintf(line, sizeof(line), "%s{%s} %u\n", metric->name, metric->labels,
+                     metric->counter.load(std::memory_order_relaxed));
+        else if (metric->type == metric_gauge)
+            snprintf(line, sizeof(line), "%s{%s} %d\n", metric->name, metric->labels,
+                     metric->gauge.load(std::memory_order_relaxed));
+        else
+        {
+            portENTER_CRITICAL(&this->_mux);
+            memcpy(counts, metric->counts, sizeof(counts));
+            sum = metric->sum;
+            count = metric->count;
+            portEXIT_CRITICAL(&this->_mux);
+
+            uint32_t cumulative = 0;
+            for (int b = 0; b <= metric->buckets; b++)
+            {
+                cumulative += counts[b];
+                if (b < metric->buckets)
+                    snprintf(labels, sizeof(labels), "%s%sle=\"%d\"", metric->labels, sep, metric->limits[b]);
+                else
+                    snprintf(labels, sizeof(labels), "%s%sle=\"+Inf\"", metric->labels, sep);
+                snprintf(line, sizeof(line), "%s_bucket{%s} %u\n", metric->name, labels, cumulative);
+                if (writer(ctx, line, strlen(line)) != ESP_OK)
+                    return ESP_FAIL;
+            }
+            snprintf(line, sizeof(line), "%s_sum{%s} %llu\n%s_count{%s} %u\n",
+                     metric->name, metric->labels, sum, metric->name, metric->labels, count);
+        }
+        if (writer(ctx, line, strlen(line)) != ESP_OK)
+            return ESP_FAIL;
+    }
+    return this->_writeSystem(writer, ctx, line);
+}
+
+// add a series, an existing name / labels pair returns the same id
+int Metrics::_register(metric_type type, const char *name, const char *labels, const char *help,
+                       const int32_t *limits, int buckets)
+{
+    int id = -1;
+
+    if (name == NULL || strlen(name) >= METRICS_NAME_LEN)
+        return -1;
+    if (labels == NULL)
+        labels = "";
+    if (strlen(labels) >= METRICS_LABELS_LEN)
+        return -1;
+
+    if (this->xSemaphore == NULL || !LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))
+        return -1;
+    int total = this->_count.load(std::memory_order_relaxed);
+    for (int i = 0; i < total && id < 0; i++)
+    {
+        if (strcmp(this->_metrics[i].name, name) == 0 && strcmp(this->_metrics[i].labels, labels) == 0)
+            id = i;
+    }
+    if (id < 0 && total < METRICS_MAX)
+    {
+        Metric *metric = &this->_metrics[total];
+        metric->type = type;
+        strlcpy(metric->name, name, sizeof(metric->name));
+        strlcpy(metric->labels, labels, sizeof(metric->labels));
+        metric->help = (help != NULL) ? help : "";
+        metric->limits = limits;
+        metric->buckets = buckets;
+        id = total;
+        // publish only after the entry is filled in
+        this->_count.store(total + 1, std::memory_order_release);
+    }
+    else if (id < 0)
+        ESP_LOGE(TAG, "_register(): no room for %s", name);
+    LOCK_GIVE(this->xSemaphore);
+    return id;
+}
+
+// heap, uptime and per task CPU time, read at scrape time
+esp_err_t Metrics::_writeSystem(metrics_writer_t writer, void *ctx, char *line)
+{
+    snprintf(line, METRICS_LINE_LEN,
+             "# TYPE uptime_seconds gauge\nuptime_seconds %lld\n"
+             "# TYPE heap_free_bytes gauge\nheap_free_bytes %u\n"
+             "# TYPE heap_min_free_bytes gauge\nheap_min_free_bytes %u\n",
+             esp_timer_get_time() / US_PER_SEC,
+             heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+    if (writer(ctx, line, strlen(line)) != ESP_OK)
+        return ESP_FAIL;
+    snprintf(line, METRICS_LINE_LEN,
+             "# TYPE heap_largest_free_block_bytes gauge\nheap_largest_free_block_bytes %u\n",
+             heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    if (writer(ctx, line, strlen(line)) != ESP_OK)
+        return ESP_FAIL;
+
+#ifdef CONFIG_STATIC_MEMORY
+    TaskStatus_t *tasks = this->_tasks;
+#else
+    TaskStatus_t *tasks = (TaskStatus_t *)malloc(METRICS_TASKS_MAX * sizeof(TaskStatus_t));
+    if (tasks == NULL)
+        return ESP_ERR_NO_MEM;
+#endif
+    uint32_t run_time = 0;
+    UBaseType_t count = uxTaskGetSystemState(tasks, METRICS_TASKS_MAX, &run_time);
+    esp_err_t rc = ESP_OK;
+
+    snprintf(line, METRICS_LINE_LEN, "# HELP task_cpu_us_total run time per task\n# TYPE task_cpu_us_total counter\n");
+    rc = writer(ctx, line, strlen(line));
+    for (UBaseType_t i = 0; i < count && rc == ESP_OK; i++)
+    {
+        snprintf(line, METRICS_LINE_LEN, "task_cpu_us_total{task=\"%s\"} %u\n",
+                 tasks[i].pcTaskName, tasks[i].ulRunTimeCounter);
+        rc = writer(ctx, line, strlen(line));
+    }
+    if (rc == ESP_OK)
+    {
+        snprintf(line, METRICS_LINE_LEN, "# HELP task_stack_free_bytes stack high water mark\n# TYPE task_stack_free_bytes gauge\n");
+        rc = writer(ctx, line, strlen(line));
+    }
+    for (UBaseType_t i = 0; i < count && rc == ESP_OK; i++)
+    {
+        snprintf(line, METRICS_LINE_LEN, "task_stack_free_bytes{task=\"%s\"} %u\n",
+                 tasks[i].pcTaskName, tasks[i].usStackHighWaterMark);
+        rc = writer(ctx, line, strlen(line));
+    }
+#ifndef CONFIG_STATIC_MEMORY
+    free(tasks);
+#endif
+    return rc;
+}
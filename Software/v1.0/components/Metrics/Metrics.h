@@ -0,0 +1,119 @@
+/*
+
+
+
+
+*/
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+
+#include "System.h"
+
+#define METRICS_MAX 64        // registered series
+#define METRICS_NAME_LEN 40
+#define METRICS_LABELS_LEN 40 // 'key="value",...' without braces
+#define METRICS_BUCKETS 12    // max histogram buckets, +Inf is implicit
+#define METRICS_LINE_LEN 192
+#define METRICS_TASKS_MAX 24  // tasks reported by the CPU counters
+
+#define METRICS_DURATION_BUCKETS 10
+extern const int32_t metrics_duration_us[METRICS_DURATION_BUCKETS]; // 100 us .. 5 s
+
+enum metric_type
+{
+    metric_counter,
+    metric_gauge,
+    metric_histogram
+};
+
+// one registered series - counters and gauges are lock free, histograms take a spinlock
+struct Metric
+{
+    metric_type type;
+    char name[METRICS_NAME_LEN];
+    char labels[METRICS_LABELS_LEN];
+    const char *help;
+    std::atomic<uint32_t> counter;
+    std::atomic<int32_t> gauge;
+    const int32_t *limits;
+    int buckets;
+    uint32_t counts[METRICS_BUCKETS + 1];
+    uint64_t sum;
+    uint32_t count;
+};
+
+// exposition output, called once per line
+typedef esp_err_t (*metrics_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Metrics registry
+
+  Series are registered once, usually through a function static id, and
+  updated by id from any task. Scraping renders all series in the
+  Prometheus text format together with heap and per-task CPU counters
+  read at that moment.
+*/
+class Metrics
+{
+public:
+    static Metrics *instance(void);
+    int counter(const char *name, const char *labels, const char *help);
+    int gauge(const char *name, const char *labels, const char *help);
+    int histogram(const char *name, const char *labels, const char *help, const int32_t *limits, int buckets);
+    void inc(int id, uint32_t n = 1);
+    void set(int id, int32_t value);
+    void observe(int id, int32_t value);
+    esp_err_t write(metrics_writer_t writer, void *ctx);
+
+private:
+    static Metrics *inst;
+    Metrics();
+    Metrics(const Metrics *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    Metric _metrics[METRICS_MAX];
+    std::atomic<int> _count{0};
+#ifdef CONFIG_STATIC_MEMORY
+    TaskStatus_t _tasks[METRICS_TASKS_MAX]; // scrape scratch, one scrape at a time
+#endif
+
+    int _register(metric_type type, const char *name, const char *labels, const char *help,
+                  const int32_t *limits, int buckets);
+    esp_err_t _writeSystem(metrics_writer_t writer, void *ctx, char *line);
+};
+
+// times the enclosing scope into a duration histogram
+class MetricTimer
+{
+public:
+    MetricTimer(int id) : _id(id), _start(esp_timer_get_time()) {}
+    ~MetricTimer() { Metrics::instance()->observe(this->_id, (int32_t)(esp_timer_get_time() - this->_start)); }
+
+private:
+    int _id;
+    int64_t _start;
+};
+
+#define METRICS_TIME_SCOPE(name, labels, help)                                                \
+    static const int _metric_id = Metrics::instance()->histogram(name, labels, help,          \
+                                                                 metrics_duration_us,         \
+                                                                 METRICS_DURATION_BUCKETS);   \
+    MetricTimer _metric_timer(_metric_id)
+
+#endif // Metrics.h
@@ -0,0 +1,504 @@
+/*
+
+
+
+
+*/
+
+#include "Query.h"
+
+static const char *TAG = "Query";
+
+static const char *agg_names[QUERY_AGGS] = {"min", "max", "mean", "count"};
+
+// two or four digit field of a time text, -1 when not digits
+static int digits(const char *p, int n)
+{
+    int v = 0;
+    for (int i = 0; i < n; i++)
+    {
+        if (p[i] < '0' || p[i] > '9')
+            return -1;
+        v = v * 10 + (p[i] - '0');
+    }
+    return v;
+}
+
+// start time carried by a log file name, "YYYY-MM-DD_HH-MM-SS.csv" or "YYYY-MM-DD_HH-MM-SS_NN.csv"
+static bool name_time(const char *name, int64_t *time_s)
+{
+    char text[QUERY_TIME_LEN];
+    if (strlen(name) < QUERY_TIME_LEN || name[13] != '-' || name[16] != '-')
+        return false;
+    memcpy(text, name, QUERY_TIME_LEN);
+    text[13] = ':';
+    text[16] = ':';
+    return Query::parseTime(text, QUERY_TIME_LEN, time_s);
+}
+
+// insertion sort of file names, start times sort like the names
+static void sort_names(char (*names)[MAX_FILE_NAME], int count)
+{
+    char key[MAX_FILE_NAME];
+    for (int i = 1; i < count; i++)
+    {
+        memcpy(key, names[i], MAX_FILE_NAME);
+        int j = i - 1;
+        while (j >= 0 && strcmp(names[j], key) > 0)
+        {
+            memcpy(names[j + 1], names[j], MAX_FILE_NAME);
+            j--;
+        }
+        memcpy(names[j + 1], key, MAX_FILE_NAME);
+    }
+}
+
+// local wall clock seconds of "YYYY-MM-DD?HH:MM:SS", the separator may be 'T' or ' ' - false when not a time
+bool Query::parseTime(const char *text, size_t len, int64_t *time_s)
+{
+    tm time = {};
+    if (len < QUERY_TIME_LEN || text[4] != '-' || text[7] != '-' || text[13] != ':' || text[16] != ':')
+        return false;
+    int year = digits(text, 4), month = digits(text + 5, 2), day = digits(text + 8, 2);
+    int hour = digits(text + 11, 2), minute = digits(text + 14, 2), second = digits(text + 17, 2);
+    if (year < 1970 || month < 1 || month > 12 || day < 1 || day > 31 || hour < 0 || hour > 23 ||
+        minute < 0 || minute > 59 || second < 0 || second > 60)
+        return false;
+    time.tm_year = year - 1900;
+    time.tm_mon = month - 1;
+    time.tm_mday = day;
+    time.tm_hour = hour;
+    time.tm_min = minute;
+    time.tm_sec = second;
+    *time_s = time_from_civil(&time);
+    return true;
+}
+
+// seconds of "90", "90s", "15m", "1h" or "1d", 0 when not valid
+uint32_t Query::parseDuration(const char *text)
+{
+    char *end = NULL;
+    unsigned long v = strtoul(text, &end, 10);
+    if (end == text)
+        return 0;
+    if (*end == 'm')
+        v *= 60;
+    else if (*end == 'h')
+        v *= 3600;
+    else if (*end == 'd')
+        v *= 86400;
+    else if (*end != 's' && *end != '\0')
+        return 0;
+    return (v > UINT32_MAX) ? 0 : (uint32_t)v;
+}
+
+// request parameters - @aggs is a comma separated list of min, max, mean and count
+esp_err_t Query::init(int channel, int64_t from_s, int64_t to_s, uint32_t bucket_s, const char *aggs, query_format format)
+{
+    if (channel < 0 || channel >= SENSOR_CHANNELS || from_s >= to_s || bucket_s == 0 || aggs == NULL)
+        return ESP_ERR_INVALID_ARG;
+    this->_channel = channel;
+    this->_from_s = from_s;
+    this->_to_s = to_s;
+    this->_bucket_s = bucket_s;
+    this->_format = format;
+    this->_agg_count = 0;
+    for (const char *p = aggs; *p != '\0';)
+    {
+        size_t len = strcspn(p, ",");
+        int agg = 0;
+        while (agg < QUERY_AGGS && (strlen(agg_names[agg]) != len || strncmp(p, agg_names[agg], len)))
+            agg++;
+        if (agg == QUERY_AGGS || this->_agg_count == QUERY_AGGS)
+            return ESP_ERR_INVALID_ARG;
+        this->_aggs[this->_agg_count++] = (query_agg)agg;
+        p += len;
+        if (*p == ',')
+            p++;
+    }
+    return (this->_agg_count > 0) ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// aggregate @files (comma separated, NULL or "" - every .csv on the card) and stream the buckets to @writer
+esp_err_t Query::run(const char *files, query_writer_t writer, void *ctx)
+{
+    esp_err_t rc;
+    char line[QUERY_OUT_LEN];
+    int len;
+
+    this->_writer = writer;
+    this->_ctx = ctx;
+    this->_count = 0;
+    this->_rows = 0;
+    if ((rc = this->_listFiles(files)) != ESP_OK)
+        return rc;
+    if (this->_header() != ESP_OK)
+        return ESP_FAIL;
+    for (int i = 0; i < this->_file_count; i++)
+    {
+        if ((rc = this->_scanFile(this->_files[i])) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "run(): failed to scan %s", this->_files[i]);
+            return rc;
+        }
+    }
+    if (this->_count > 0 && this->_emit() != ESP_OK)
+        return ESP_FAIL;
+    if (this->_format == query_csv)
+        return ESP_OK;
+    len = snprintf(line, sizeof(line), "],\"buckets\":%u}", this->_rows);
+    return this->_writer(this->_ctx, line, len);
+}
+
+// statistics of a whole log file for its sidecar, the row times are converted from local time
+esp_err_t Query::summarize(const char *name, FileSummary *summary)
+{
+    tm time;
+    esp_err_t rc;
+
+    this->_from_s = 0;
+    this->_to_s = INT64_MAX;
+    this->_summary = summary;
+    summary_reset(summary, 1);
+    rc = this->_scanFile(name);
+    this->_summary = NULL;
+    if (rc != ESP_OK)
+        return rc;
+    summary->channels = this->_columns;
+    summary->size = this->_end;
+    if (summary->rows > 0)
+    {
+        civil_from_time((time_t)this->_first_s, &time);
+        time.tm_isdst = -1;
+        summary->first_us = (int64_t)mktime(&time) * US_PER_SEC;
+        civil_from_time((time_t)this->_last_s, &time);
+        time.tm_isdst = -1;
+        summary->last_us = (int64_t)mktime(&time) * US_PER_SEC;
+    }
+    return ESP_OK;
+}
+
+// file names to scan in time order, a given list is kept as is
+esp_err_t Query::_listFiles(const char *files)
+{
+    SDCard *card = SDCard::instance();
+    SDCardFile *list[MAX_FILE_LIST];
+    int count = 0;
+
+    this->_file_count = 0;
+    if (files != NULL && files[0] != '\0')
+    {
+        for (const char *p = files; *p != '\0' && this->_file_count < QUERY_MAX_FILES;)
+        {
+            size_t len = strcspn(p, ",");
+            if (len == 0 || len >= MAX_FILE_NAME || memchr(p, '/', len) != NULL)
+                return ESP_ERR_INVALID_ARG;
+            memcpy(this->_files[this->_file_count], p, len);
+            this->_files[this->_file_count++][len] = '\0';
+            p += len;
+            if (*p == ',')
+                p++;
+        }
+        return ESP_OK;
+    }
+
+    if (card->mount() != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+    if (card->listDir(&list[0], &count) != ESP_OK)
+    {
+        card->unmount();
+        return ESP_FAIL;
+    }
+    for (int i = 0; i < count && this->_file_count < QUERY_MAX_FILES; i++)
+    {
+        size_t len = strlen(list[i]->name);
+        if (len > 4 && strcasecmp(&list[i]->name[len - 4], ".csv") == 0)
+            strncpy(this->_files[this->_file_count++], list[i]->name, MAX_FILE_NAME);
+    }
+    card->clearFileList();
+    card->unmount();
+    sort_names(this->_files, this->_file_count);
+
+    // names carry the first row's time: drop files starting after the range or followed by one starting before it
+    int kept = 0;
+    for (int i = 0; i < this->_file_count; i++)
+    {
+        int64_t start = 0, next = 0;
+        bool timed = name_time(this->_files[i], &start);
+        if (timed && start >= this->_to_s)
+            continue;
+        if (timed && i + 1 < this->_file_count && name_time(this->_files[i + 1], &next) &&
+            next <= this->_from_s)
+            continue;
+        if (kept != i)
+            memcpy(this->_files[kept], this->_files[i], MAX_FILE_NAME);
+        kept++;
+    }
+    this->_file_count = kept;
+    return ESP_OK;
+}
+
+// one file from the first row in range, in card sessions of at most QUERY_SLICE_US
+esp_err_t Query::_scanFile(const char *name)
+{
+    SDCard *card = SDCard::instance();
+    uint64_t size = 0, offset = 0;
+    esp_err_t rc = ESP_OK;
+    bool done = false, first = true;
+
+    this->_line_len = 0;
+    this->_skip_line = false;
+    this->_grouped = false;
+    this->_columns = 1;
+    this->_end = 0;
+    while (!done && rc == ESP_OK)
+    {
+        if (card->mount() != ESP_OK)
+            return ESP_FAIL;
+        if (card->getFileSize(name, &size) != ESP_OK || card->openFile(name, "r") != ESP_OK)
+        {
+            card->unmount();
+            ESP_LOGW(TAG, "_scanFile(): %s not found", name);
+            return ESP_OK;
+        }
+        if (first)
+        {
+            first = false;
+            this->_readLayout();
+            offset = this->_seekStart(size);
+            this->_skip_line = (offset > 0);
+        }
+        int64_t start = esp_timer_get_time();
+        if (card->seekFile((long)offset) != ESP_OK)
+            rc = ESP_FAIL;
+        while (rc == ESP_OK && !done && esp_timer_get_time() - start < QUERY_SLICE_US)
+        {
+            ssize_t n = card->readFile(this->_buff, sizeof(this->_buff));
+            if (n <= 0)
+            {
+                done = true;
+                break;
+            }
+            offset += n;
+            for (ssize_t i = 0; i < n && !done; i++)
+            {
+                char c = this->_buff[i];
+                if (c == '\0') // preallocated reserve, end of the data
+                    done = true;
+                else if (c == '\n')
+                {
+                    this->_end = offset - n + i + 1;
+                    if (!this->_skip_line)
+                        done = !this->_row(this->_line, this->_line_len, &rc);
+                    this->_skip_line = false;
+                    this->_line_len = 0;
+                }
+                else if (this->_line_len < sizeof(this->_line) - 1)
+                    this->_line[this->_line_len++] = c;
+            }
+        }
+        card->closeFile();
+        card->unmount();
+        if (!done)
+            vTaskDelay(pdMS_TO_TICKS(QUERY_YIELD_MS));
+    }
+    return rc;
+}
+
+// column layout from the header lines of the open file
+esp_err_t Query::_readLayout(void)
+{
+    SDCard *card = SDCard::instance();
+    ssize_t n;
+
+    if (card->seekFile(0) != ESP_OK || (n = card->readFile(this->_buff, 2 * QUERY_LINE_LEN)) <= 0)
+        return ESP_FAIL;
+    this->_buff[(n < (ssize_t)sizeof(this->_buff)) ? n : n - 1] = '\0';
+    char *columns = strstr(this->_buff, "Datetime");
+    if (columns != NULL)
+    {
+        char *end = strchr(columns, '\n');
+        if (end != NULL)
+            *end = '\0';
+        this->_setLayout(columns);
+    }
+    return ESP_OK;
+}
+
+// layout from the column names line
+void Query::_setLayout(const char *columns)
+{
+    this->_grouped = (strstr(columns, "Tension 1") != NULL);
+    this->_columns = 0;
+    for (const char *p = strstr(columns, "Units"); p != NULL && this->_columns < SENSOR_CHANNELS; p = strstr(p + 1, "Units"))
+        this->_columns++;
+    if (this->_columns == 0)
+        this->_columns = 1;
+}
+
+// offset at or before the first row of the range, binary searched over rows in time order
+uint64_t Query::_seekStart(uint64_t size)
+{
+    SDCard *card = SDCard::instance();
+    uint64_t lo = 0, hi = size;
+
+    while (hi - lo > QUERY_READ_LEN)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        int64_t time_s = 0;
+        ssize_t n;
+        if (card->seekFile((long)mid) != ESP_OK || (n = card->readFile(this->_buff, 2 * QUERY_LINE_LEN)) <= 0)
+            break;
+        char *row = (char *)memchr(this->_buff, '\n', n);
+        if (row == NULL || !parseTime(row + 1, n - (row + 1 - this->_buff), &time_s) || time_s >= this->_from_s)
+            hi = mid; // in range, or reserve zeros past the data
+        else
+            lo = mid;
+    }
+    return lo;
+}
+
+// fold one row into the buckets, false once rows are past the range
+bool Query::_row(const char *line, size_t len, esp_err_t *rc)
+{
+    const char *field[QUERY_FIELDS];
+    size_t field_len[QUERY_FIELDS];
+    int fields = 0;
+    int64_t time_s;
+    tension_t value;
+    tension_unit units;
+
+    if (len > 0 && line[len - 1] == '\r')
+        len--;
+    if (!parseTime(line, len, &time_s))
+    { // header lines, a column line met after a rotation in the middle of a list
+        if (len >= 8 && strncmp(line, "Datetime", 8) == 0)
+        {
+            char columns[QUERY_LINE_LEN];
+            memcpy(columns, line, len);
+            columns[len] = '\0';
+            this->_setLayout(columns);
+        }
+        return true;
+    }
+    if (time_s < this->_from_s)
+        return true;
+    if (time_s >= this->_to_s)
+        return false;
+
+    for (size_t i = 0, start = 0; i <= len && fields < QUERY_FIELDS; i++)
+    {
+        if (i == len || line[i] == ',')
+        {
+            field[fields] = line + start;
+            field_len[fields++] = i - start;
+            start = i + 1;
+        }
+    }
+    if (this->_summary != NULL)
+    {
+        if (this->_summary->rows == 0)
+            this->_first_s = time_s;
+        this->_last_s = time_s;
+        summary_row(this->_summary, 0);
+        for (int channel = 0; channel < this->_columns; channel++)
+        {
+            if (this->_value(field, field_len, fields, channel, &value, &units))
+                summary_add(this->_summary, channel, value, units);
+        }
+        return true;
+    }
+    if (!this->_value(field, field_len, fields, this->_channel, &value, &units))
+        return true; // channel without a sample in this row
+
+    // a unit change closes the bucket like a new interval, values in different units are never mixed
+    int64_t bucket = time_s - time_s % this->_bucket_s;
+    if (this->_count > 0 && (bucket != this->_bucket || units != this->_units) && (*rc = this->_emit()) != ESP_OK)
+        return false;
+    if (this->_count == 0)
+    {
+        this->_bucket = bucket;
+        this->_sum = 0;
+        this->_min = value;
+        this->_max = value;
+        this->_units = units;
+    }
+    this->_sum += value;
+    this->_min = (value < this->_min) ? value : this->_min;
+    this->_max = (value > this->_max) ? value : this->_max;
+    this->_count++;
+    return true;
+}
+
+// tension and units of @channel among the @fields of a row, false when the channel has no sample in it
+bool Query::_value(const char **field, const size_t *field_len, int fields, int channel, tension_t *value, tension_unit *units)
+{
+    int value_idx, units_idx;
+    if (this->_grouped)
+    {
+        value_idx = 1 + 3 * channel;
+        units_idx = 3 + 3 * channel;
+    }
+    else
+    {
+        value_idx = (channel == 0) ? 1 : QUERY_FIELDS;
+        units_idx = fields - 1;
+    }
+    if (value_idx >= fields || units_idx >= fields || !tension_parse(field[value_idx], field_len[value_idx], value))
+        return false;
+    *units = tension_unit_parse(field[units_idx], field_len[units_idx]);
+    return true;
+}
+
+// column names, CSV header or the JSON object up to the rows
+esp_err_t Query::_header(void)
+{
+    char line[QUERY_OUT_LEN];
+    int len;
+
+    if (this->_format == query_csv)
+        len = snprintf(line, sizeof(line), "Time");
+    else
+        len = snprintf(line, sizeof(line), "{\"bucket\":%u,\"channel\":%d,\"columns\":[\"time\"", this->_bucket_s, this->_channel);
+    for (int i = 0; i < this->_agg_count; i++)
+        len += snprintf(line + len, sizeof(line) - len, (this->_format == query_csv) ? ",%s" : ",\"%s\"", agg_names[this->_aggs[i]]);
+    len += snprintf(line + len, sizeof(line) - len, (this->_format == query_csv) ? ",units\r\n" : ",\"units\"],\"rows\":[");
+    return this->_writer(this->_ctx, line, len);
+}
+
+// the current bucket as one row
+esp_err_t Query::_emit(void)
+{
+    char line[QUERY_OUT_LEN], *p = line, *end = line + sizeof(line);
+    bool json = (this->_format == query_json);
+    int64_t half = this->_count / 2;
+    tm time;
+
+    civil_from_time((time_t)this->_bucket, &time);
+    p += snprintf(p, end - p, json ? "%s[\"%04d-%02d-%02dT%02d:%02d:%02d\"" : "%s%04d-%02d-%02dT%02d:%02d:%02d",
+                  (json && this->_rows > 0) ? "," : "", time.tm_year + 1900, time.tm_mon + 1, time.tm_mday,
+                  time.tm_hour, time.tm_min, time.tm_sec);
+    for (int i = 0; i < this->_agg_count; i++)
+    {
+        *p++ = ',';
+        switch (this->_aggs[i])
+        {
+        case agg_min:
+            p += tension_format(p, end - p, this->_min);
+            break;
+        case agg_max:
+            p += tension_format(p, end - p, this->_max);
+            break;
+        case agg_mean:
+            p += tension_format(p, end - p, (tension_t)(((this->_sum >= 0) ? this->_sum + half : this->_sum - half) / this->_count));
+            break;
+        case agg_count:
+            p += snprintf(p, end - p, "%u", this->_count);
+            break;
+        }
+    }
+    p += snprintf(p, end - p, json ? ",\"%s\"]" : ",%s\r\n", tension_unit_name(this->_units));
+    this->_count = 0;
+    this->_rows++;
+    return this->_writer(this->_ctx, line, p - line);
+}
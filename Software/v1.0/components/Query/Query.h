@@ -0,0 +1,129 @@
+/*
+
+
+
+
+*/
+
+#ifndef QUERY_H
+#define QUERY_H
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "System.h"
+#include "TimeFormat.h"
+#include "Sensor.h"
+#include "SDCard.h"
+#include "Summary.h"
+
+#define QUERY_MAX_FILES MAX_FILE_LIST
+#define QUERY_READ_LEN FILE_BUFFER // sequential card reads, one stdio buffer each
+#define QUERY_LINE_LEN 256
+#define QUERY_FIELDS (1 + 3 * SENSOR_CHANNELS)
+#define QUERY_AGGS 4
+#define QUERY_SLICE_US 250000LL // card held at most this long before the storage task gets a turn
+#define QUERY_YIELD_MS 20
+#define QUERY_TIME_LEN 19       // "YYYY-MM-DDTHH:MM:SS", the part of a row time that is parsed
+#define QUERY_OUT_LEN 160
+
+enum query_agg : uint8_t
+{
+    agg_min,
+    agg_max,
+    agg_mean,
+    agg_count
+};
+
+enum query_format
+{
+    query_json,
+    query_csv
+};
+
+// result output, called once per row
+typedef esp_err_t (*query_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Log file query
+
+  One pass over the CSV files: rows between from and to are grouped into
+  fixed buckets of local time and min / max / mean / count of one
+  channel's tension are kept per bucket, so memory stays at one read
+  buffer and one line whatever the file size. The start row is found
+  by a binary search on file offsets, as rows are in time order. The
+  card is mounted in slices of QUERY_SLICE_US so logging goes on during
+  long queries. Times are local wall clock seconds, as in the files.
+  Aggregates are over the rows present - with compression enabled
+  these are the kept points, not every sample. A change of units
+  closes the bucket early, the next row repeats its time in the new
+  units. summarize() runs the same scan over a whole file to backfill
+  its sidecar.
+*/
+class Query
+{
+public:
+    esp_err_t init(int channel, int64_t from_s, int64_t to_s, uint32_t bucket_s, const char *aggs, query_format format);
+    esp_err_t run(const char *files, query_writer_t writer, void *ctx);
+    esp_err_t summarize(const char *name, FileSummary *summary);
+    static bool parseTime(const char *text, size_t len, int64_t *time_s);
+    static uint32_t parseDuration(const char *text);
+
+private:
+    // request
+    int _channel = 0;
+    int64_t _from_s = 0;
+    int64_t _to_s = INT64_MAX;
+    uint32_t _bucket_s = 60;
+    query_agg _aggs[QUERY_AGGS];
+    int _agg_count = 0;
+    query_format _format = query_json;
+    // files
+    char _files[QUERY_MAX_FILES][MAX_FILE_NAME];
+    int _file_count = 0;
+    // scan state
+    char _buff[QUERY_READ_LEN];
+    char _line[QUERY_LINE_LEN];
+    size_t _line_len = 0;
+    bool _skip_line = false; // started mid row after a seek
+    bool _grouped = false;   // Tension / Peak / Units per channel layout
+    int _columns = 1;        // channels in the file
+    uint64_t _end = 0;       // bytes up to the last complete row
+    // current bucket
+    int64_t _bucket = 0;
+    int64_t _sum = 0;
+    tension_t _min = 0;
+    tension_t _max = 0;
+    uint32_t _count = 0;
+    tension_unit _units = unit_none;
+    uint32_t _rows = 0; // buckets written
+    query_writer_t _writer = NULL;
+    void *_ctx = NULL;
+    // summarize()
+    FileSummary *_summary = NULL;
+    int64_t _first_s = 0;
+    int64_t _last_s = 0;
+
+    esp_err_t _listFiles(const char *files);
+    esp_err_t _scanFile(const char *name);
+    esp_err_t _readLayout(void);
+    void _setLayout(const char *columns);
+    uint64_t _seekStart(uint64_t size);
+    bool _row(const char *line, size_t len, esp_err_t *rc);
+    bool _value(const char **field, const size_t *field_len, int fields, int channel, tension_t *value, tension_unit *units);
+    esp_err_t _emit(void);
+    esp_err_t _header(void);
+};
+
+#endif // Query.h
@@ -0,0 +1,328 @@
+/*
+
+
+
+
+*/
+
+#include "Rollup.h"
+
+static const char *TAG = "Rollup";
+
+static const uint32_t steps[ROLLUP_LEVELS] = ROLLUP_STEPS;
+
+/* Null, because instance will be initialized on demand. */
+Rollup *Rollup::inst = 0;
+
+//
+Rollup::Rollup()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Rollup(): failed to create semaphore");
+    this->_dropped_metric = Metrics::instance()->counter("rollup_dropped_total", "", "buckets lost to a full queue or a clock step back");
+}
+
+//
+Rollup *Rollup::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Rollup(): creating instance");
+        inst = SINGLETON_NEW(Rollup);
+    }
+    return inst;
+}
+
+// bucket seconds of @level
+uint32_t Rollup::step(int level)
+{
+    return (level >= 0 && level < ROLLUP_LEVELS) ? steps[level] : 0;
+}
+
+// count one sample of the storage task's tick
+esp_err_t Rollup::add(const SensorData *data)
+{
+    if (data == NULL || data->channel >= SENSOR_CHANNELS || data->timestamp < 0)
+        return ESP_ERR_INVALID_ARG;
+    uint32_t time_s = (uint32_t)(data->timestamp / US_PER_SEC);
+    SEMAPHORE_TAKE();
+    // every channel's bucket closes on the shared boundary, a silent channel's must not reach the file after newer ones
+    for (int level = 0; level < ROLLUP_LEVELS; level++)
+    {
+        for (int c = 0; c < SENSOR_CHANNELS; c++)
+        {
+            if (this->_acc[level][c].count > 0 && this->_acc[level][c].time_s < time_s - time_s % steps[level])
+                this->_close(level, c);
+        }
+    }
+    this->_fold(0, data->channel, time_s, data->units, 1, data->tension, data->tension, data->tension);
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// add @count samples at @time_s to the @level bucket, closing it first when the time or unit moved on
+void Rollup::_fold(int level, uint8_t channel, uint32_t time_s, uint8_t units, uint32_t count,
+                   int64_t sum, tension_t min, tension_t max)
+{
+    rollup_acc *acc = &this->_acc[level][channel];
+
+    time_s -= time_s % steps[level];
+    if (acc->count > 0 && (acc->time_s != time_s || acc->units != units))
+        this->_close(level, channel);
+    if (acc->count == 0)
+    {
+        acc->sum = 0;
+        acc->min = min;
+        acc->max = max;
+        acc->time_s = time_s;
+        acc->units = units;
+    }
+    acc->sum += sum;
+    acc->min = (min < acc->min) ? min : acc->min;
+    acc->max = (max > acc->max) ? max : acc->max;
+    acc->count += count;
+}
+
+// queue the @level bucket of @channel for the card and pass it up a level
+void Rollup::_close(int level, uint8_t channel)
+{
+    rollup_acc *acc = &this->_acc[level][channel];
+    int64_t half = acc->count / 2;
+
+    if (this->_head[level] - this->_tail[level] < ROLLUP_PENDING)
+    {
+        RollupRecord *out = &this->_pending[level][this->_head[level] % ROLLUP_PENDING];
+        out->time_s = acc->time_s;
+        out->count = acc->count;
+        out->min = acc->min;
+        out->max = acc->max;
+        out->mean = (tension_t)(((acc->sum >= 0) ? acc->sum + half : acc->sum - half) / (int64_t)acc->count);
+        out->units = acc->units;
+        out->channel = channel;
+        out->magic = ROLLUP_MAGIC;
+        this->_head[level]++;
+    }
+    else
+        Metrics::instance()->inc(this->_dropped_metric);
+    if (level + 1 < ROLLUP_LEVELS)
+        this->_fold(level + 1, channel, acc->time_s, acc->units, acc->count, acc->sum, acc->min, acc->max);
+    acc->count = 0;
+}
+
+// append queued buckets to the level files - the caller has the card mounted and no file open
+esp_err_t Rollup::flush(void)
+{
+    SDCard *card = SDCard::instance();
+    RollupRecord out[ROLLUP_PENDING];
+    char name[MAX_FILE_NAME];
+    esp_err_t rc = ESP_OK;
+
+    for (int level = 0; level < ROLLUP_LEVELS; level++)
+    {
+        uint32_t tail;
+        int n = 0;
+
+        SEMAPHORE_TAKE();
+        tail = this->_tail[level];
+        for (; tail + n != this->_head[level]; n++)
+            out[n] = this->_pending[level][(tail + n) % ROLLUP_PENDING];
+        SEMAPHORE_GIVE();
+        if (n == 0)
+            continue;
+
+        snprintf(name, sizeof(name), ROLLUP_FILE, steps[level]);
+        if ((!this->_checked[level] && this->_check(level, name) != ESP_OK) || card->openFile(name, "a") != ESP_OK)
+        {
+            rc = ESP_FAIL;
+            continue;
+        }
+        esp_err_t wrc = ESP_OK;
+        uint32_t last_s = this->_last_s[level];
+        for (int i = 0; i < n && wrc == ESP_OK; i++)
+        {
+            if (out[i].time_s < last_s)
+            { // clock stepped back, the file stays sorted
+                Metrics::instance()->inc(this->_dropped_metric);
+                continue;
+            }
+            wrc = card->writeFile((const char *)&out[i], sizeof(RollupRecord));
+            last_s = out[i].time_s;
+        }
+        if (card->closeFile() != ESP_OK || wrc != ESP_OK)
+        { // a torn record is cut off by the next _check(), the queue is written again
+            ESP_LOGE(TAG, "flush(): failed to write %s", name);
+            this->_checked[level] = false;
+            rc = ESP_FAIL;
+            continue;
+        }
+        this->_last_s[level] = last_s;
+        SEMAPHORE_TAKE();
+        this->_tail[level] = tail + n;
+        SEMAPHORE_GIVE();
+    }
+    return rc;
+}
+
+// cut a torn record off the @level file and read its newest time
+esp_err_t Rollup::_check(int level, const char *name)
+{
+    SDCard *card = SDCard::instance();
+    RollupRecord last;
+    uint64_t size = 0;
+
+    if (card->getFileSize(name, &size) != ESP_OK)
+    { // not created yet
+        this->_last_s[level] = 0;
+        this->_checked[level] = true;
+        return ESP_OK;
+    }
+    if (size % sizeof(RollupRecord))
+    {
+        size -= size % sizeof(RollupRecord);
+        ESP_LOGW(TAG, "_check(): %s cut to %llu bytes", name, size);
+        if (card->truncateFile(name, size) != ESP_OK)
+            return ESP_FAIL;
+    }
+    this->_last_s[level] = 0;
+    if (size > 0)
+    {
+        if (card->openFile(name, "r") != ESP_OK)
+            return ESP_FAIL;
+        esp_err_t rc = this->_readRecord(size / sizeof(RollupRecord) - 1, &last);
+        card->closeFile();
+        if (rc != ESP_OK)
+            return ESP_FAIL;
+        this->_last_s[level] = last.time_s;
+    }
+    this->_checked[level] = true;
+    return ESP_OK;
+}
+
+// record @index of the open file
+esp_err_t Rollup::_readRecord(uint32_t index, RollupRecord *out)
+{
+    SDCard *card = SDCard::instance();
+    if (card->seekFile((long)index * sizeof(RollupRecord)) != ESP_OK ||
+        card->readFile((char *)out, sizeof(RollupRecord)) != sizeof(RollupRecord) || out->magic != ROLLUP_MAGIC)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+// "[dt_s, count, min, max, mean, unit]", dt from the previous row
+esp_err_t Rollup::_writeRow(rollup_writer_t writer, void *ctx, const RollupRecord *in, uint32_t *last_s, bool first)
+{
+    char line[ROLLUP_LINE_LEN];
+    int len = snprintf(line, sizeof(line), "%s[%d,%u,%d,%d,%d,%u]", first ? "" : ",", (int)(in->time_s - *last_s),
+                       in->count, in->min, in->max, in->mean, in->units);
+    *last_s = in->time_s;
+    return writer(ctx, line, len);
+}
+
+// stream @channel buckets starting in [@from_s, @to_s] as JSON, from the coarsest level with a step of at most @resolution_s
+esp_err_t Rollup::query(int channel, uint32_t from_s, uint32_t to_s, uint32_t resolution_s, rollup_writer_t writer, void *ctx)
+{
+    SDCard *card = SDCard::instance();
+    RollupRecord pending[ROLLUP_PENDING];
+    char line[ROLLUP_LINE_LEN], name[MAX_FILE_NAME];
+    uint64_t size = 0;
+    uint32_t lo = 0, hi = 0, last_s = 0, rows = 0, written_s = 0;
+    int level = 0, n = 0;
+    bool done = false;
+    esp_err_t rc = ESP_OK;
+
+    for (int l = 1; l < ROLLUP_LEVELS; l++)
+    {
+        if (steps[l] <= resolution_s)
+            level = l;
+    }
+    from_s -= from_s % steps[level]; // the bucket holding @from_s
+    snprintf(name, sizeof(name), ROLLUP_FILE, steps[level]);
+
+    // first record at or after from_s, nothing is sent when the card is missing
+    if (card->mount() != ESP_OK)
+        return ESP_FAIL;
+    if (card->getFileSize(name, &size) == ESP_OK && size >= sizeof(RollupRecord) && card->openFile(name, "r") == ESP_OK)
+    {
+        hi = size / sizeof(RollupRecord);
+        while (lo < hi && rc == ESP_OK)
+        {
+            uint32_t mid = lo + (hi - lo) / 2;
+            rc = this->_readRecord(mid, &this->_read[0]);
+            if (this->_read[0].time_s < from_s)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        card->closeFile();
+    }
+    card->unmount();
+    if (rc != ESP_OK)
+        return ESP_FAIL;
+
+    int len = snprintf(line, sizeof(line), "{\"step\":%u,\"scale\":%d,\"units\":[", steps[level], TENSION_SCALE);
+    rc = writer(ctx, line, len);
+    for (int u = 0; u < unit_count && rc == ESP_OK; u++)
+    {
+        len = snprintf(line, sizeof(line), "%s\"%s\"", (u > 0) ? "," : "", tension_unit_name((tension_unit)u));
+        rc = writer(ctx, line, len);
+    }
+    if (rc == ESP_OK)
+        rc = writer(ctx, "],\"rows\":[", 10);
+
+    // one card session per ROLLUP_READ records, the card is never held while rows go to a slow client
+    while (rc == ESP_OK && !done && rows < ROLLUP_QUERY_MAX)
+    {
+        ssize_t got = 0;
+        if (card->mount() != ESP_OK)
+        {
+            rc = ESP_FAIL;
+            break;
+        }
+        if (card->getFileSize(name, &size) == ESP_OK && lo < size / sizeof(RollupRecord) && card->openFile(name, "r") == ESP_OK)
+        {
+            if (card->seekFile((long)lo * sizeof(RollupRecord)) == ESP_OK)
+                got = card->readFile((char *)this->_read, sizeof(this->_read)) / (ssize_t)sizeof(RollupRecord);
+            card->closeFile();
+        }
+        if (got <= 0)
+        { // end of the file - buckets still queued for it, taken while the card session keeps flush() out
+            done = true;
+            if (LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))
+            {
+                for (uint32_t s = this->_tail[level]; s != this->_head[level]; s++)
+                    pending[n++] = this->_pending[level][s % ROLLUP_PENDING];
+                LOCK_GIVE(this->xSemaphore);
+            }
+        }
+        card->unmount();
+
+        lo += (got > 0) ? got : 0;
+        for (int i = 0; i < got && rc == ESP_OK; i++)
+        {
+            if (this->_read[i].time_s > to_s)
+            {
+                done = true;
+                break;
+            }
+            if (this->_read[i].magic != ROLLUP_MAGIC || (channel >= 0 && this->_read[i].channel != channel))
+                continue;
+            rc = this->_writeRow(writer, ctx, &this->_read[i], &last_s, rows == 0);
+            written_s = this->_read[i].time_s;
+            rows++;
+        }
+    }
+
+    for (int i = 0; i < n && rc == ESP_OK && rows < ROLLUP_QUERY_MAX; i++)
+    {
+        if (pending[i].time_s < from_s || pending[i].time_s > to_s || pending[i].time_s < written_s ||
+            (channel >= 0 && pending[i].channel != channel))
+            continue;
+        rc = this->_writeRow(writer, ctx, &pending[i], &last_s, rows == 0);
+        rows++;
+    }
+    if (rc != ESP_OK)
+        return ESP_FAIL;
+    len = snprintf(line, sizeof(line), "],\"truncated\":%s}", (rows >= ROLLUP_QUERY_MAX) ? "true" : "false");
+    return writer(ctx, line, len);
+}
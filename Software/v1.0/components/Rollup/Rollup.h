@@ -0,0 +1,114 @@
+/*
+
+
+
+
+*/
+
+#ifndef ROLLUP_H
+#define ROLLUP_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "System.h"
+#include "Sensor.h"
+#include "SDCard.h"
+#include "Metrics.h"
+
+#define ROLLUP_LEVELS 3
+#define ROLLUP_STEPS {60, 900, 3600} // bucket seconds per level, each a multiple of the one before
+#define ROLLUP_FILE ".rollup%u.bin"  // per level, hidden from /listdir
+#define ROLLUP_MAGIC 0x5255
+#define ROLLUP_PENDING 32       // closed buckets per level waiting for the card
+#define ROLLUP_READ 64          // records per card session of query()
+#define ROLLUP_QUERY_MAX 5000   // rows per response
+#define ROLLUP_LINE_LEN 96
+
+// one bucket of one channel, the level files are arrays of these in time order - 24 bytes
+struct RollupRecord
+{
+    uint32_t time_s; // epoch seconds of the bucket start
+    uint32_t count;
+    tension_t min;
+    tension_t max;
+    tension_t mean;
+    uint8_t units;
+    uint8_t channel;
+    uint16_t magic;
+};
+
+static_assert(sizeof(RollupRecord) == 24, "RollupRecord is the file layout");
+
+// the bucket a channel is building on one level
+struct rollup_acc
+{
+    int64_t sum;
+    tension_t min;
+    tension_t max;
+    uint32_t time_s;
+    uint32_t count; // 0 - nothing collected
+    uint8_t units;
+};
+
+// exported JSON output, called once per row
+typedef esp_err_t (*rollup_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Rollup store
+
+  Every sample the storage task takes is counted into per channel
+  buckets of 1 min; a closed bucket is queued for the card and folded
+  into the 15 min bucket, which feeds the 1 h one in turn. The buckets
+  of all channels close together when any sample crosses their end, so
+  a channel that went silent still keeps the files in time order. Queued
+  buckets are appended to one fixed record file per level while the
+  storage writer has the card mounted. Records are in time order, so a
+  query binary searches its start and reads only the range, from the
+  coarsest level that still meets the requested resolution, mounting
+  the card for one read of ROLLUP_READ records at a time. Buckets
+  still open at a reset are lost.
+*/
+class Rollup
+{
+public:
+    static Rollup *instance(void);
+    esp_err_t add(const SensorData *data);
+    esp_err_t flush(void);
+    esp_err_t query(int channel, uint32_t from_s, uint32_t to_s, uint32_t resolution_s, rollup_writer_t writer, void *ctx);
+    static uint32_t step(int level);
+
+private:
+    static Rollup *inst;
+    Rollup();
+    Rollup(const Rollup *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    rollup_acc _acc[ROLLUP_LEVELS][SENSOR_CHANNELS] = {};
+    RollupRecord _pending[ROLLUP_LEVELS][ROLLUP_PENDING];
+    uint32_t _head[ROLLUP_LEVELS] = {}; // buckets queued
+    uint32_t _tail[ROLLUP_LEVELS] = {}; // buckets written
+    // level files, touched by flush() only
+    uint32_t _last_s[ROLLUP_LEVELS] = {}; // newest record in the file, keeps it sorted
+    bool _checked[ROLLUP_LEVELS] = {};
+    // query() read buffer, one request at a time on the server task
+    RollupRecord _read[ROLLUP_READ];
+    int _dropped_metric = -1;
+
+    void _fold(int level, uint8_t channel, uint32_t time_s, uint8_t units, uint32_t count,
+               int64_t sum, tension_t min, tension_t max);
+    void _close(int level, uint8_t channel);
+    esp_err_t _check(int level, const char *name);
+    esp_err_t _readRecord(uint32_t index, RollupRecord *out);
+    esp_err_t _writeRow(rollup_writer_t writer, void *ctx, const RollupRecord *in, uint32_t *last_s, bool first);
+};
+
+#endif // Rollup.h
@@ -52,7 +52,7 @@ SDCard *SDCard::instance(void)
   if (inst == 0)
   {
     ESP_LOGI(TAG, "SDCard(): creating instance");
-    inst = new SDCard();
+    inst = SINGLETON_NEW(SDCard);
   }
   return inst;
 }
@@ -68,6 +68,18 @@ esp_err_t SDCard::checkCard(void)
   else
   {
     System::instance()->setErrorFlag(disk_not_found);
+#ifdef CONFIG_STATIC_MEMORY
+    // card pulled while the volume was kept mounted, drop it outside a session
+    if (this->_volume && !this->mounted && LOCK_TAKE(this->xSemaphore, 0) == pdTRUE)
+    {
+      if (this->_volume && !this->mounted)
+      {
+        esp_vfs_fat_sdcard_unmount(SD_CARD_MOUNT_POINT, this->_card);
+        this->_volume = false;
+      }
+      LOCK_GIVE(this->xSemaphore);
+    }
+#endif
     return ESP_FAIL;
   }
 }
@@ -110,9 +122,17 @@ esp_err_t SDCard::init(uint8_t cd_pin)
 // Mounting the SD card
 esp_err_t SDCard::mount()
 {
+  TRACE_SCOPE("sd mount");
   CHECK_CARD();
   SEMAPHORE_TAKE(); // semaphore released by umount() function
 
+#ifdef CONFIG_STATIC_MEMORY
+  if (this->_volume) // still mounted from the last session
+  {
+    this->mounted = true;
+    return ESP_OK;
+  }
+#endif
   // mount
   esp_err_t ret = esp_vfs_fat_sdmmc_mount(SD_CARD_MOUNT_POINT, &this->host, &this->slot_config, &this->mount_config, &this->_card);
   if (ret != ESP_OK)
@@ -124,6 +144,7 @@ esp_err_t SDCard::mount()
   // DEBUG
   //sdmmc_card_print_info(stdout, this->_card);
   //ESP_LOGI(TAG, "init(): card mounted");
+  this->_volume = true;
   this->mounted = true;
   return ESP_OK;
 }
@@ -163,8 +184,19 @@ esp_err_t SDCard::getCardSpace(SDCardSpace *card_space)
 // unmount the SD card
 esp_err_t SDCard::unmount(void)
 {
+  TRACE_SCOPE("sd unmount");
   //CHECK_CARD();
+#ifdef CONFIG_STATIC_MEMORY
+  // mounting allocates, the volume stays mounted while the card is in - closed files are already synced
+  if (this->checkCard() == ESP_OK)
+  {
+    this->mounted = false;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+  }
+#endif
   esp_err_t ret = esp_vfs_fat_sdcard_unmount(SD_CARD_MOUNT_POINT, this->_card);
+  this->_volume = false;
   SEMAPHORE_GIVE();
   if (ret != ESP_OK)
   {
@@ -178,23 +210,16 @@ esp_err_t SDCard::unmount(void)
 // get file info
 esp_err_t SDCard::_getStat(const char *path, struct stat *_stat)
 {
-  char *temp = (char *)malloc(strlen(path) + strlen(SD_CARD_MOUNT_POINT) + 2);
-  if (!temp)
-  {
-    ESP_LOGE(TAG, "_getStat(): malloc failed");
-    return ESP_FAIL;
-  }
+  char temp[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1];
+  if (snprintf(temp, sizeof(temp), "%s/%s", SD_CARD_MOUNT_POINT, path) >= (int)sizeof(temp))
+    return ESP_ERR_INVALID_SIZE;
 
-  sprintf(temp, "%s/%s", SD_CARD_MOUNT_POINT, path);
   int ret = stat(temp, _stat);
   if (ret == -1)
   {
-    free(temp);
     ESP_LOGW(TAG, "_getStat(): stat returned %d", ret);
     return ESP_ERR_INVALID_STATE;
   }
-
-  free(temp);
   return ESP_OK;
 }
 
@@ -215,17 +240,26 @@ esp_err_t SDCard::listDir(SDCardFile **list, int *file_num)
 
   while ((ep = readdir(dp)) != NULL)
   {
-    if (this->_getStat(ep->d_name, &_stat) == ESP_ERR_INVALID_STATE)
+    if (ep->d_name[0] == '.') // internal files, e.g. preallocated log file
+      continue;
+    if (this->_getStat(ep->d_name, &_stat) != ESP_OK) // gone, or a name too long to list
       continue;
     //ESP_LOGI(TAG, "file:%s st_dev: %hi st_ino: %hi, st_mode:%i, st_nlink:%hi, st_uid:%hi, st_gid:%hi, st_rdev:%hi, off_t:%li",
     //         ep->d_name, _stat.st_dev, _stat.st_ino, _stat.st_mode, _stat.st_nlink, _stat.st_uid, _stat.st_gid, _stat.st_rdev, _stat.st_size);
     if (S_ISREG(_stat.st_mode)) // if file
     {
       // Allocating memory for new file info structure
-      SDCardFile *file_data = (SDCardFile *)malloc(sizeof(SDCardFile));
+      if (this->_file_num >= MAX_FILE_LIST)
+        break;
+#ifdef CONFIG_STATIC_MEMORY
+      SDCardFile *file_data = &this->_file_pool[this->_file_num];
+#else
+      SDCardFile *file_data = (SDCardFile *)Memory::instance()->alloc(sizeof(SDCardFile), mem_site_sdcard);
+#endif
       if (!file_data)
       {
         ESP_LOGE(TAG, "listDir(): malloc failed\n");
+        closedir(dp);
         return ESP_ERR_NO_MEM;
       }
       memset(file_data->name, 0, CARD_NAME);
@@ -238,6 +272,7 @@ esp_err_t SDCard::listDir(SDCardFile **list, int *file_num)
       this->_file_num++;
     }
   }
+  closedir(dp);
   *file_num = this->_file_num;
   return ESP_OK;
 }
@@ -245,8 +280,10 @@ esp_err_t SDCard::listDir(SDCardFile **list, int *file_num)
 // Private function used to de-allocate the file list memory
 void SDCard::clearFileList(void)
 {
+#ifndef CONFIG_STATIC_MEMORY
   for (int i = 0; i < this->_file_num; i++)
-    free(this->_file_list[i]);
+    Memory::instance()->release(this->_file_list[i]);
+#endif
   this->_file_num = 0;
 }
 
@@ -254,28 +291,23 @@ void SDCard::clearFileList(void)
 esp_err_t SDCard::openFile(const char *path, const char *permission)
 {
   CHECK_MOUNTED();
-  char *temp = (char *)malloc(strlen(path) + strlen(SD_CARD_MOUNT_POINT) + 2);
-  if (!temp)
-    return ESP_ERR_NO_MEM;
-
-  sprintf(temp, "%s/%s", SD_CARD_MOUNT_POINT, path);
+  char temp[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1];
+  if (snprintf(temp, sizeof(temp), "%s/%s", SD_CARD_MOUNT_POINT, path) >= (int)sizeof(temp))
+    return ESP_ERR_INVALID_SIZE;
 
   this->_file = fopen(temp, permission);
   if (!this->_file)
   {
     ESP_LOGE(TAG, "openFile(): failed to open file - %s\n", temp);
-    free(temp);
     return ESP_FAIL;
   }
-  // increasing file buffer size
-  if (setvbuf(this->_file, NULL, _IOFBF, FILE_BUFFER) != 0)
+  // increasing file buffer size, one file is open at a time so the buffer is reused
+  if (setvbuf(this->_file, this->_file_buffer, _IOFBF, FILE_BUFFER) != 0)
   {
     ESP_LOGE(TAG, "openFile(): setvbuf failed\n"); // POSIX version sets errno
-    free(temp);
     fclose(this->_file);
     return ESP_FAIL;
   }
-  free(temp);
   return ESP_OK;
 }
 
@@ -312,16 +344,40 @@ esp_err_t SDCard::writeFile(const char *message)
     return ESP_FAIL;
 }
 
+// write @len bytes of @buff to the open file
+esp_err_t SDCard::writeFile(const char *buff, size_t len)
+{
+  CHECK_MOUNTED();
+  if (!this->_file)
+    return ESP_ERR_INVALID_STATE;
+  if (fwrite(buff, 1, len, this->_file) == len)
+    return ESP_OK;
+  else
+    return ESP_FAIL;
+}
+
+// move the position of the open file to @offset from the beginning
+esp_err_t SDCard::seekFile(long offset)
+{
+  CHECK_MOUNTED();
+  if (!this->_file)
+    return ESP_ERR_INVALID_STATE;
+  if (fseek(this->_file, offset, SEEK_SET) != 0)
+  {
+    ESP_LOGE(TAG, "seekFile(): fseek to %ld failed", offset);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
 // Remove file from SD card
 esp_err_t SDCard::deleteFile(const char *path)
 {
   CHECK_MOUNTED();
-  char *temp = (char *)malloc(strlen(path) + strlen(SD_CARD_MOUNT_POINT) + 2);
+  char temp[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1];
   esp_err_t err;
-  if (!temp)
-    return ESP_ERR_NO_MEM;
-
-  sprintf(temp, "%s/%s", SD_CARD_MOUNT_POINT, path);
+  if (snprintf(temp, sizeof(temp), "%s/%s", SD_CARD_MOUNT_POINT, path) >= (int)sizeof(temp))
+    return ESP_ERR_INVALID_SIZE;
 
   if (remove(temp) != 0)
   {
@@ -330,8 +386,6 @@ esp_err_t SDCard::deleteFile(const char *path)
   }
   else
     err = ESP_OK;
-
-  free(temp);
   return err;
 }
 
@@ -390,13 +444,11 @@ esp_err_t SDCard::checkFile(const char *filename)
 {
   CHECK_MOUNTED();
   struct stat st;
-  char *temp = (char *)malloc(strlen(filename) + strlen(SD_CARD_MOUNT_POINT) + 2);
-  if (!temp)
-    return ESP_ERR_NO_MEM;
-  sprintf(temp, "%s/%s", SD_CARD_MOUNT_POINT, filename);
+  char temp[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1];
+  if (snprintf(temp, sizeof(temp), "%s/%s", SD_CARD_MOUNT_POINT, filename) >= (int)sizeof(temp))
+    return ESP_ERR_INVALID_SIZE;
 
   int rc = stat(temp, &st);
-  free(temp);
 
   if (rc == 0)
     return ESP_OK;
@@ -427,15 +479,54 @@ esp_err_t SDCard::checkFile(const char *filename)
 // }
 
 // get file size
-// esp_err_t SDCard::getFileSize(const char *filename, uint64_t *size)
-// {
-//   CHECK_MOUNTED();
-//   struct stat _stat;
+esp_err_t SDCard::getFileSize(const char *filename, uint64_t *size)
+{
+  CHECK_MOUNTED();
+  struct stat _stat;
 
-//   if (this->_getStat(filename, &_stat) != ESP_OK)
-//     return ESP_FAIL;
-//   else
-//     *size = _stat.st_size;
+  if (this->_getStat(filename, &_stat) != ESP_OK)
+    return ESP_ERR_NOT_FOUND;
+  *size = _stat.st_size;
+  return ESP_OK;
+}
 
-//   return ESP_OK;
-// }
\ No newline at end of file
+// rename file @from to @to, directory entry only - no data is moved
+esp_err_t SDCard::renameFile(const char *from, const char *to)
+{
+  CHECK_MOUNTED();
+  char src[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1], dst[MAX_FILE_NAME + sizeof(SD_CARD_MOUNT_POINT) + 1];
+
+  snprintf(src, sizeof(src), "%s/%s", SD_CARD_MOUNT_POINT, from);
+  snprintf(dst, sizeof(dst), "%s/%s", SD_CARD_MOUNT_POINT, to);
+  if (rename(src, dst) != 0)
+  {
+    ESP_LOGE(TAG, "renameFile(): failed to rename %s to %s", src, dst);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// cut file down to @size bytes, releasing clusters past the end (VFS has no truncate - FatFs is used directly)
+esp_err_t SDCard::truncateFile(const char *filename, uint64_t size)
+{
+  CHECK_MOUNTED();
+  char path[MAX_FILE_NAME + sizeof(SD_CARD_DRIVE) + 1];
+  FIL fil;
+
+  snprintf(path, sizeof(path), "%s/%s", SD_CARD_DRIVE, filename);
+  if (f_open(&fil, path, FA_WRITE | FA_OPEN_EXISTING) != FR_OK)
+  {
+    ESP_LOGE(TAG, "truncateFile(): failed to open %s", path);
+    return ESP_FAIL;
+  }
+  FRESULT rc = f_lseek(&fil, (FSIZE_t)size);
+  if (rc == FR_OK)
+    rc = f_truncate(&fil);
+  f_close(&fil);
+  if (rc != FR_OK)
+  {
+    ESP_LOGE(TAG, "truncateFile(): failed to truncate %s to %llu (%d)", path, size, rc);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
@@ -32,15 +32,22 @@
 #include "sdmmc_cmd.h"
 
 #include "System.h"
+#include "Trace.h"
+#include "Memory.h"
 
 #define SD_CARD_MOUNT_POINT "/sdcard"
+#define SD_CARD_DRIVE "0:" // FatFs logical drive of the mounted card
 
-#define MAX_FILE_NAME 25
+#define MAX_FILE_NAME 28 // ".YYYY-MM-DD_HH-MM-SS_NN.sum" + '\0', sidecar of the longest log name
 #define MAX_FILE_LIST 100
 
 #define FILE_BUFFER 4096 // buffer for read and write - 16 * 1024 - 16KB
 #define LINE_BUFFER 128
 
+#if defined(CONFIG_STATIC_MEMORY) && defined(CONFIG_FATFS_LFN_HEAP)
+#warning "static memory mode: FatFs long file name buffers come from the heap, select FATFS_LFN_STACK"
+#endif
+
 #define CARD_NAME 20
 #define CD_PIN 27 //* Pin for card detection
 //#define NOT_A_FILE 10
@@ -83,13 +90,17 @@ public:
   esp_err_t closeFile(void);
   ssize_t readFile(char *buff, size_t len);
   esp_err_t writeFile(const char *message);
+  esp_err_t writeFile(const char *buff, size_t len);
+  esp_err_t seekFile(long offset);
   esp_err_t deleteFile(const char *path);
   esp_err_t testFileIO(const char *path, uint32_t *write_speed, uint32_t *read_speed);
   void clearFileList(void);
   //esp_err_t getFileName(char *buff, size_t len);
   //esp_err_t setFileName(const char *new_name);
   esp_err_t checkFile(const char *filename);
-  //esp_err_t getFileSize(const char *filename, uint64_t *size);
+  esp_err_t getFileSize(const char *filename, uint64_t *size);
+  esp_err_t renameFile(const char *from, const char *to);
+  esp_err_t truncateFile(const char *filename, uint64_t size);
 
 private:
   static SDCard *inst;
@@ -105,10 +116,15 @@ private:
   sdmmc_host_t host = SDMMC_HOST_DEFAULT();
   esp_vfs_fat_sdmmc_mount_config_t mount_config;
 
-  bool mounted = false;
+  bool mounted = false; // inside a mount() / unmount() session
+  bool _volume = false; // FAT volume mounted, outlives sessions in the static memory mode
   int _file_num = 0;
   FILE *_file;
+  char _file_buffer[FILE_BUFFER]; // stdio buffer of _file
   SDCardFile *_file_list[MAX_FILE_LIST];
+#ifdef CONFIG_STATIC_MEMORY
+  SDCardFile _file_pool[MAX_FILE_LIST];
+#endif
   esp_err_t _getStat(const char *path, struct stat *_stat);
   char _filename[MAX_FILE_NAME];
 };
@@ -0,0 +1,146 @@
+/*
+
+
+
+
+*/
+
+#include "Scheduler.h"
+
+static const char *TAG = "Scheduler";
+
+// upper lateness limit of each histogram bucket, the last one is open
+static const int32_t bucket_limits[SCHEDULER_BUCKETS - 1] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000, 100000};
+
+/* Null, because instance will be initialized on demand. */
+Scheduler *Scheduler::inst = 0;
+
+//
+Scheduler::Scheduler()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Scheduler(): failed to create semaphore");
+
+    esp_timer_create_args_t timer_args = {};
+    timer_args.callback = &Scheduler::_timerCallback;
+    timer_args.arg = this;
+    timer_args.name = "scheduler";
+    if (esp_timer_create(&timer_args, &this->_timer) != ESP_OK)
+        ESP_LOGE(TAG, "Scheduler(): failed to create timer");
+}
+
+//
+Scheduler *Scheduler::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Scheduler(): creating instance");
+        inst = SINGLETON_NEW(Scheduler);
+    }
+    return inst;
+}
+
+// set the sampling interval in seconds (fractions allowed), restarts the grid and the stats
+esp_err_t Scheduler::init(double interval_s)
+{
+    int64_t interval_us = (int64_t)(interval_s * US_PER_SEC + 0.5);
+
+    if (interval_us < SCHEDULER_MIN_INTERVAL_US || interval_us > SCHEDULER_MAX_INTERVAL_US)
+    {
+        ESP_LOGE(TAG, "init(): invalid interval %.3f s", interval_s);
+        return ESP_ERR_INVALID_ARG;
+    }
+    SEMAPHORE_TAKE();
+    this->_interval_us = interval_us;
+    this->_next_us = 0;
+    memset(&this->_stats, 0, sizeof(this->_stats));
+    this->_stats.interval_us = interval_us;
+    SEMAPHORE_GIVE();
+    ESP_LOGI(TAG, "init(): interval %lld us", interval_us);
+    return ESP_OK;
+}
+
+// block until the next deadline, returns it in @deadline_us (epoch microseconds) - one task only
+esp_err_t Scheduler::wait(int64_t *deadline_us)
+{
+    System *sys = System::instance();
+    int64_t now = sys->getTimeUs();
+    int64_t interval = this->_interval_us;
+    int64_t next = this->_next_us;
+    int64_t late;
+    uint32_t skipped = 0;
+    bool resync = false;
+
+    if (next != 0)
+        next += interval;
+    if (next == 0 || now < next - interval - SCHEDULER_RESYNC_US || now > next + SCHEDULER_RESYNC_US)
+    { // first tick or system time was set - first grid point after now
+        resync = (next != 0);
+        next = (now / interval + 1) * interval;
+    }
+    else if (now >= next + interval)
+    { // loop overran whole periods - drop them rather than bursting
+        skipped = (now - next) / interval;
+        next += skipped * interval;
+    }
+
+    if (next > now)
+    {
+        this->_task = xTaskGetCurrentTaskHandle();
+        ulTaskNotifyTake(pdTRUE, 0); // stale wake-up from a cancelled deadline
+        if (esp_timer_start_once(this->_timer, next - now) == ESP_OK)
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS((next - now) / 1000 + 100));
+        else
+            vTaskDelay(pdMS_TO_TICKS((next - now) / 1000));
+        esp_timer_stop(this->_timer);
+    }
+    late = sys->getTimeUs() - next;
+    if (late < 0)
+        late = 0;
+
+    SEMAPHORE_TAKE();
+    this->_next_us = next;
+    this->_stats.ticks++;
+    this->_stats.skipped += skipped;
+    if (resync)
+        this->_stats.resyncs++;
+    if (late > this->_stats.max_late_us)
+        this->_stats.max_late_us = (late > INT32_MAX) ? INT32_MAX : (int32_t)late;
+    this->_stats.sum_late_us += late;
+    int bucket = 0;
+    while (bucket < SCHEDULER_BUCKETS - 1 && late > bucket_limits[bucket])
+        bucket++;
+    this->_stats.histogram[bucket]++;
+    SEMAPHORE_GIVE();
+
+    if (deadline_us != NULL)
+        *deadline_us = next;
+    return ESP_OK;
+}
+
+//
+esp_err_t Scheduler::getStats(scheduler_stats *stats)
+{
+    SEMAPHORE_TAKE();
+    *stats = this->_stats;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// upper limit of @bucket in microseconds, -1 for the open last bucket
+int32_t Scheduler::bucketLimit(int bucket)
+{
+    if (bucket < 0 || bucket >= SCHEDULER_BUCKETS - 1)
+        return -1;
+    return bucket_limits[bucket];
+}
+
+// esp_timer task context - wake the task waiting for the deadline
+void Scheduler::_timerCallback(void *arg)
+{
+    Scheduler *scheduler = (Scheduler *)arg;
+    if (scheduler->_task != NULL)
+        xTaskNotifyGive(scheduler->_task);
+}
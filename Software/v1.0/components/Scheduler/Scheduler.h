@@ -0,0 +1,74 @@
+/*
+
+
+
+
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "System.h"
+
+#define SCHEDULER_MIN_INTERVAL_US 10000LL       // 100 Hz
+#define SCHEDULER_MAX_INTERVAL_US 86400000000LL // 1 day
+#define SCHEDULER_RESYNC_US 10000000LL          // clock step that realigns the grid instead of counting skips
+#define SCHEDULER_BUCKETS 11
+
+// sampling regularity since the last init()
+struct scheduler_stats
+{
+    int64_t interval_us;
+    uint32_t ticks;
+    uint32_t skipped;    // deadlines passed while the loop was busy
+    uint32_t resyncs;    // grid realigned after a clock step
+    int32_t max_late_us;
+    int64_t sum_late_us; // mean lateness = sum_late_us / ticks
+    uint32_t histogram[SCHEDULER_BUCKETS]; // lateness counts, limits from bucketLimit()
+};
+
+/*
+  Sampling scheduler
+
+  Ticks fall on a fixed grid of absolute deadlines in system time
+  (multiples of the interval since epoch), so loop body time never moves
+  later samples and intervals may be fractional. A one shot esp_timer
+  wakes the waiting task at the deadline; how late each wake-up was is
+  kept in a histogram.
+*/
+class Scheduler
+{
+public:
+    static Scheduler *instance(void);
+    esp_err_t init(double interval_s);
+    esp_err_t wait(int64_t *deadline_us);
+    esp_err_t getStats(scheduler_stats *stats);
+    static int32_t bucketLimit(int bucket);
+
+private:
+    static Scheduler *inst;
+    Scheduler();
+    Scheduler(const Scheduler *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    esp_timer_handle_t _timer = NULL;
+    TaskHandle_t _task = NULL;
+    int64_t _interval_us = US_PER_SEC;
+    int64_t _next_us = 0; // next deadline, 0 - align on the next wait()
+    scheduler_stats _stats = {};
+
+    static void _timerCallback(void *arg);
+};
+
+#endif // Scheduler.h
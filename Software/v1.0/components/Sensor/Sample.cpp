@@ -0,0 +1,68 @@
+/*
+
+
+
+
+*/
+
+#include "Sample.h"
+#include "Sensor.h"
+
+//
+static inline int32_t pack_tension(tension_t v)
+{
+    if (v == TENSION_NONE)
+        return SAMPLE_TENSION_NONE;
+    if (v > SAMPLE_TENSION_MAX)
+        return SAMPLE_TENSION_MAX;
+    if (v < -SAMPLE_TENSION_MAX)
+        return -SAMPLE_TENSION_MAX;
+    return v;
+}
+
+// whole millisecond at or before @time_us, the base samples are packed against
+int64_t sample_base(int64_t time_us)
+{
+    int64_t ms = (time_us >= 0) ? time_us / 1000 : -((-time_us + 999) / 1000);
+    return ms * 1000;
+}
+
+// @data relative to @base_us, false when its time is before the base or out of range
+bool sample_pack(const SensorData *data, int64_t base_us, Sample *out)
+{
+    int64_t offset = data->timestamp - base_us;
+    if (offset < 0 || offset / 1000 > UINT32_MAX)
+        return false;
+    out->time_ms = (uint32_t)(offset / 1000);
+    sample_put_24(out->tension, pack_tension(data->tension));
+    sample_put_24(out->peak, pack_tension(data->peak_tension));
+    out->units = data->units;
+    out->channel = data->channel;
+    return true;
+}
+
+//
+void sample_unpack(const Sample *in, int64_t base_us, SensorData *out)
+{
+    int32_t peak = sample_get_24(in->peak);
+    out->timestamp = sample_time_us(in, base_us);
+    out->tension = sample_get_24(in->tension);
+    out->peak_tension = (peak == SAMPLE_TENSION_NONE) ? TENSION_NONE : peak;
+    out->units = (in->units < unit_count) ? (tension_unit)in->units : unit_none;
+    out->channel = in->channel;
+}
+
+// move @len samples from @base_us to @new_base_us, false (nothing changed) when one does not fit
+bool sample_rebase(Sample *data, int len, int64_t base_us, int64_t new_base_us)
+{
+    int64_t shift_ms = (new_base_us - base_us) / 1000;
+    for (int i = 0; i < len; i++)
+    {
+        int64_t time_ms = (int64_t)data[i].time_ms - shift_ms;
+        if (time_ms < 0 || time_ms > UINT32_MAX)
+            return false;
+    }
+    for (int i = 0; i < len; i++)
+        data[i].time_ms = (uint32_t)((int64_t)data[i].time_ms - shift_ms);
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+
+
+
+
+*/
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "Tension.h"
+
+#define SAMPLE_TENSION_MAX 8388607     // packed tension is int24 hundredths, +/- 83886.07 units
+#define SAMPLE_TENSION_NONE (-8388608) // TENSION_NONE when packed
+
+struct SensorData;
+
+// 12 byte form of SensorData for RAM buffers - time counts ms from a base kept by the buffer owner
+struct __attribute__((packed)) Sample
+{
+    uint32_t time_ms;   // since the base, ~49.7 days of range
+    uint8_t tension[3]; // little endian int24, clamped to SAMPLE_TENSION_MAX
+    uint8_t peak[3];
+    uint8_t units;      // tension_unit
+    uint8_t channel;
+};
+
+static_assert(sizeof(Sample) == 12, "Sample is meant to stay 12 bytes");
+
+// whole millisecond at or before @time_us, the base samples are packed against
+int64_t sample_base(int64_t time_us);
+// @data relative to @base_us, false when its time is before the base or out of range
+bool sample_pack(const SensorData *data, int64_t base_us, Sample *out);
+//
+void sample_unpack(const Sample *in, int64_t base_us, SensorData *out);
+// move @len samples from @base_us to @new_base_us, false (nothing changed) when one does not fit
+bool sample_rebase(Sample *data, int len, int64_t base_us, int64_t new_base_us);
+
+// little endian int24 store, shared by the packed forms
+static inline void sample_put_24(uint8_t *p, int32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+}
+
+// sign extended from bit 23
+static inline int32_t sample_get_24(const uint8_t *p)
+{
+    return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+}
+
+// epoch microseconds of @in
+static inline int64_t sample_time_us(const Sample *in, int64_t base_us)
+{
+    return base_us + (int64_t)in->time_ms * 1000;
+}
+
+#endif // Sample.h
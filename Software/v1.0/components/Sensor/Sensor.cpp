@@ -9,25 +9,72 @@
 
 static const char *TAG = "Sensor";
 
-/* Null, because instance will be initialized on demand. */
-Sensor *Sensor::inst = 0;
+static const uint32_t baud_rates[] = SENSOR_BAUD_RATES;
+
+// channel 0 is the original gauge connector, channel 1 the expansion header
+static const sensor_port sensor_ports[SENSOR_CHANNELS] = {
+    {UART_NUM_2, TXD2, RXD2, 18, 23, UART_MODE_UART},
+    {UART_NUM_1, 33, 32, UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE, UART_MODE_UART},
+};
+
+/* Null, because instances will be initialized on demand. */
+Sensor *Sensor::inst[SENSOR_CHANNELS] = {};
+int Sensor::_channels = 0;
+
+#ifdef CONFIG_STATIC_MEMORY
+alignas(Sensor) static uint8_t sensor_storage[SENSOR_CHANNELS][sizeof(Sensor)];
+#endif
+
 //
-Sensor::Sensor()
+Sensor::Sensor(int channel)
 {
+    char labels[METRICS_LABELS_LEN];
+    SensorData defaults = SENSOR_DEFAULTS();
+
     this->xSemaphore = xSemaphoreCreateMutex();
     if (this->xSemaphore == NULL)
         ESP_LOGE(TAG, "Sensor(): failed to create semaphore");
+    this->_channel = channel;
+    this->_port = &sensor_ports[channel];
+    defaults.channel = channel;
+    this->_data = defaults;
+    memset(this->_ring, 0, sizeof(this->_ring));
+    this->_stats.status = ESP_ERR_INVALID_STATE;
+    this->_stats.baud = DEFAULT_BAUD;
+
+    Metrics *metrics = Metrics::instance();
+    snprintf(labels, sizeof(labels), "channel=\"%d\",result=\"ok\"", channel);
+    this->_frames_ok = metrics->counter("sensor_frames_total", labels, "frames read from the gauge");
+    snprintf(labels, sizeof(labels), "channel=\"%d\",result=\"timeout\"", channel);
+    this->_frames_timeout = metrics->counter("sensor_frames_total", labels, "");
+    snprintf(labels, sizeof(labels), "channel=\"%d\",result=\"parse_error\"", channel);
+    this->_frames_invalid = metrics->counter("sensor_frames_total", labels, "");
+    snprintf(labels, sizeof(labels), "channel=\"%d\"", channel);
+    this->_poll_latency = metrics->histogram("sensor_poll_latency_us", labels, "request to response time in polled mode",
+                                             metrics_duration_us, METRICS_DURATION_BUCKETS);
 }
 
-//
-Sensor *Sensor::instance(void)
+// @channel 0 .. SENSOR_CHANNELS - 1, NULL otherwise
+Sensor *Sensor::instance(int channel)
 {
-    if (inst == 0)
+    if (channel < 0 || channel >= SENSOR_CHANNELS)
+        return NULL;
+    if (inst[channel] == 0)
     {
-        ESP_LOGI(TAG, "Sensor(): creating Sensor instance");
-        inst = new Sensor();
+        ESP_LOGI(TAG, "Sensor(): creating Sensor instance %d", channel);
+#ifdef CONFIG_STATIC_MEMORY
+        inst[channel] = new (sensor_storage[channel]) Sensor(channel);
+#else
+        inst[channel] = new Sensor(channel);
+#endif
     }
-    return inst;
+    return inst[channel];
+}
+
+// channels initialized, numbered from 0
+int Sensor::channels(void)
+{
+    return _channels;
 }
 
 //
@@ -36,51 +83,57 @@ esp_err_t Sensor::init(void)
     /* Configure parameters of an UART driver,
      * communication pins and install the driver */
     uart_config_t uart_config = {
-        .baud_rate = DEFAULT_BAUD,
+        .baud_rate = (int)this->_baud,
         .data_bits = UART_DATA_8_BITS,
         .parity = UART_PARITY_DISABLE,
         .stop_bits = UART_STOP_BITS_1,
         .flow_ctrl = UART_HW_FLOWCTRL_DISABLE,
         .source_clk = UART_SCLK_APB,
     };
+    const sensor_port *port = this->_port;
 
-    ESP_ERROR_CHECK(uart_driver_install(UART_NUM_2, SERIAL_BUFF, 0, 0, NULL, 0));
-    ESP_ERROR_CHECK(uart_param_config(UART_NUM_2, &uart_config));
-    ESP_ERROR_CHECK(uart_set_pin(UART_NUM_2, 17, 16, 18, 23));
-    ESP_ERROR_CHECK(uart_set_mode(UART_NUM_2, UART_MODE_UART));
-    ESP_ERROR_CHECK(uart_flush(UART_NUM_2));
-    ESP_ERROR_CHECK(uart_flush_input(UART_NUM_2));
+    if (this->_initialized)
+        return ESP_OK;
+    ESP_ERROR_CHECK(uart_driver_install(port->uart, SERIAL_BUFF, 0, 0, NULL, 0));
+    ESP_ERROR_CHECK(uart_param_config(port->uart, &uart_config));
+    ESP_ERROR_CHECK(uart_set_pin(port->uart, port->tx, port->rx, port->rts, port->cts));
+    ESP_ERROR_CHECK(uart_set_mode(port->uart, port->mode));
+    ESP_ERROR_CHECK(uart_flush(port->uart));
+    ESP_ERROR_CHECK(uart_flush_input(port->uart));
 
     this->_initialized = true;
-    ESP_LOGI(TAG, "init(): initialized");
+    if (this->_channel + 1 > _channels)
+        _channels = this->_channel + 1;
+    ESP_LOGI(TAG, "init(): channel %d initialized on UART%d at %u baud", this->_channel, port->uart, this->_baud);
     return ESP_OK;
 }
 
 //
 void Sensor::dumpData(SensorData *data, int len)
 {
+    char time_str[TIME_LEN], tension[TENSION_TEXT_LEN], peak[TENSION_TEXT_LEN];
     for (int i = 0; i < len; i++)
     {
-        ESP_LOGI(TAG, "[%d] time: %d-%02d-%02d %02d:%02d:%02d\t tension:%.1f \tpeak: %.1f \tunits: %s",
+        System::instance()->getTimeStringMs(time_str, sizeof(time_str), data[i].timestamp);
+        tension_format(tension, sizeof(tension), data[i].tension);
+        tension_format(peak, sizeof(peak), data[i].peak_tension);
+        ESP_LOGI(TAG, "[%d] channel: %d\ttime: %s\t tension:%s \tpeak: %s \tunits: %s",
                  i,
-                 data[i].timestamp.tm_year + 1900,
-                 data[i].timestamp.tm_mon + 1,
-                 data[i].timestamp.tm_mday,
-                 data[i].timestamp.tm_hour,
-                 data[i].timestamp.tm_min,
-                 data[i].timestamp.tm_sec,
-                 data[i].tension,
-                 data[i].peak_tension,
-                 data[i].units);
+                 data[i].channel,
+                 time_str,
+                 tension,
+                 (data[i].peak_tension == TENSION_NONE) ? "-" : peak,
+                 tension_unit_name(data[i].units));
     }
 }
 
 //
 esp_err_t Sensor::getData(SensorData *data_buff)
 {
+    TRACE_SCOPE("getData");
     esp_err_t rc = ESP_OK;
     SEMAPHORE_TAKE();
-    if (this->_data.units == 0)
+    if (this->_data.units == unit_none) // nothing received yet
         rc = ESP_FAIL;
     else
         *data_buff = this->_data;
@@ -88,77 +141,411 @@ esp_err_t Sensor::getData(SensorData *data_buff)
     return rc;
 }
 
+// up to @len latest readings oldest first and the base their times count from, returns the count
+int Sensor::getRing(Sample *data, int len, int64_t *base_us)
+{
+    if (!this->xSemaphore || !LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))
+        return 0;
+    uint32_t count = (this->_ring_count < SENSOR_RING) ? this->_ring_count : SENSOR_RING;
+    if ((uint32_t)len < count)
+        count = len;
+    for (uint32_t i = 0; i < count; i++)
+        data[i] = this->_ring[(this->_ring_count - count + i) % SENSOR_RING];
+    *base_us = this->_ring_base;
+    LOCK_GIVE(this->xSemaphore);
+    return count;
+}
+
+//
+esp_err_t Sensor::getStats(sensor_stats *stats)
+{
+    SEMAPHORE_TAKE();
+    *stats = this->_stats;
+    SEMAPHORE_GIVE();
+    stats->requests = this->_requests.load(std::memory_order_relaxed);
+    return ESP_OK;
+}
+
+//
+int Sensor::getChannel(void)
+{
+    return this->_channel;
+}
+
 // read serial and store in internal buffer - return - ESP_ERR_NOT_FOUND, ESP_ERR_INVALID_RESPONSE
 esp_err_t Sensor::readSerial(uint32_t delay)
 {
-    char buff[SERIAL_BUFF] = {0}, units[UNITS_LEN] = {0}, units2[UNITS_LEN] = {0};
-    float tension = 0.0, peak = 0.0;
-    int len = 0, end_byte = 0;
-    time_t rawTime;
+    char buff[SERIAL_BUFF] = {0};
+    int len = 0;
+    int64_t timestamp;
+    TRACE_SCOPE("readSerial");
 
     //ESP_ERROR_CHECK( uart_get_buffered_data_len(UART_NUM_2, (size_t*)&len) );
     //memset(buff, 0, sizeof(buff));
-    len = uart_read_bytes(UART_NUM_2, (uint8_t *)buff, SERIAL_BUFF, pdMS_TO_TICKS(delay));
+    len = uart_read_bytes(this->_port->uart, (uint8_t *)buff, SERIAL_BUFF - 1, pdMS_TO_TICKS(delay));
+    timestamp = System::instance()->getTimeUs(); // taken at reception, before parsing
     this->flush();
-    buff[len] = '\0';
+    buff[(len > 0) ? len : 0] = '\0';
     //ESP_LOGI(TAG, "readSerial(): read [%d] %s", len, buff);
-    if (len == 0 || buff[0] == 0) // sensor not found
-        return ESP_ERR_NOT_FOUND;
+    return this->_parse(buff, len, timestamp);
+}
 
-    // parsing
-    len = sscanf(buff, "%*d %*s %*d %*d:%*d:%*d %f %s %f %s %d", &tension, units, &peak, units2, &end_byte);
-    if (len == 0) // datetime is not enabled
-        len = sscanf(buff, "%f %s %f %s %d", &tension, units, &peak, units2, &end_byte);
-    //ESP_LOGI(TAG, "readSerial(): parsed -> param read: %d, tension: %.1f, units: %s, peak: %.1f, units: %s, end_byte: %d", len, tension, units, peak, units2, end_byte);
+// request a reading on every @interval_s grid point, call from the task that calls poll()
+esp_err_t Sensor::startPolling(double interval_s)
+{
+    int64_t interval_us = (int64_t)(interval_s * US_PER_SEC + 0.5);
 
-    // Error checking
-    if ((strcmp(units, "lbf") && strcmp(units, "N") && strcmp(units, "kgf")) || len < 3)
+    if (!this->_initialized || interval_us < SENSOR_POLL_MIN_US || interval_us > INT32_MAX)
     {
-        ESP_LOGE(TAG, "readSerial(): parsing error [ %s ]", buff);
-        return ESP_ERR_INVALID_RESPONSE;
+        ESP_LOGE(TAG, "startPolling(): channel %d invalid interval %.3f s", this->_channel, interval_s);
+        return ESP_ERR_INVALID_ARG;
     }
+    if (this->_poll_timer == NULL)
+    {
+        esp_timer_create_args_t timer_args = {};
+        timer_args.callback = &Sensor::_pollCallback;
+        timer_args.arg = this;
+        timer_args.name = "sensor_poll";
+        if (esp_timer_create(&timer_args, &this->_poll_timer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "startPolling(): failed to create timer");
+            return ESP_FAIL;
+        }
+    }
+    esp_timer_stop(this->_poll_timer);
 
     SEMAPHORE_TAKE();
-    if (len == 3) // sensor mode 1 or 2 - [tension/peak],[units]
+    this->_stats.poll_interval_us = interval_us;
+    this->_stats.responses = 0;
+    this->_stats.max_latency_us = 0;
+    this->_stats.sum_latency_us = 0;
+    SEMAPHORE_GIVE();
+    this->_task = xTaskGetCurrentTaskHandle();
+    this->_poll_interval_us = interval_us;
+    ulTaskNotifyTake(pdTRUE, 0); // request of a previous run
+    this->flush();
+    this->_armPoll();
+    ESP_LOGI(TAG, "startPolling(): channel %d every %lld us", this->_channel, interval_us);
+    return ESP_OK;
+}
+
+// back to free running
+void Sensor::stopPolling(void)
+{
+    if (this->_poll_timer != NULL)
+        esp_timer_stop(this->_poll_timer);
+    this->_poll_interval_us = 0;
+    if (this->xSemaphore && LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))
     {
-        this->_data.tension = tension;
-        this->_data.peak_tension = -1;
+        this->_stats.poll_interval_us = 0;
+        LOCK_GIVE(this->xSemaphore);
     }
-    else if (len == 5) // sensor mode 3 [tension],[units],[peak],[unit2]
+}
+
+//
+bool Sensor::polling(void)
+{
+    return this->_poll_interval_us != 0;
+}
+
+// wait for the next request and read its response, the reading gets the request time
+esp_err_t Sensor::poll(void)
+{
+    char buff[SERIAL_BUFF];
+    int64_t interval_us = this->_poll_interval_us;
+    TRACE_SCOPE("poll");
+
+    if (interval_us == 0)
+        return ESP_ERR_INVALID_STATE;
+    if (!ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(interval_us / 1000 + SEMAPAHORE_WAIT_MS)))
     {
-        this->_data.tension = tension;
-        this->_data.peak_tension = peak;
+        ESP_LOGE(TAG, "poll(): channel %d request timer stalled", this->_channel);
+        this->_armPoll();
+        return ESP_ERR_TIMEOUT;
     }
-    snprintf(this->_data.units, UNITS_LEN, "%s", units);
-    time(&rawTime);
-    this->_data.timestamp = *(localtime(&rawTime));
-    SEMAPHORE_GIVE();
+    int64_t request_us = this->_request_us;
+    // the answer has to be in before the next request goes out
+    int64_t window_ms = (request_us + interval_us - System::instance()->getTimeUs()) / 1000 - SENSOR_POLL_GUARD_MS;
+    int len = this->_readLine(buff, sizeof(buff), (window_ms > 0) ? (uint32_t)window_ms : 0);
+    int32_t latency = (int32_t)(System::instance()->getTimeUs() - request_us);
+    this->flush();
 
+    esp_err_t rc = this->_parse(buff, len, request_us);
+    if (rc != ESP_OK)
+        return rc;
+    Metrics::instance()->observe(this->_poll_latency, latency);
+    SEMAPHORE_TAKE();
+    this->_stats.responses++;
+    this->_stats.latency_us = latency;
+    if (latency > this->_stats.max_latency_us)
+        this->_stats.max_latency_us = latency;
+    this->_stats.sum_latency_us += latency;
+    SEMAPHORE_GIVE();
     return ESP_OK;
 }
 
-//
+// check and store a received frame as the reading at @timestamp
+esp_err_t Sensor::_parse(const char *buff, int len, int64_t timestamp)
+{
+    SensorData frame = SENSOR_DEFAULTS();
+    esp_err_t rc = ESP_OK;
+
+    if (len <= 0 || buff[0] == 0) // sensor not found
+    {
+        Metrics::instance()->inc(this->_frames_timeout);
+        rc = ESP_ERR_NOT_FOUND;
+    }
+    else if (!_scan(buff, this->_format, &frame))
+    {
+        ESP_LOGE(TAG, "readSerial(): channel %d parsing error [ %s ]", this->_channel, buff);
+        Metrics::instance()->inc(this->_frames_invalid);
+        rc = ESP_ERR_INVALID_RESPONSE;
+    }
+    else
+        Metrics::instance()->inc(this->_frames_ok);
+
+    SEMAPHORE_TAKE();
+    this->_stats.status = rc;
+    if (rc == ESP_ERR_NOT_FOUND)
+    {
+        this->_stats.timeouts++;
+        this->_stats.failures++;
+    }
+    else if (rc == ESP_ERR_INVALID_RESPONSE)
+    {
+        this->_stats.parse_errors++;
+        this->_stats.failures++;
+    }
+    else
+    {
+        this->_data.tension = frame.tension;
+        this->_data.peak_tension = frame.peak_tension;
+        this->_data.units = frame.units;
+        this->_data.timestamp = timestamp;
+        // a fresh base on the first reading, after ~49 days or a clock step back - older readings are dropped
+        if (this->_ring_count == 0 || !sample_pack(&this->_data, this->_ring_base, &this->_ring[this->_ring_count % SENSOR_RING]))
+        {
+            this->_ring_base = sample_base(timestamp);
+            this->_ring_count = 0;
+            sample_pack(&this->_data, this->_ring_base, &this->_ring[0]);
+        }
+        this->_ring_count++;
+        this->_stats.frames++;
+        this->_stats.failures = 0;
+        this->_stats.last_us = timestamp;
+    }
+    SEMAPHORE_GIVE();
+
+    return rc;
+}
+
+// fill the tension fields of @data from a frame in @format, false when it is not a valid frame
+bool Sensor::_scan(const char *buff, sensor_format format, SensorData *data)
+{
+    const char *token[SENSOR_TOKENS];
+    size_t token_len[SENSOR_TOKENS];
+    int count = 0;
+
+    // split on blanks, fields are never copied
+    for (const char *p = buff; *p != 0 && count < SENSOR_TOKENS;)
+    {
+        while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+            p++;
+        if (*p == 0)
+            break;
+        token[count] = p;
+        while (*p != 0 && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+            p++;
+        token_len[count] = p - token[count];
+        count++;
+    }
+
+    // "[n] [month] [year] [hh:mm:ss] " leads when the gauge datetime is enabled
+    int first = 0;
+    if (format != sensor_format_bare && count > 3 && memchr(token[3], ':', token_len[3]) != NULL)
+        first = 4;
+    else if (format == sensor_format_datetime)
+        return false;
+
+    // [tension] [units] [peak / end byte] ([units] [end byte] in mode 3)
+    if (count - first < 3)
+        return false;
+    data->units = tension_unit_parse(token[first + 1], token_len[first + 1]);
+    if (data->units == unit_none || !tension_parse(token[first], token_len[first], &data->tension))
+        return false;
+    tension_t third;
+    if (!tension_parse(token[first + 2], token_len[first + 2], &third))
+        return false;
+    if (count - first > 3 && tension_unit_parse(token[first + 3], token_len[first + 3]) != unit_none)
+        data->peak_tension = third; // sensor mode 3 [tension],[units],[peak],[unit2]
+    else
+        data->peak_tension = TENSION_NONE; // sensor mode 1 or 2 - [tension/peak],[units]
+    return true;
+}
+
+// probe the rates of SENSOR_BAUD_RATES and lock onto the one giving the most valid frames
+esp_err_t Sensor::detect(void)
+{
+    static const sensor_format formats[] = {sensor_format_datetime, sensor_format_bare};
+    char buff[SERIAL_BUFF];
+    SensorData frame;
+    uint32_t best_baud = this->_baud;
+    sensor_format best_format = this->_format;
+    int best_score = 0;
+    int64_t poll_interval_us = this->_poll_interval_us;
+    TRACE_SCOPE("detect");
+
+    if (!this->_initialized)
+        return ESP_ERR_INVALID_STATE;
+    ESP_LOGD(TAG, "detect(): channel %d probing", this->_channel);
+    this->stopPolling();
+    for (int i = 0; i < (int)(sizeof(baud_rates) / sizeof(baud_rates[0])); i++)
+    {
+        int valid[2] = {0, 0}, invalid = 0, lines = 0;
+        if (uart_set_baudrate(this->_port->uart, baud_rates[i]) != ESP_OK)
+            continue;
+        this->flush();
+        TickType_t start = xTaskGetTickCount(), window = pdMS_TO_TICKS(SENSOR_DETECT_WINDOW_MS);
+        while (xTaskGetTickCount() - start < window && invalid + valid[0] + valid[1] < SENSOR_RING &&
+               !((valid[0] >= SENSOR_DETECT_LOCK || valid[1] >= SENSOR_DETECT_LOCK) && invalid == 0))
+        {
+            if (poll_interval_us != 0)
+                uart_write_bytes(this->_port->uart, SENSOR_POLL_CMD, strlen(SENSOR_POLL_CMD));
+            uint32_t left = (window - (xTaskGetTickCount() - start)) * portTICK_PERIOD_MS;
+            if (this->_readLine(buff, sizeof(buff), left) <= 0)
+                break; // silent at this rate
+            if (lines++ == 0 && poll_interval_us == 0)
+                continue; // free running output was joined mid frame
+            int matched = 0;
+            for (int f = 0; f < 2; f++)
+            {
+                if (_scan(buff, formats[f], &frame))
+                {
+                    valid[f]++;
+                    matched++;
+                }
+            }
+            if (matched == 0)
+                invalid++;
+        }
+        for (int f = 0; f < 2; f++)
+        {
+            int score = valid[f] - invalid; // a neighbouring rate may decode a few frames by chance
+            ESP_LOGD(TAG, "detect(): channel %d %u baud %s: %d valid %d invalid", this->_channel, baud_rates[i],
+                     (formats[f] == sensor_format_datetime) ? "datetime" : "bare", valid[f], invalid);
+            if (valid[f] >= SENSOR_DETECT_MIN_FRAMES && score > best_score)
+            {
+                best_score = score;
+                best_baud = baud_rates[i];
+                best_format = formats[f];
+            }
+        }
+        if (best_score >= SENSOR_DETECT_LOCK)
+            break; // clean at this rate, the rest is not worth the wait
+    }
+
+    esp_err_t rc = (best_score > 0) ? ESP_OK : ESP_ERR_NOT_FOUND;
+    if (rc == ESP_OK)
+    {
+        this->setFormat(best_format);
+        ESP_LOGI(TAG, "detect(): channel %d locked on %u baud, %s frames", this->_channel, best_baud,
+                 (best_format == sensor_format_datetime) ? "datetime" : "bare");
+    }
+    else
+        ESP_LOGE(TAG, "detect(): channel %d no gauge found, staying at %u baud", this->_channel, best_baud);
+    this->setBaud(best_baud);
+    this->flush();
+    SEMAPHORE_TAKE();
+    this->_stats.failures = 0;
+    SEMAPHORE_GIVE();
+    if (poll_interval_us != 0)
+        this->startPolling((double)poll_interval_us / US_PER_SEC);
+    return rc;
+}
+
+// read up to and including a line feed or until @timeout_ms, returns the length
+int Sensor::_readLine(char *buff, int len, uint32_t timeout_ms)
+{
+    TickType_t start = xTaskGetTickCount(), wait = pdMS_TO_TICKS(timeout_ms);
+    int count = 0;
+
+    while (count < len - 1)
+    {
+        TickType_t elapsed = xTaskGetTickCount() - start;
+        if (elapsed >= wait || uart_read_bytes(this->_port->uart, (uint8_t *)&buff[count], 1, wait - elapsed) <= 0)
+            break;
+        if (buff[count++] == '\n')
+            break;
+    }
+    buff[count] = '\0';
+    return count;
+}
+
+// schedule the next request on the first grid point after now
+void Sensor::_armPoll(void)
+{
+    int64_t interval = this->_poll_interval_us;
+    if (interval == 0)
+        return;
+    int64_t now = System::instance()->getTimeUs();
+    int64_t next = (now / interval + 1) * interval;
+    if (esp_timer_start_once(this->_poll_timer, next - now) != ESP_OK)
+        ESP_LOGE(TAG, "_armPoll(): channel %d failed to start timer", this->_channel);
+}
+
+// esp_timer task context - send the request, stamp it and wake the reading task
+void Sensor::_pollCallback(void *arg)
+{
+    Sensor *sensor = (Sensor *)arg;
+    if (sensor->_poll_interval_us == 0)
+        return;
+    sensor->_request_us = System::instance()->getTimeUs();
+    uart_write_bytes(sensor->_port->uart, SENSOR_POLL_CMD, strlen(SENSOR_POLL_CMD));
+    sensor->_requests.fetch_add(1, std::memory_order_relaxed);
+    sensor->_armPoll();
+    if (sensor->_task != NULL)
+        xTaskNotifyGive(sensor->_task);
+}
+
+// takes effect at once after init(), otherwise at init()
 esp_err_t Sensor::setBaud(uint32_t baud)
 {
-    if (uart_set_baudrate(UART_NUM_2, baud) != ESP_OK)
+    if (this->_initialized && uart_set_baudrate(this->_port->uart, baud) != ESP_OK)
     {
         ESP_LOGE(TAG, "setBaud(): baudrate set ESP_FAIL");
         return ESP_FAIL;
     }
+    this->_baud = baud;
+    SEMAPHORE_TAKE();
+    this->_stats.baud = baud;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+//
+esp_err_t Sensor::setFormat(sensor_format format)
+{
+    if (format < sensor_format_auto || format > sensor_format_bare)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    this->_format = format;
+    this->_stats.format = format;
+    SEMAPHORE_GIVE();
     return ESP_OK;
 }
 
 //
 void Sensor::deinit()
 {
-    ESP_ERROR_CHECK(uart_driver_delete(UART_NUM_2));
+    this->stopPolling();
+    ESP_ERROR_CHECK(uart_driver_delete(this->_port->uart));
     this->_initialized = false;
 }
 
 //
 void Sensor::flush(void)
 {
-    esp_err_t rc = uart_flush_input(UART_NUM_2);
+    esp_err_t rc = uart_flush_input(this->_port->uart);
     if (rc != ESP_OK)
         ESP_LOGE(TAG, "flush(): failed to flush ret = %s", esp_err_to_name(rc));
 }
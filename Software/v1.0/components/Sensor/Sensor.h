@@ -15,6 +15,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
@@ -25,8 +26,13 @@
 
 #include "esp_log.h"
 #include "esp_err.h"
+#include "esp_timer.h"
 
 #include "System.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Tension.h"
+#include "Sample.h"
 
 // extern "C" {
 // #include "driver/uart.h"
@@ -41,41 +47,109 @@
 #define RXD2 16
 #define TXD2 17
 
+#define SENSOR_CHANNELS 2 // gauges, one UART each - see sensor_ports in Sensor.cpp
+#define SENSOR_RING 32    // readings kept per channel, packed
+
 #define SERIAL_BUFF 256
-#define UNITS_LEN 5
+#define SENSOR_TOKENS 10 // whitespace separated fields looked at in a frame
 #define DEFAULT_BAUD 9600
 
-#define SENSOR_DEFAULTS()                                             \
-    {                                                                 \
-        .timestamp = {                                                \
-            .tm_sec = 0,                                              \
-            .tm_min = 0,                                              \
-            .tm_hour = 0,                                             \
-            .tm_mday = 0,                                             \
-            .tm_mon = 0,                                              \
-            .tm_year = 0,                                             \
-            .tm_wday = 0,                                             \
-            .tm_yday = 0,                                             \
-            .tm_isdst = 0},                                           \
-        .tension = 0.0, .peak_tension = -1.0, .units = { 0 } \
+#define SENSOR_BAUD_RATES {9600, 19200, 38400, 57600, 115200, 4800, 2400} // probe order, default first
+#define SENSOR_DETECT_WINDOW_MS 2500 // listening time per rate
+#define SENSOR_DETECT_LOCK 5         // clean frames that end a rate's window early
+#define SENSOR_DETECT_MIN_FRAMES 2   // valid frames needed to accept a rate
+
+#define SENSOR_POLL_CMD "?\r"       // request for one reading
+#define SENSOR_POLL_MIN_US 50000LL  // a ~40 byte response takes 42 ms at 9600 baud
+#define SENSOR_POLL_GUARD_MS 2      // response window ends this long before the next request
+
+#define SENSOR_DEFAULTS()                                                                  \
+    {                                                                                      \
+        .timestamp = 0, .tension = 0, .peak_tension = TENSION_NONE, .units = unit_none, .channel = 0 \
     }
 
 struct SensorData
 {
-    tm timestamp;
-    float tension;
-    float peak_tension;
-    char units[UNITS_LEN];
+    int64_t timestamp; // epoch microseconds, see System::getTimeUs()
+    tension_t tension;      // hundredths of units, see Tension.h
+    tension_t peak_tension; // TENSION_NONE when the gauge does not send it
+    tension_unit units;     // unit_none until the first frame
+    uint8_t channel;
+};
+
+// gauge output line layout
+enum sensor_format
+{
+    sensor_format_auto,     // try both per frame
+    sensor_format_datetime, // "[n] [date] [hh:mm:ss] [tension] [units] ..."
+    sensor_format_bare      // "[tension] [units] ..."
+};
+
+// UART wiring of one channel
+struct sensor_port
+{
+    uart_port_t uart;
+    int tx, rx, rts, cts;
+    uart_mode_t mode; // UART_MODE_RS485_HALF_DUPLEX drives the transceiver from rts
 };
 
+// frame counters of one channel since boot
+struct sensor_stats
+{
+    uint32_t frames;
+    uint32_t timeouts;
+    uint32_t parse_errors;
+    int64_t last_us; // reception time of the latest frame
+    esp_err_t status; // result of the latest readSerial() / poll()
+    uint32_t failures; // consecutive reads without a valid frame
+    uint32_t baud;
+    sensor_format format;
+    // polled mode only
+    int64_t poll_interval_us; // 0 - free running
+    uint32_t requests;
+    uint32_t responses;     // requests answered with a valid frame
+    int32_t latency_us;     // request to end of response, latest frame
+    int32_t max_latency_us;
+    int64_t sum_latency_us; // mean = sum_latency_us / responses
+};
+
+/*
+  Gauge channel
+
+  One instance per UART, each read by its own task with its own parser
+  state, reading ring and counters. instance(n) returns channel n;
+  channels() tells how many were initialized at boot.
+
+  A gauge free runs by default and readSerial() takes whatever frame
+  arrives. After startPolling() a one shot esp_timer sends a request on
+  every grid point of the poll interval (multiples since epoch, like the
+  Scheduler) and poll() reads the answer; the reading is stamped with the
+  request time and the request to response latency is recorded.
+
+  detect() finds the line settings of an unknown gauge: it listens at
+  each rate of SENSOR_BAUD_RATES (sending requests when polled), counts
+  the frames that parse in each layout and locks onto the rate and
+  layout with the most, logging one line per probe. The caller keeps the
+  result for the next boot and backs off after probes that found nothing.
+*/
 class Sensor
 {
 public:
-    static Sensor *instance(void);
+    static Sensor *instance(int channel = 0);
+    static int channels(void);
     esp_err_t init(void);
     esp_err_t readSerial(uint32_t delay);
+    esp_err_t startPolling(double interval_s);
+    void stopPolling(void);
+    bool polling(void);
+    esp_err_t poll(void);
     esp_err_t setBaud(uint32_t baud);
+    esp_err_t setFormat(sensor_format format);
+    esp_err_t detect(void);
     esp_err_t getData(SensorData* data_buff);
+    int getRing(Sample *data, int len, int64_t *base_us);
+    esp_err_t getStats(sensor_stats *stats);
+    int getChannel(void);
     void deinit(void);
     void dumpData(SensorData *data, int len);
     void flush(void);
@@ -83,13 +157,34 @@ public:
     // uint8_t getMode(void);
 
 private:
-    static Sensor *inst;
-    Sensor();
+    static Sensor *inst[SENSOR_CHANNELS];
+    static int _channels;
+    Sensor(int channel);
     SemaphoreHandle_t xSemaphore = NULL;
     bool _initialized = false;
     uint8_t _mode = 1;
+    uint32_t _baud = DEFAULT_BAUD;
+    sensor_format _format = sensor_format_auto;
+    int _channel;
+    const sensor_port *_port;
     SensorData _data = SENSOR_DEFAULTS();
-
+    Sample _ring[SENSOR_RING];
+    int64_t _ring_base = 0;   // epoch microseconds the ring's samples count from
+    uint32_t _ring_count = 0; // readings pushed, ring position
+    sensor_stats _stats = {};
+    int _frames_ok = -1, _frames_timeout = -1, _frames_invalid = -1, _poll_latency = -1;
+
+    esp_timer_handle_t _poll_timer = NULL;
+    TaskHandle_t _task = NULL; // task calling poll()
+    int64_t _poll_interval_us = 0;
+    volatile int64_t _request_us = 0; // written by the timer before it notifies _task
+    std::atomic<uint32_t> _requests{0};
+
+    esp_err_t _parse(const char *buff, int len, int64_t timestamp);
+    static bool _scan(const char *buff, sensor_format format, SensorData *data);
+    int _readLine(char *buff, int len, uint32_t timeout_ms);
+    void _armPoll(void);
+    static void _pollCallback(void *arg);
 };
 
 #endif // Sensor.h
\ No newline at end of file
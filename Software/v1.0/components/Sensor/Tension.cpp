@@ -0,0 +1,135 @@
+/*
+
+
+
+
+*/
+
+#include <string.h>
+
+#include "Tension.h"
+
+#define FACTOR_SCALE 100000000LL // conversion factors carry 8 decimals, |value| * factor stays below 2^62
+
+static const char *unit_names[unit_count] = {"", "lbf", "N", "kgf"};
+
+// newtons per unit - lbf via the international pound and standard gravity
+static constexpr double newtons[unit_count] = {0.0, 4.4482216152605, 1.0, 9.80665};
+
+//
+static constexpr int64_t factor(int from, int to)
+{
+    return (from == unit_none || to == unit_none) ? FACTOR_SCALE
+                                                  : (int64_t)(newtons[from] / newtons[to] * FACTOR_SCALE + 0.5);
+}
+
+#define FACTOR_ROW(from) {factor(from, unit_none), factor(from, unit_lbf), factor(from, unit_n), factor(from, unit_kgf)}
+
+// [from][to] multipliers, FACTOR_SCALE is 1:1 - built at compile time
+static constexpr int64_t factors[unit_count][unit_count] = {
+    FACTOR_ROW(unit_none), FACTOR_ROW(unit_lbf), FACTOR_ROW(unit_n), FACTOR_ROW(unit_kgf)};
+
+static_assert(factors[unit_lbf][unit_n] == 444822162, "lbf to N factor");
+static_assert(factors[unit_kgf][unit_n] == 980665000, "kgf to N factor");
+
+// name of @unit as the gauge prints it, "" for unit_none
+const char *tension_unit_name(tension_unit unit)
+{
+    return (unit < unit_count) ? unit_names[unit] : "";
+}
+
+// unit of the @len byte gauge token @text, unit_none when not recognized
+tension_unit tension_unit_parse(const char *text, size_t len)
+{
+    if (len == 1 && text[0] == 'N')
+        return unit_n;
+    if (len == 3 && text[1] == 'b' && text[0] == 'l' && text[2] == 'f')
+        return unit_lbf;
+    if (len == 3 && text[1] == 'g' && text[0] == 'k' && text[2] == 'f')
+        return unit_kgf;
+    return unit_none;
+}
+
+// @len byte decimal token to fixed point, rounded half away from zero - false when not a number
+bool tension_parse(const char *text, size_t len, tension_t *value)
+{
+    size_t i = 0;
+    bool negative = false;
+    int64_t result = 0;
+    int digits = 0, fraction = 0;
+
+    if (i < len && (text[i] == '-' || text[i] == '+'))
+        negative = (text[i++] == '-');
+    for (; i < len && text[i] >= '0' && text[i] <= '9'; i++, digits++)
+    {
+        result = result * 10 + (text[i] - '0');
+        if (result > INT32_MAX / TENSION_SCALE)
+            return false;
+    }
+    result *= TENSION_SCALE;
+    if (i < len && text[i] == '.')
+    {
+        for (i++; i < len && text[i] >= '0' && text[i] <= '9'; i++, digits++, fraction++)
+        {
+            if (fraction == 0)
+                result += (text[i] - '0') * 10;
+            else if (fraction == 1)
+                result += text[i] - '0';
+            else if (fraction == 2 && text[i] >= '5')
+                result++;
+        }
+    }
+    if (i != len || digits == 0 || result > INT32_MAX)
+        return false;
+    *value = (tension_t)(negative ? -result : result);
+    return true;
+}
+
+// exact decimal text of @value with two fraction digits, returns the length without '\0'
+size_t tension_format(char *buff, size_t len, tension_t value)
+{
+    char digits[TENSION_TEXT_LEN];
+    size_t n = 0, count = 0;
+    int64_t v = value;
+
+    if (buff == NULL || len < TENSION_TEXT_LEN)
+        return 0;
+    if (v < 0)
+    {
+        buff[n++] = '-';
+        v = -v;
+    }
+    // least significant first: two fraction digits, then at least one whole digit
+    do
+    {
+        digits[count++] = '0' + v % 10;
+        v /= 10;
+        if (count == 2)
+            digits[count++] = '.';
+    } while (v > 0 || count < 4);
+    while (count > 0)
+        buff[n++] = digits[--count];
+    buff[n] = '\0';
+    return n;
+}
+
+// @value from one unit to another, rounded to the nearest hundredth - unit_none on either side leaves it as is
+tension_t tension_convert(tension_t value, tension_unit from, tension_unit to)
+{
+    if (from == to || value == TENSION_NONE || from >= unit_count || to >= unit_count)
+        return value;
+    int64_t scaled = (int64_t)value * factors[from][to];
+    int64_t result = (scaled >= 0) ? (scaled + FACTOR_SCALE / 2) / FACTOR_SCALE
+                                   : -((-scaled + FACTOR_SCALE / 2) / FACTOR_SCALE);
+    if (result > INT32_MAX)
+        return INT32_MAX;
+    if (result <= INT32_MIN)
+        return INT32_MIN + 1;
+    return (tension_t)result;
+}
+
+// whole units, for JSON responses only
+double tension_to_double(tension_t value)
+{
+    return (double)value / TENSION_SCALE;
+}
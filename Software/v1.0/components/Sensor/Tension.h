@@ -0,0 +1,43 @@
+/*
+
+
+
+
+*/
+
+#ifndef TENSION_H
+#define TENSION_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define TENSION_SCALE 100      // fixed point tension counts hundredths of its unit
+#define TENSION_NONE INT32_MIN // no value, e.g. the peak of a gauge that does not send one
+#define TENSION_TEXT_LEN 13    // "-21474836.47" + '\0'
+
+typedef int32_t tension_t;
+
+// units the gauge reports in
+enum tension_unit : uint8_t
+{
+    unit_none, // nothing received yet / no conversion
+    unit_lbf,
+    unit_n,
+    unit_kgf,
+    unit_count
+};
+
+// name of @unit as the gauge prints it, "" for unit_none
+const char *tension_unit_name(tension_unit unit);
+// unit of the @len byte gauge token @text, unit_none when not recognized
+tension_unit tension_unit_parse(const char *text, size_t len);
+// @len byte decimal token to fixed point, rounded half away from zero - false when not a number
+bool tension_parse(const char *text, size_t len, tension_t *value);
+// exact decimal text of @value with two fraction digits, returns the length without '\0'
+size_t tension_format(char *buff, size_t len, tension_t value);
+// @value from one unit to another, rounded to the nearest hundredth - unit_none on either side leaves it as is
+tension_t tension_convert(tension_t value, tension_unit from, tension_unit to);
+// whole units, for JSON responses only
+double tension_to_double(tension_t value);
+
+#endif // Tension.h
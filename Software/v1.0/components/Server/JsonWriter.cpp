@@ -0,0 +1,211 @@
+/*
+
+
+
+
+*/
+
+#include "JsonWriter.h"
+
+static const char hex_digits[] = "0123456789abcdef";
+
+//
+JsonWriter::JsonWriter(json_writer_t writer, void *ctx)
+{
+    this->_writer = writer;
+    this->_ctx = ctx;
+    this->_first[0] = true;
+}
+
+// first error of the writer or of the nesting, ESP_OK when everything went out
+esp_err_t JsonWriter::status(void)
+{
+    return this->_rc;
+}
+
+// @len bytes of @buff to the writer, nothing once a write failed
+void JsonWriter::_write(const char *buff, size_t len)
+{
+    if (this->_rc == ESP_OK && len > 0)
+        this->_rc = this->_writer(this->_ctx, buff, len);
+}
+
+// @text between quotes, runs that need no escape are written as they are
+void JsonWriter::_quoted(const char *text)
+{
+    char escape[6] = {'\\', 'u', '0', '0', 0, 0};
+    const char *run = text;
+    size_t len;
+
+    this->_write("\"", 1);
+    for (const char *c = text; *c != '\0'; c++)
+    {
+        unsigned char ch = (unsigned char)*c;
+        if (ch >= 0x20 && ch != '"' && ch != '\\')
+            continue;
+        this->_write(run, c - run);
+        run = c + 1;
+        len = 2;
+        switch (ch)
+        {
+        case '"':
+        case '\\':
+            escape[1] = ch;
+            break;
+        case '\n':
+            escape[1] = 'n';
+            break;
+        case '\r':
+            escape[1] = 'r';
+            break;
+        case '\t':
+            escape[1] = 't';
+            break;
+        case '\b':
+            escape[1] = 'b';
+            break;
+        case '\f':
+            escape[1] = 'f';
+            break;
+        default: // other control characters as \u00XX
+            escape[1] = 'u';
+            escape[4] = hex_digits[ch >> 4];
+            escape[5] = hex_digits[ch & 0x0f];
+            len = 6;
+            break;
+        }
+        this->_write(escape, len);
+    }
+    this->_write(run, strlen(run));
+    this->_write("\"", 1);
+}
+
+// separator to the previous member and "@key": when in an object
+void JsonWriter::_key(const char *key)
+{
+    if (!this->_first[this->_depth])
+        this->_write(",", 1);
+    this->_first[this->_depth] = false;
+    if (key != NULL)
+    {
+        this->_quoted(key);
+        this->_write(":", 1);
+    }
+}
+
+// start an object or array at @key
+esp_err_t JsonWriter::_open(const char *key, char bracket)
+{
+    if (this->_depth >= JSON_MAX_DEPTH)
+    {
+        if (this->_rc == ESP_OK)
+            this->_rc = ESP_ERR_INVALID_STATE;
+        return this->_rc;
+    }
+    this->_key(key);
+    this->_write(&bracket, 1);
+    this->_depth++;
+    this->_first[this->_depth] = true;
+    return this->_rc;
+}
+
+// end the innermost object or array
+esp_err_t JsonWriter::_close(char bracket)
+{
+    if (this->_depth == 0)
+    {
+        if (this->_rc == ESP_OK)
+            this->_rc = ESP_ERR_INVALID_STATE;
+        return this->_rc;
+    }
+    this->_depth--;
+    this->_write(&bracket, 1);
+    return this->_rc;
+}
+
+//
+esp_err_t JsonWriter::beginObject(const char *key)
+{
+    return this->_open(key, '{');
+}
+
+//
+esp_err_t JsonWriter::endObject(void)
+{
+    return this->_close('}');
+}
+
+//
+esp_err_t JsonWriter::beginArray(const char *key)
+{
+    return this->_open(key, '[');
+}
+
+//
+esp_err_t JsonWriter::endArray(void)
+{
+    return this->_close(']');
+}
+
+// escaped @value, NULL is written as null
+esp_err_t JsonWriter::string(const char *key, const char *value)
+{
+    if (value == NULL)
+        return this->null(key);
+    this->_key(key);
+    this->_quoted(value);
+    return this->_rc;
+}
+
+// @value as cJSON prints it, NaN and infinities are not JSON and go out as null
+esp_err_t JsonWriter::number(const char *key, double value)
+{
+    char buff[JSON_NUMBER_LEN];
+    int len;
+
+    if (!isfinite(value))
+        return this->null(key);
+    if (value == 0) // -0 as well
+        len = snprintf(buff, sizeof(buff), "0");
+    else if (value == floor(value) && fabs(value) < 1e15)
+        len = snprintf(buff, sizeof(buff), "%.0f", value);
+    else
+    {
+        len = snprintf(buff, sizeof(buff), "%.15g", value);
+        if (strtod(buff, NULL) != value)
+            len = snprintf(buff, sizeof(buff), "%.17g", value);
+    }
+    this->_key(key);
+    this->_write(buff, len);
+    return this->_rc;
+}
+
+// @value exactly, counters and times past the 53 bits a double holds
+esp_err_t JsonWriter::integer(const char *key, int64_t value)
+{
+    char buff[JSON_NUMBER_LEN];
+    int len = snprintf(buff, sizeof(buff), "%" PRId64, value);
+
+    this->_key(key);
+    this->_write(buff, len);
+    return this->_rc;
+}
+
+//
+esp_err_t JsonWriter::boolean(const char *key, bool value)
+{
+    this->_key(key);
+    if (value)
+        this->_write("true", 4);
+    else
+        this->_write("false", 5);
+    return this->_rc;
+}
+
+//
+esp_err_t JsonWriter::null(const char *key)
+{
+    this->_key(key);
+    this->_write("null", 4);
+    return this->_rc;
+}
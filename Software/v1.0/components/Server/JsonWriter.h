@@ -0,0 +1,68 @@
+/*
+
+
+
+
+*/
+
+#ifndef JSON_WRITER_H
+#define JSON_WRITER_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+
+#include "esp_err.h"
+
+#define JSON_MAX_DEPTH 8     // nested objects / arrays of one response
+#define JSON_NUMBER_LEN 32   // "%.17g" of any double, sign and exponent included
+
+// output, called with every token - usually chunk_write() of the server
+typedef esp_err_t (*json_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Streaming JSON writer
+
+  Emits a document token by token through the writer callback instead
+  of building a cJSON tree and printing it, so a response costs the
+  writer's chunk buffer and this object whatever its length. Keys and
+  string values are escaped, doubles are printed like cJSON does -
+  integral values without a fraction, otherwise the shortest of %.15g
+  and %.17g that reads back the same, non-finite ones as null. Pass a
+  NULL key for array elements and for the root. The first failure of
+  the writer or a nesting deeper than JSON_MAX_DEPTH is kept, later
+  calls are ignored and status() returns it at the end.
+*/
+class JsonWriter
+{
+public:
+    JsonWriter(json_writer_t writer, void *ctx);
+    esp_err_t beginObject(const char *key = NULL);
+    esp_err_t endObject(void);
+    esp_err_t beginArray(const char *key = NULL);
+    esp_err_t endArray(void);
+    esp_err_t string(const char *key, const char *value);
+    esp_err_t number(const char *key, double value);
+    esp_err_t integer(const char *key, int64_t value);
+    esp_err_t boolean(const char *key, bool value);
+    esp_err_t null(const char *key);
+    esp_err_t status(void);
+
+private:
+    json_writer_t _writer;
+    void *_ctx;
+    esp_err_t _rc = ESP_OK;
+    int _depth = 0;
+    bool _first[JSON_MAX_DEPTH + 1]; // no member written yet at that depth
+
+    void _write(const char *buff, size_t len);
+    void _quoted(const char *text);
+    void _key(const char *key);
+    esp_err_t _open(const char *key, char bracket);
+    esp_err_t _close(char bracket);
+};
+
+#endif // JsonWriter.h
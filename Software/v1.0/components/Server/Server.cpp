@@ -9,6 +9,11 @@
 
 static const char *TAG = "Server";
 
+// handler run time into /metrics and /trace
+#define HANDLER_SCOPE(name)                                                                                    \
+    METRICS_TIME_SCOPE("http_handler_duration_us", "handler=\"" name "\"", "HTTP handler run time"); \
+    TRACE_SCOPE("http " name)
+
 #define CHECK_FILE_EXTENSION(filename, ext) (strcasecmp(&filename[strlen(filename) - strlen(ext)], ext) == 0)
 
 //
@@ -42,9 +47,48 @@ static esp_err_t set_content_type_from_file(httpd_req_t *req, const char *filepa
     return httpd_resp_set_type(req, type);
 }
 
+// lines collected in the scratch buffer, sent as one chunk when full
+typedef struct chunk_writer
+{
+    httpd_req_t *req;
+    char *buff;
+    size_t used;
+} chunk_writer_t;
+
+//
+static esp_err_t chunk_write(void *ctx, const char *buff, size_t len)
+{
+    chunk_writer_t *out = (chunk_writer_t *)ctx;
+    if (out->used + len > SCRATCH_BUFSIZE)
+    {
+        if (httpd_resp_send_chunk(out->req, out->buff, out->used) != ESP_OK)
+            return ESP_FAIL;
+        out->used = 0;
+    }
+    if (len > SCRATCH_BUFSIZE)
+        return httpd_resp_send_chunk(out->req, buff, len);
+    memcpy(out->buff + out->used, buff, len);
+    out->used += len;
+    return ESP_OK;
+}
+
+// send what is left in @out and end the response, or abort it when @rc failed
+static esp_err_t chunk_end(chunk_writer_t *out, esp_err_t rc)
+{
+    if (rc != ESP_OK || (out->used > 0 && httpd_resp_send_chunk(out->req, out->buff, out->used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "chunk_end(): failed to send %s", out->req->uri);
+        httpd_resp_sendstr_chunk(out->req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(out->req, NULL, 0);
+    return ESP_OK;
+}
+
 // Handler GET: /*
 static esp_err_t common_get_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("common_get");
     char filepath[FILE_PATH_MAX];
     rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
     strlcpy(filepath, rest_context->base_path, sizeof(filepath));
@@ -100,6 +144,7 @@ static esp_err_t common_get_handler(httpd_req_t *req)
 // Handler GET: /sdcard/*
 static esp_err_t data_get_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("data_get");
     char filepath[FILE_PATH_MAX], *file_name;
     SDCard *card = SDCard::instance();
     rest_server_context_t *rest_context = (rest_server_context_t *)req->user_ctx;
@@ -108,6 +153,15 @@ static esp_err_t data_get_handler(httpd_req_t *req)
     file_name = strtok(NULL, "/");
     //ESP_LOGI(TAG, "data_get_handler(): second tok %s", file_name);
 
+    // the file being logged is preallocated, send only the data part
+    char active_name[MAX_FILE_NAME];
+    uint64_t left = UINT64_MAX, active_size = 0;
+    if (file_name != NULL && Storage::instance()->getActiveFile(active_name, sizeof(active_name), &active_size) == ESP_OK)
+    {
+        if (strcmp(active_name, file_name) == 0)
+            left = active_size;
+    }
+
     if (card->mount() != ESP_OK)
     {
         ESP_LOGE(TAG, "data_get_handler(): failed to mount");
@@ -127,9 +181,10 @@ static esp_err_t data_get_handler(httpd_req_t *req)
     ssize_t chunksize;
     do
     {
-        chunksize = card->readFile(chunk, SCRATCH_BUFSIZE);
+        chunksize = card->readFile(chunk, (left < SCRATCH_BUFSIZE) ? (size_t)left : SCRATCH_BUFSIZE);
         if (chunksize > 0)
         {
+            left -= chunksize;
             /* Send the buffer contents as HTTP response chunk */
             if (httpd_resp_send_chunk(req, chunk, chunksize) != ESP_OK)
             {
@@ -153,49 +208,141 @@ static esp_err_t data_get_handler(httpd_req_t *req)
 // Handler: GET /measurement
 static esp_err_t measurements_get_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("measurements_get");
     /* {
         present: bool,
         message: str, (comma separated)
         color: str,
         timestamp: str,
         tension: int,
-        units: str
+        units: str,
+        channel: num     ?channel=n, 0 by default
+        seq: num         newest /history sequence
+        alarms: [str]    rules raised on the channel, "high" / "low" / "rate"
+        alarm_seq: num   newest /alarms sequence, a change means new events
     } */
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
+    System *sys = System::instance();
+    SensorData sen_data = SENSOR_DEFAULTS();
+    char buff[ERROR_MSG_LEN], value[8];
+    int channel = 0;
+
+    if (httpd_req_get_url_query_str(req, buff, sizeof(buff)) == ESP_OK &&
+        httpd_query_key_value(buff, "channel", value, sizeof(value)) == ESP_OK)
+        channel = atoi(value);
+    if (channel < 0 || channel >= Sensor::channels())
     {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown channel");
         return ESP_FAIL;
     }
+    Sensor *sen = Sensor::instance(channel);
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
 
-    System *sys = System::instance();
-    Sensor *sen = Sensor::instance();
-    SensorData sen_data = SENSOR_DEFAULTS();
-    char buff[ERROR_MSG_LEN];
-
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
     // Status field
-    cJSON_AddBoolToObject(root, "present", (sys->getErrorFlag(sensor_not_found) == true) ? false : true);
+    json.boolean("present", (sys->getErrorFlag(sensor_not_found) == true) ? false : true);
     sys->getErrorMsg(buff, sizeof(buff));
-    cJSON_AddStringToObject(root, "message", buff);
+    json.string("message", buff);
     sys->getErrorMsgColor(buff, sizeof(buff));
-    cJSON_AddStringToObject(root, "color", buff);
+    json.string("color", buff);
     sen->getData(&sen_data);
     sys->getTimeString(buff, sizeof(buff), TIME_FORMAT_SEC, sen_data.timestamp);
-    cJSON_AddStringToObject(root, "timestamp", buff);
-    cJSON_AddNumberToObject(root, "tension", sen_data.tension);
-    cJSON_AddStringToObject(root, "units", sen_data.units);
+    json.string("timestamp", buff);
+    json.number("tension", tension_to_double(sen_data.tension));
+    json.string("units", tension_unit_name(sen_data.units));
+    json.integer("channel", channel);
+    json.integer("seq", History::instance()->seq());
+    json.beginArray("alarms");
+    uint32_t active = Alarm::instance()->active(channel);
+    for (int r = 0; r < alarm_rules; r++)
+    {
+        if (active & (1UL << r))
+            json.string(NULL, Alarm::ruleName((alarm_rule)r));
+    }
+    json.endArray();
+    json.integer("alarm_seq", Alarm::instance()->seq());
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Handler: GET /channels
+static esp_err_t channels_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("channels_get");
+    /* {
+            channels: [{channel: num, status: str, frames: num, timeouts: num, parse_errors: num,
+                        baud: num, format: str,
+                        poll: {interval_us: num, requests: num, responses: num, latency_us: num,
+                               max_latency_us: num, mean_latency_us: num},     polled mode only
+                        recent: [{time: str, tension: num, peak: num (if sent), units: str}, ...]}, ...]   oldest first
+     }*/
+    System *sys = System::instance();
+    Sample recent[SENSOR_RING];
+    SensorData reading_data;
+    int64_t base;
+    sensor_stats stats;
+    char buff[TIME_FORMAT_MS_LEN];
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
 
-    const char *json_str = cJSON_Print(root);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, json_str);
-    free((void *)json_str);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json.beginObject();
+    json.beginArray("channels");
+    for (int i = 0; i < Sensor::channels() && json.status() == ESP_OK; i++)
+    {
+        Sensor *sen = Sensor::instance(i);
+        if (sen->getStats(&stats) != ESP_OK)
+            continue;
+        json.beginObject();
+        json.integer("channel", i);
+        json.string("status", esp_err_to_name(stats.status));
+        json.integer("frames", stats.frames);
+        json.integer("timeouts", stats.timeouts);
+        json.integer("parse_errors", stats.parse_errors);
+        json.integer("baud", stats.baud);
+        json.string("format", (stats.format == sensor_format_datetime) ? "datetime"
+                              : (stats.format == sensor_format_bare)   ? "bare"
+                                                                       : "auto");
+        if (stats.poll_interval_us != 0)
+        {
+            json.beginObject("poll");
+            json.integer("interval_us", stats.poll_interval_us);
+            json.integer("requests", stats.requests);
+            json.integer("responses", stats.responses);
+            json.integer("latency_us", stats.latency_us);
+            json.integer("max_latency_us", stats.max_latency_us);
+            json.integer("mean_latency_us", stats.responses ? stats.sum_latency_us / stats.responses : 0);
+            json.endObject();
+        }
+        json.beginArray("recent");
+        int count = sen->getRing(recent, SENSOR_RING, &base);
+        for (int j = 0; j < count; j++)
+        {
+            sample_unpack(&recent[j], base, &reading_data);
+            sys->getTimeStringMs(buff, sizeof(buff), reading_data.timestamp);
+            json.beginObject();
+            json.string("time", buff);
+            json.number("tension", tension_to_double(reading_data.tension));
+            if (reading_data.peak_tension != TENSION_NONE)
+                json.number("peak", tension_to_double(reading_data.peak_tension));
+            json.string("units", tension_unit_name(reading_data.units));
+            json.endObject();
+        }
+        json.endArray();
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return chunk_end(&out, json.status());
 }
 
 // Handler: POST /settings.json
 static esp_err_t settings_post_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("settings_post");
     int total_len = req->content_len, cur_len = 0, received = 0;
     char *buff = ((rest_server_context_t *)(req->user_ctx))->scratch;
     if (total_len >= SCRATCH_BUFSIZE)
@@ -257,90 +404,498 @@ static esp_err_t settings_post_handler(httpd_req_t *req)
 // Hanlder: GET /memory
 static esp_err_t memory_get_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("memory_get");
     /* {
             present: bool,
             cardtype: str,
             totalmem: str,
             freemem: int,
         }*/
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
-    {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
-        cJSON_Delete(root);
-        return ESP_FAIL;
-    }
     SDCard *card = SDCard::instance();
     SDCardSpace card_mem;
     card_mem.cardSize = 0;
     card_mem.totalBytes = 0;
     card_mem.freeBytes = 0;
     char buff[25];
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
 
     esp_err_t card_in = card->mount();
     if (card_in == ESP_OK)
     {
-        cJSON_AddBoolToObject(root, "present", true);
         card->getCardSpace(&card_mem);
         card->unmount();
-        cJSON_AddStringToObject(root, "cardtype", card_mem.name);
+    }
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
+    if (card_in == ESP_OK)
+    {
+        json.boolean("present", true);
+        json.string("cardtype", card_mem.name);
         snprintf(buff, sizeof(buff), "%llu", card_mem.totalBytes);
-        cJSON_AddStringToObject(root, "totalmem", buff);
+        json.string("totalmem", buff);
         snprintf(buff, sizeof(buff), "%llu", card_mem.freeBytes);
-        cJSON_AddStringToObject(root, "freemem", buff);
+        json.string("freemem", buff);
     }
     else
     {
-        cJSON_AddBoolToObject(root, "present", false);
-        cJSON_AddStringToObject(root, "cardtype", "not found");
-        cJSON_AddStringToObject(root, "totalmem", "0");
-        cJSON_AddStringToObject(root, "freemem", "0");
+        json.boolean("present", false);
+        json.string("cardtype", "not found");
+        json.string("totalmem", "0");
+        json.string("freemem", "0");
     }
+    json.endObject();
 
-    const char *json_str = cJSON_Print(root);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, json_str);
-    free((void *)json_str);
-    cJSON_Delete(root);
-    return ESP_OK;
+    return chunk_end(&out, json.status());
 }
 
 // Hanlder: GET /datetime
 static esp_err_t datetime_get_handler(httpd_req_t *req)
 {
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
-    {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
-        cJSON_Delete(root);
-        return ESP_FAIL;
-    }
+    HANDLER_SCOPE("datetime_get");
     System *sys = System::instance();
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
     char buff[TIME_LEN];
     memset(buff, 0, sizeof(buff));
     tm sys_date;
 
     sys->getTime(&sys_date);
     sys->getTimeString(buff, sizeof(buff), TIME_FORMAT, sys_date);
-    cJSON_AddStringToObject(root, "datetime", buff);
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
+    json.string("datetime", buff);
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Hanlder: GET /clock
+static esp_err_t clock_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("clock_get");
+    /* {
+            locked: bool,
+            edges: num,
+            missed: num,
+            relocks: num,
+            offset_us: num,
+            max_offset_us: num,
+            drift_ppm: num
+     }*/
+    System *sys = System::instance();
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
+    pps_stats stats;
 
-    const char *json_str = cJSON_Print(root);
+    if (sys->getPPSStats(&stats) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "failed to get clock stats");
+        return ESP_FAIL;
+    }
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, json_str);
-    free((void *)json_str);
-    cJSON_Delete(root);
+    json.beginObject();
+    json.boolean("available", sys->ppsAvailable());
+    json.boolean("locked", stats.locked);
+    json.integer("edges", stats.edges);
+    json.integer("missed", stats.missed);
+    json.integer("relocks", stats.relocks);
+    json.integer("offset_us", stats.offset_us);
+    json.integer("max_offset_us", stats.max_offset_us);
+    json.number("drift_ppm", stats.drift_ppm);
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Hanlder: GET /schedule
+static esp_err_t schedule_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("schedule_get");
+    /* {
+            interval_us: num,
+            ticks: num,
+            skipped: num,
+            resyncs: num,
+            mean_late_us: num,
+            max_late_us: num,
+            histogram: [{le_us: num, count: num}, ...]   le_us -1 - open bucket
+     }*/
+    scheduler_stats stats;
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
+
+    if (Scheduler::instance()->getStats(&stats) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "failed to get scheduler stats");
+        return ESP_FAIL;
+    }
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
+    json.integer("interval_us", stats.interval_us);
+    json.integer("ticks", stats.ticks);
+    json.integer("skipped", stats.skipped);
+    json.integer("resyncs", stats.resyncs);
+    json.number("mean_late_us", stats.ticks ? (double)stats.sum_late_us / stats.ticks : 0);
+    json.integer("max_late_us", stats.max_late_us);
+    json.beginArray("histogram");
+    for (int i = 0; i < SCHEDULER_BUCKETS; i++)
+    {
+        json.beginObject();
+        json.integer("le_us", Scheduler::bucketLimit(i));
+        json.integer("count", stats.histogram[i]);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Hanlder: GET /errors
+static esp_err_t errors_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("errors_get");
+    /* {
+            flags: [{name: str, active: bool, count: num, total_s: num}, ...],
+            history: [{time: str, name: str, set: bool}, ...]   oldest first
+     }*/
+    System *sys = System::instance();
+    error_stats stats[error_flag_num];
+    error_event events[ERROR_HISTORY_LEN];
+    char buff[TIME_LEN];
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
+    int count;
+
+    sys->getErrorStats(stats, error_flag_num);
+    count = sys->getErrorHistory(events, ERROR_HISTORY_LEN);
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
+    json.beginArray("flags");
+    for (int i = 0; i < error_flag_num; i++)
+    {
+        json.beginObject();
+        json.string("name", sys->getErrorName((error_flag)i));
+        json.boolean("active", stats[i].active);
+        json.integer("count", stats[i].count);
+        json.number("total_s", (double)stats[i].total_us / US_PER_SEC);
+        json.endObject();
+    }
+    json.endArray();
+    json.beginArray("history");
+    for (int i = 0; i < count && json.status() == ESP_OK; i++)
+    {
+        sys->getTimeStringMs(buff, sizeof(buff), events[i].time_us);
+        json.beginObject();
+        json.string("time", buff);
+        json.string("name", sys->getErrorName((error_flag)events[i].flag));
+        json.boolean("set", events[i].set);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Handler: GET /locks
+static esp_err_t locks_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("locks_get");
+    /* {
+            enabled: bool,      built with CONFIG_LOCK_PROFILE
+            locks: [{name: str, takes: num, contended: num, timeouts: num,
+                     wait_us: num, max_wait_us: num, hold_us: num, max_hold_us: num,
+                     holder: str | null, held_us: num, max_holder: str, timeout_holder: str}, ...]
+     }  wait and hold totals since boot, held_us is the current hold */
+    static lock_stats locks[LOCK_PROFILE_MAX]; // one request at a time on the server task, too large for its stack
+    int64_t now = esp_timer_get_time();
+    int count = lock_get_stats(locks, LOCK_PROFILE_MAX);
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
+
+    httpd_resp_set_type(req, "application/json");
+    json.beginObject();
+#ifdef CONFIG_LOCK_PROFILE
+    json.boolean("enabled", true);
+#else
+    json.boolean("enabled", false);
+#endif
+    json.beginArray("locks");
+    for (int i = 0; i < count && json.status() == ESP_OK; i++)
+    {
+        json.beginObject();
+        json.string("name", locks[i].name);
+        json.integer("takes", locks[i].takes);
+        json.integer("contended", locks[i].contended);
+        json.integer("timeouts", locks[i].timeouts);
+        json.integer("wait_us", locks[i].wait_us);
+        json.integer("max_wait_us", locks[i].max_wait_us);
+        json.integer("hold_us", locks[i].hold_us);
+        json.integer("max_hold_us", locks[i].max_hold_us);
+        json.string("holder", (locks[i].holder != NULL) ? pcTaskGetTaskName(locks[i].holder) : NULL);
+        json.integer("held_us", (locks[i].holder != NULL) ? now - locks[i].held_since_us : 0);
+        json.string("max_holder", locks[i].max_holder);
+        json.string("timeout_holder", locks[i].timeout_holder);
+        json.endObject();
+    }
+    json.endArray();
+    json.endObject();
+
+    return chunk_end(&out, json.status());
+}
+
+// Hanlder: GET /metrics
+static esp_err_t metrics_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("metrics_get");
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    if (Metrics::instance()->write(chunk_write, &out) != ESP_OK ||
+        (out.used > 0 && httpd_resp_send_chunk(req, out.buff, out.used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "metrics_get_handler(): failed to send metrics");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Handler: GET /history
+static esp_err_t history_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("history_get");
+    /* ?since=seq&channel=n&limit=n, all optional
+       {
+            seq: num,       pass back as since= to get only newer samples
+            scale: num,     values are integers, divide by it
+            step: num,      rollup length in seconds
+            units: [str],   unit column indexes these
+            rollups: [[dt_s, channel, mean, min, max, unit, count], ...],   only when the gap reaches past samples
+            samples: [[dt_ms, channel, tension, peak | null, unit], ...]
+     }  dt is the difference to the previous row, the first row's is epoch time */
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    char query[64], value[12];
+    uint32_t since = 0, limit = 0;
+    int channel = -1;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)
+            since = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "limit", value, sizeof(value)) == ESP_OK)
+            limit = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "channel", value, sizeof(value)) == ESP_OK)
+        {
+            channel = atoi(value);
+            if (channel < 0 || channel >= Sensor::channels())
+            {
+                httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Unknown channel");
+                return ESP_FAIL;
+            }
+        }
+    }
+    httpd_resp_set_type(req, "application/json");
+    if (History::instance()->write(chunk_write, &out, since, channel, limit) != ESP_OK ||
+        (out.used > 0 && httpd_resp_send_chunk(req, out.buff, out.used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "history_get_handler(): failed to send history");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Handler: GET /alarms
+static esp_err_t alarms_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("alarms_get");
+    /* ?since=seq, optional
+       {
+            seq: num,       pass back as since= to get only newer events
+            scale: num,     values are integers, divide by it
+            active: [[channel, rule], ...],     rules raised now
+            events: [[seq, epoch_ms, channel, rule, raised 1 | cleared 0, value, units], ...]
+     }  the last ALARM_EVENTS events are kept, the full log is ALARM_FILE on the card */
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    char query[32], value[12];
+    uint32_t since = 0;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK &&
+        httpd_query_key_value(query, "since", value, sizeof(value)) == ESP_OK)
+        since = strtoul(value, NULL, 10);
+    httpd_resp_set_type(req, "application/json");
+    if (Alarm::instance()->write(chunk_write, &out, since) != ESP_OK ||
+        (out.used > 0 && httpd_resp_send_chunk(req, out.buff, out.used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "alarms_get_handler(): failed to send alarms");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Handler: GET /rollup
+static esp_err_t rollup_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("rollup_get");
+    /* ?channel=n&from=epoch_s&to=epoch_s&resolution=s, all optional - the last week at ~ROLLUP_POINTS rows by default
+       {
+            step: num,      bucket seconds of the level picked, the coarsest one not above resolution
+            scale: num,     values are integers, divide by it
+            units: [str],   unit column indexes these
+            rows: [[dt_s, count, min, max, mean, unit], ...],   dt to the previous row, the first row's is epoch time
+            truncated: bool
+     }*/
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    char query[96], value[12];
+    uint32_t to = (uint32_t)(System::instance()->getTimeUs() / US_PER_SEC);
+    uint32_t from = (to > ROLLUP_DEFAULT_RANGE) ? to - ROLLUP_DEFAULT_RANGE : 0, resolution = 0;
+    int channel = 0;
+
+    if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if (httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
+            from = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
+            to = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "resolution", value, sizeof(value)) == ESP_OK)
+            resolution = strtoul(value, NULL, 10);
+        if (httpd_query_key_value(query, "channel", value, sizeof(value)) == ESP_OK)
+            channel = atoi(value);
+    }
+    if (channel < 0 || channel >= Sensor::channels() || from > to)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad channel or range");
+        return ESP_FAIL;
+    }
+    if (resolution == 0)
+        resolution = (to - from) / ROLLUP_POINTS;
+    httpd_resp_set_type(req, "application/json");
+    if (Rollup::instance()->query(channel, from, to, resolution, chunk_write, &out) != ESP_OK ||
+        (out.used > 0 && httpd_resp_send_chunk(req, out.buff, out.used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "rollup_get_handler(): failed to send rollups");
+        if (out.used == 0)
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "SD card not available");
+        else
+            httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Handler: GET /query
+static esp_err_t query_get_handler(httpd_req_t *req)
+{
+    HANDLER_SCOPE("query_get");
+    /* ?files=a.csv,b.csv&from=YYYY-MM-DDTHH:MM:SS&to=...&bucket=60s&agg=max,mean,count&channel=n&format=csv|json
+       all optional - every log file, the whole range, 60 s, all aggregates, channel 0, JSON
+       {
+            bucket: num, channel: num,
+            columns: ["time", agg..., "units"],
+            rows: [[str, num..., str], ...],    bucket start in local time
+            buckets: num
+     }*/
+    static Query query; // one request at a time on the server task, too large for its stack
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    char params[QUERY_URL_LEN], files[QUERY_URL_LEN], value[QUERY_PARAM_LEN], aggs[QUERY_PARAM_LEN] = "min,max,mean,count";
+    int64_t from = 0, to = INT64_MAX;
+    uint32_t bucket = 60;
+    int channel = 0;
+    query_format format = query_json;
+    bool valid = true;
+
+    files[0] = '\0';
+    if (httpd_req_get_url_query_len(req) >= sizeof(params))
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Query too long");
+        return ESP_FAIL;
+    }
+    if (httpd_req_get_url_query_str(req, params, sizeof(params)) == ESP_OK)
+    {
+        if (httpd_query_key_value(params, "files", files, sizeof(files)) != ESP_OK)
+            files[0] = '\0';
+        if (httpd_query_key_value(params, "from", value, sizeof(value)) == ESP_OK)
+            valid = valid && Query::parseTime(value, strlen(value), &from);
+        if (httpd_query_key_value(params, "to", value, sizeof(value)) == ESP_OK)
+            valid = valid && Query::parseTime(value, strlen(value), &to);
+        if (httpd_query_key_value(params, "bucket", value, sizeof(value)) == ESP_OK)
+            valid = valid && (bucket = Query::parseDuration(value)) > 0;
+        if (httpd_query_key_value(params, "channel", value, sizeof(value)) == ESP_OK)
+            channel = atoi(value);
+        if (httpd_query_key_value(params, "format", value, sizeof(value)) == ESP_OK)
+            format = (strcmp(value, "csv") == 0) ? query_csv : query_json;
+        if (httpd_query_key_value(params, "agg", value, sizeof(value)) == ESP_OK)
+            strlcpy(aggs, value, sizeof(aggs));
+    }
+    if (!valid || channel >= Sensor::channels() || query.init(channel, from, to, bucket, aggs, format) != ESP_OK)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad query");
+        return ESP_FAIL;
+    }
+
+    if (format == query_csv)
+    {
+        httpd_resp_set_type(req, "text/csv");
+        httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"query.csv\"");
+    }
+    else
+        httpd_resp_set_type(req, "application/json");
+    esp_err_t rc = query.run(files, chunk_write, &out);
+    if (rc == ESP_OK && out.used > 0)
+        rc = httpd_resp_send_chunk(req, out.buff, out.used);
+    if (rc != ESP_OK)
+    {
+        ESP_LOGE(TAG, "query_get_handler(): query failed (%s)", esp_err_to_name(rc));
+        if (out.used == 0 && rc == ESP_ERR_INVALID_ARG)
+            httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "Bad file list");
+        else if (out.used == 0 && rc == ESP_ERR_NOT_FOUND)
+            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "card not found");
+        else
+            httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
+    return ESP_OK;
+}
+
+// Hanlder: GET /trace
+static esp_err_t trace_get_handler(httpd_req_t *req)
+{
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+
+    httpd_resp_set_type(req, "application/json");
+    httpd_resp_set_hdr(req, "Content-Disposition", "attachment; filename=\"trace.json\"");
+    if (Trace::instance()->write(chunk_write, &out) != ESP_OK ||
+        (out.used > 0 && httpd_resp_send_chunk(req, out.buff, out.used) != ESP_OK))
+    {
+        ESP_LOGE(TAG, "trace_get_handler(): failed to send trace");
+        httpd_resp_sendstr_chunk(req, NULL);
+        return ESP_FAIL;
+    }
+    httpd_resp_send_chunk(req, NULL, 0);
     return ESP_OK;
 }
 
 // Hanlder: GET /info
 static esp_err_t info_get_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("info_get");
     /* {
             coincell: str,
             temperature: num,
             version: str,
      }*/
     System *sys = System::instance();
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
     char buff[20];
     memset(buff, 0, sizeof(buff));
 
@@ -352,28 +907,21 @@ static esp_err_t info_get_handler(httpd_req_t *req)
     }
     sys->updateVoltage();
 
-    cJSON *root = cJSON_CreateObject();
-    if (root == NULL)
-    {
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
-        return ESP_FAIL;
-    }
     snprintf(buff, sizeof(buff), "%.2f", sys->getVoltage());
-    cJSON_AddStringToObject(root, "coincell", buff);
-    cJSON_AddNumberToObject(root, "temperature", sys->getTemp());
-    cJSON_AddStringToObject(root, "version", sys->getVersion());
-
-    const char *json_str = cJSON_Print(root);
     httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, json_str);
-    free((void *)json_str);
-    cJSON_Delete(root);
-    return ESP_OK;
+    json.beginObject();
+    json.string("coincell", buff);
+    json.number("temperature", sys->getTemp());
+    json.string("version", sys->getVersion());
+    json.endObject();
+
+    return chunk_end(&out, json.status());
 }
 
 // Handler: POST /datetime
 static esp_err_t datetime_post_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("datetime_post");
     int total_len = req->content_len;
     int cur_len = 0;
     char *buff = ((rest_server_context_t *)(req->user_ctx))->scratch;
@@ -438,69 +986,94 @@ error:
 // [ { name: str, date: str, size: int }, ... ]
 static esp_err_t listdir_get_handler(httpd_req_t *req)
 {
-    // Getting file list from SD card
+    HANDLER_SCOPE("listdir_get");
+    /* [{name: str, date: str, size: num,
+         summary: {first: str, last: str, rows: num,            from the sidecar, when it is current
+                   channels: [{count: num, min: num, max: num, mean: num, units: str}, ...]}}, ...]
+     */
     SDCard *card = SDCard::instance();
     SDCardFile *files[MAX_FILE_LIST];
+    FileSummary summary, active_summary;
+    chunk_writer_t out = {req, ((rest_server_context_t *)(req->user_ctx))->scratch, 0};
+    JsonWriter json(chunk_write, &out);
+    char active_name[MAX_FILE_NAME], buff[TIME_LEN];
+    uint64_t active_size = 0;
+    bool have_active = false;
     int file_num = -1;
 
+    // the writer holds the storage lock while it waits for the card, ask before mounting
+    if (Storage::instance()->getActiveFile(active_name, sizeof(active_name), &active_size) != ESP_OK)
+        active_name[0] = '\0';
+    else
+        have_active = (Storage::instance()->getSummary(&active_summary) == ESP_OK);
+
     if (card->mount() != ESP_OK)
     {
         httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "card not found");
         return ESP_FAIL;
     }
-    else
-    {
-        if (card->listDir(&files[0], &file_num) != ESP_OK)
-        {
-            card->unmount();
-            ESP_LOGI(TAG, "listdir_get_handler(): ListDir Failed");
-            httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "error");
-            return ESP_FAIL;
-        }
-    }
-    card->unmount();
-
-    // Creating JSON array
-    cJSON *dir_list = NULL, *dir = NULL;
-    char buff[TIME_LEN];
-    dir_list = cJSON_CreateArray();
-    if (dir_list == NULL)
+    if (card->listDir(&files[0], &file_num) != ESP_OK)
     {
-        ESP_LOGI(TAG, "create JSON failed");
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
-        SDCard::instance()->clearFileList();
+        card->unmount();
+        ESP_LOGI(TAG, "listdir_get_handler(): ListDir Failed");
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "error");
         return ESP_FAIL;
     }
-    for (int i = 0; i < file_num; i++)
+
+    httpd_resp_set_type(req, "application/json");
+    json.beginArray();
+    for (int i = 0; i < file_num && json.status() == ESP_OK; i++)
     {
-        dir = cJSON_CreateObject();
-        if (dir == NULL)
+        bool active = (strcmp(files[i]->name, active_name) == 0);
+        const FileSummary *sum = NULL;
+        json.beginObject();
+        json.string("name", files[i]->name);
+        System::instance()->getTimeString(buff, sizeof(buff), TIME_FORMAT_JS, files[i]->lastWrite);
+        json.string("date", buff);
+        json.integer("size", active ? active_size : files[i]->size);
+
+        if (active && have_active)
+            sum = &active_summary;
+        else if (!active && summary_load(files[i]->name, &summary) == ESP_OK && summary.size == files[i]->size)
+            sum = &summary;
+        if (sum != NULL && sum->rows > 0)
         {
-            ESP_LOGI(TAG, "create JSON failed");
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "error");
-            cJSON_Delete(dir_list);
-            SDCard::instance()->clearFileList();
-            return ESP_FAIL;
+            json.beginObject("summary");
+            System::instance()->getTimeString(buff, sizeof(buff), TIME_FORMAT_JS, sum->first_us);
+            json.string("first", buff);
+            System::instance()->getTimeString(buff, sizeof(buff), TIME_FORMAT_JS, sum->last_us);
+            json.string("last", buff);
+            json.integer("rows", sum->rows);
+            json.beginArray("channels");
+            for (uint32_t ch = 0; ch < sum->channels && ch < SENSOR_CHANNELS; ch++)
+            {
+                json.beginObject();
+                json.integer("count", sum->channel[ch].count);
+                if (sum->channel[ch].count > 0)
+                {
+                    json.number("min", tension_to_double(sum->channel[ch].min));
+                    json.number("max", tension_to_double(sum->channel[ch].max));
+                    json.number("mean", tension_to_double(summary_mean(sum, ch)));
+                }
+                json.string("units", tension_unit_name((tension_unit)sum->channel[ch].units));
+                json.endObject();
+            }
+            json.endArray();
+            json.endObject();
         }
-        cJSON_AddStringToObject(dir, "name", files[i]->name);
-        System::instance()->getTimeString(buff, sizeof(buff), TIME_FORMAT_JS, files[i]->lastWrite);
-        cJSON_AddStringToObject(dir, "date", buff);
-        cJSON_AddNumberToObject(dir, "size", files[i]->size);
-        cJSON_AddItemToArray(dir_list, dir);
+        json.endObject();
     }
+    card->clearFileList();
+    card->unmount();
+    json.endArray();
 
-    SDCard::instance()->clearFileList();
-    const char *json_str = cJSON_Print(dir_list);
-    httpd_resp_set_type(req, "application/json");
-    httpd_resp_sendstr(req, json_str);
-    free((void *)json_str);
-    cJSON_Delete(dir_list);
-    return ESP_OK;
+    return chunk_end(&out, json.status());
 }
 
 // Handler: DELETE /sdcard/*
 static esp_err_t data_delete_handler(httpd_req_t *req)
 {
+    HANDLER_SCOPE("data_delete");
     char filepath[FILE_PATH_MAX], *file_name;
     SDCard *card = SDCard::instance();
     strlcpy(filepath, req->uri, sizeof(filepath));
@@ -522,6 +1095,10 @@ static esp_err_t data_delete_handler(httpd_req_t *req)
         ESP_LOGE(TAG, "data_delete_handler(): failed to remove %s", file_name);
         return ESP_FAIL;
     }
+    // its summary sidecar goes with it
+    char sidecar[MAX_FILE_NAME];
+    if (summary_name(file_name, sidecar, sizeof(sidecar)) && card->checkFile(sidecar) == ESP_OK)
+        card->deleteFile(sidecar);
     card->unmount();
     httpd_resp_set_type(req, "text/plain");
     httpd_resp_sendstr(req, "OK");
@@ -537,7 +1114,13 @@ esp_err_t Server::start_server(const char *base_path)
         return ESP_FAIL;
     }
 
-    this->rest_context = (rest_server_context_t *)calloc(1, sizeof(rest_server_context_t));
+#ifdef CONFIG_STATIC_MEMORY
+    static rest_server_context_t rest_context_storage;
+    memset(&rest_context_storage, 0, sizeof(rest_context_storage));
+    this->rest_context = &rest_context_storage;
+#else
+    this->rest_context = (rest_server_context_t *)Memory::instance()->calloc(1, sizeof(rest_server_context_t), mem_site_server);
+#endif
     if (!this->rest_context)
     {
         ESP_LOGE(TAG, "No memory for rest context");
@@ -552,7 +1135,7 @@ esp_err_t Server::start_server(const char *base_path)
     config.core_id = (BaseType_t) 1;
     config.task_priority = configMAX_PRIORITIES - 4;
     config.stack_size = 16384;
-    config.max_uri_handlers = 10;
+    config.max_uri_handlers = 24;
     config.uri_match_fn = httpd_uri_match_wildcard;
     config.backlog_conn = 10;
     config.lru_purge_enable = true;
@@ -561,7 +1144,9 @@ esp_err_t Server::start_server(const char *base_path)
     if (httpd_start(&server, &config) != ESP_OK)
     {
         ESP_LOGE(TAG, "Start server failed");
-        free(this->rest_context);
+#ifndef CONFIG_STATIC_MEMORY
+        Memory::instance()->release(this->rest_context);
+#endif
         return ESP_FAIL;
     }
 
@@ -613,6 +1198,94 @@ esp_err_t Server::start_server(const char *base_path)
         .user_ctx = this->rest_context};
     httpd_register_uri_handler(server, &info_get_uri);
 
+    /* URI handler for RTC square wave discipline stats */
+    httpd_uri_t clock_get_uri = {
+        .uri = "/clock",
+        .method = HTTP_GET,
+        .handler = &clock_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &clock_get_uri);
+
+    /* URI handler for sampling regularity stats */
+    httpd_uri_t schedule_get_uri = {
+        .uri = "/schedule",
+        .method = HTTP_GET,
+        .handler = &schedule_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &schedule_get_uri);
+
+    /* URI handler for live readings of every channel */
+    httpd_uri_t channels_get_uri = {
+        .uri = "/channels",
+        .method = HTTP_GET,
+        .handler = &channels_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &channels_get_uri);
+
+    /* URI handler for the recent sample history */
+    httpd_uri_t history_get_uri = {
+        .uri = "/history",
+        .method = HTTP_GET,
+        .handler = &history_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &history_get_uri);
+
+    /* URI handler for raised tension alarms and recent alarm events */
+    httpd_uri_t alarms_get_uri = {
+        .uri = "/alarms",
+        .method = HTTP_GET,
+        .handler = &alarms_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &alarms_get_uri);
+
+    /* URI handler for the rollup store, min / max / mean per bucket */
+    httpd_uri_t rollup_get_uri = {
+        .uri = "/rollup",
+        .method = HTTP_GET,
+        .handler = &rollup_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &rollup_get_uri);
+
+    /* URI handler for bucketed aggregates over the log files */
+    httpd_uri_t query_get_uri = {
+        .uri = "/query",
+        .method = HTTP_GET,
+        .handler = &query_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &query_get_uri);
+
+    /* URI handler for error flag counters and transition history */
+    httpd_uri_t errors_get_uri = {
+        .uri = "/errors",
+        .method = HTTP_GET,
+        .handler = &errors_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &errors_get_uri);
+
+    /* URI handler for mutex contention counters */
+    httpd_uri_t locks_get_uri = {
+        .uri = "/locks",
+        .method = HTTP_GET,
+        .handler = &locks_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &locks_get_uri);
+
+    /* URI handler for Prometheus text metrics */
+    httpd_uri_t metrics_get_uri = {
+        .uri = "/metrics",
+        .method = HTTP_GET,
+        .handler = &metrics_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &metrics_get_uri);
+
+    /* URI handler for the event trace, Chrome / Perfetto JSON */
+    httpd_uri_t trace_get_uri = {
+        .uri = "/trace",
+        .method = HTTP_GET,
+        .handler = &trace_get_handler,
+        .user_ctx = this->rest_context};
+    httpd_register_uri_handler(server, &trace_get_uri);
+
     /* URI handler for listing directories on SD card */
     httpd_uri_t listdir_get_uri = {
         .uri = "/listdir",
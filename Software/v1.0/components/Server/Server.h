@@ -29,9 +29,24 @@
 #include "Sensor.h"
 #include "SDCard.h"
 #include "Settings.h"
+#include "Storage.h"
+#include "History.h"
+#include "Rollup.h"
+#include "Alarm.h"
+#include "Query.h"
+#include "Summary.h"
+#include "Scheduler.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "JsonWriter.h"
 
 #define FILE_PATH_MAX (ESP_VFS_PATH_MAX + 64)
 #define SCRATCH_BUFSIZE (16384) // 10240
+#define ROLLUP_DEFAULT_RANGE (7 * 24 * 3600) // /rollup without from=, seconds
+#define ROLLUP_POINTS 500                   // rows aimed at when no resolution is given
+#define QUERY_URL_LEN 1024                  // /query string, mostly the file list
+#define QUERY_PARAM_LEN 32
 
 typedef struct rest_server_context {
     char base_path[ESP_VFS_PATH_MAX + 1];
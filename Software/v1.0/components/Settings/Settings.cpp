@@ -28,7 +28,7 @@ Settings *Settings::instance(void)
     if (inst == 0)
     {
         ESP_LOGI(TAG, "creating Settings instance");
-        inst = new Settings();
+        inst = SINGLETON_NEW(Settings);
     }
     return inst;
 }
@@ -20,7 +20,7 @@
 
 #include "System.h"
 
-#define SETTINGS_BUFFER 254
+#define SETTINGS_BUFFER 1024
 #define SETTINGS_MAX_VAL 15
 #define SETTINGS_MAX_PARAM 15
 #define SETTINGS_PATH "/spiffs/settings.json"
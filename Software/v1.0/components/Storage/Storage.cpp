@@ -0,0 +1,742 @@
+/*
+
+
+
+
+*/
+
+#include "Storage.h"
+
+static const char *TAG = "Storage";
+
+static const char zeros[FILE_BUFFER] = {0};
+
+// stable insertion sort on time, input is nearly sorted
+static void sort_samples(Sample *data, int len)
+{
+    for (int i = 1; i < len; i++)
+    {
+        Sample key = data[i];
+        int j = i - 1;
+        while (j >= 0 && data[j].time_ms > key.time_ms)
+        {
+            data[j + 1] = data[j];
+            j--;
+        }
+        data[j + 1] = key;
+    }
+}
+
+/* Null, because instance will be initialized on demand. */
+Storage *Storage::inst = 0;
+
+//
+Storage::Storage()
+{
+    this->xSemaphore = xSemaphoreCreateMutex();
+    if (this->xSemaphore == NULL)
+        ESP_LOGE(TAG, "Storage(): failed to create semaphore");
+
+    tm start = TIME_DEFAULTS();
+    this->_file_start = start;
+}
+
+//
+Storage *Storage::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Storage(): creating instance");
+        inst = SINGLETON_NEW(Storage);
+    }
+    return inst;
+}
+
+//
+esp_err_t Storage::init(void)
+{
+    return this->loadSettings();
+}
+
+// read rotation policy from settings - file_size [KB], rotate [0 - none, 1 - hourly, 2 - daily], file_rows
+esp_err_t Storage::loadSettings(void)
+{
+    Settings *settings = Settings::instance();
+    double file_size = 0, rotate = 0, file_rows = 0;
+    char units[SETTINGS_MAX_VAL] = {0};
+
+    settings->getParameter(&file_size, "file_size");
+    settings->getParameter(&rotate, "rotate");
+    settings->getParameter(&file_rows, "file_rows");
+    settings->getParameter(units, sizeof(units), "units"); // "", "lbf", "N" or "kgf"
+
+    SEMAPHORE_TAKE();
+    this->_max_size = (file_size > 0) ? (uint64_t)file_size * 1024 : 0;
+    this->_max_rows = (file_rows > 0) ? (uint32_t)file_rows : 0;
+    if ((int)rotate == rotate_hourly)
+        this->_rotation = rotate_hourly;
+    else if ((int)rotate == rotate_daily)
+        this->_rotation = rotate_daily;
+    else
+        this->_rotation = rotate_none;
+    this->_units = tension_unit_parse(units, strnlen(units, sizeof(units)));
+    this->_setBoundary();
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// extra header line written above the column names of new files, empty string for none
+esp_err_t Storage::setHeader(const char *header)
+{
+    if (header == NULL || strlen(header) >= STORAGE_HEADER_LEN)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    strncpy(this->_header, header, STORAGE_HEADER_LEN);
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// number of channels logged, a change starts a new file
+esp_err_t Storage::setChannels(int channels)
+{
+    if (channels < 1 || channels > SENSOR_CHANNELS)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    this->_channels = channels;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
+// write @len samples packed against @base_us to the active file, rotating files as needed - the samples are sorted
+// in place and @written tells how many of them are on the card, a prefix of the sorted order even when this fails
+esp_err_t Storage::write(Sample *data, int len, int64_t base_us, int *written)
+{
+    SDCard *card = SDCard::instance();
+    char row[LINE_BUFFER];
+    size_t row_len;
+    esp_err_t rc = ESP_OK;
+    int i = 0;
+
+    if (written == NULL)
+        return ESP_ERR_INVALID_ARG;
+    *written = 0;
+    if (data == NULL || len <= 0)
+        return ESP_ERR_INVALID_ARG;
+
+    METRICS_TIME_SCOPE("sd_write_duration_us", "", "Storage::write() from mount to unmount");
+    static const int mount_metric = Metrics::instance()->histogram("sd_mount_duration_us", "", "card mount time",
+                                                                   metrics_duration_us, METRICS_DURATION_BUCKETS);
+    static const int sync_metric = Metrics::instance()->histogram("sd_sync_duration_us", "", "file close and unmount (FAT flush) time",
+                                                                  metrics_duration_us, METRICS_DURATION_BUCKETS);
+    static const int rows_metric = Metrics::instance()->counter("storage_rows_total", "", "rows written to the card");
+    static const int failed_metric = Metrics::instance()->counter("storage_write_failed_total", "", "failed Storage::write() calls");
+    int64_t start, sync;
+
+    SEMAPHORE_TAKE();
+    start = esp_timer_get_time();
+    if (card->mount() != ESP_OK)
+    {
+        Metrics::instance()->inc(failed_metric);
+        SEMAPHORE_GIVE();
+        return ESP_FAIL;
+    }
+    Metrics::instance()->observe(mount_metric, (int32_t)(esp_timer_get_time() - start));
+
+    if (this->_active && this->_resume() != ESP_OK)
+        this->_active = false; // file removed or card swapped - start a new one
+
+    sort_samples(data, len);
+    for (int count = 1; i < len; i += count)
+    {
+        // one row per timestamp, samples of all channels side by side
+        count = 1;
+        while (this->_channels > 1 && i + count < len && data[i + count].time_ms == data[i].time_ms)
+            count++;
+        int64_t time_us = sample_time_us(&data[i], base_us);
+        row_len = this->_formatRow(row, sizeof(row), &data[i], count, base_us);
+        if (!this->_active || this->_needRotation(time_us, row_len))
+        {
+            if (this->_open(time_us) != ESP_OK)
+            {
+                rc = ESP_FAIL;
+                break;
+            }
+        }
+        if (this->_writeRow(row, row_len) != ESP_OK)
+        {
+            rc = ESP_FAIL;
+            break;
+        }
+        this->_rows++;
+        this->_addSummary(&data[i], count, base_us);
+        Metrics::instance()->inc(rows_metric);
+    }
+    *written = i;
+    start = esp_timer_get_time();
+    if (this->_active)
+        card->closeFile();
+    sync = esp_timer_get_time() - start;
+
+    if (this->_active && this->_summary_valid)
+    {
+        this->_summary.size = this->_offset;
+        if (summary_save(this->_file_name, &this->_summary) != ESP_OK)
+            ESP_LOGW(TAG, "write(): failed to save the summary of %s", this->_file_name);
+    }
+
+    // closed rollup buckets go out in the same card session
+    if (Rollup::instance()->flush() != ESP_OK)
+        ESP_LOGW(TAG, "write(): rollup flush failed");
+    if (Alarm::instance()->flush() != ESP_OK)
+        ESP_LOGW(TAG, "write(): alarm log flush failed");
+
+    start = esp_timer_get_time();
+    if (card->unmount() != ESP_OK)
+        ESP_LOGE(TAG, "write(): card unmount failed");
+    sync += esp_timer_get_time() - start;
+    Metrics::instance()->observe(sync_metric, (int32_t)sync);
+    if (rc != ESP_OK)
+        Metrics::instance()->inc(failed_metric);
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// continue logging into @file_name after a reset, cutting off the preallocated zeros and a torn last row
+esp_err_t Storage::recover(const char *file_name)
+{
+    SDCard *card = SDCard::instance();
+    uint64_t end = 0;
+    tm start = TIME_DEFAULTS();
+    esp_err_t rc;
+
+    if (file_name == NULL || strlen(file_name) >= MAX_FILE_NAME)
+        return ESP_ERR_INVALID_ARG;
+
+    SEMAPHORE_TAKE();
+    if (card->mount() != ESP_OK)
+    {
+        SEMAPHORE_GIVE();
+        return ESP_FAIL;
+    }
+    rc = this->_repair(file_name, &end);
+    if (rc == ESP_OK && end > 0)
+        this->_loadSummary(file_name, end);
+    if (card->unmount() != ESP_OK)
+        ESP_LOGE(TAG, "recover(): card unmount failed");
+    if (rc == ESP_OK && end > 0)
+    {
+        strncpy(this->_file_name, file_name, sizeof(this->_file_name));
+        if (strptime(file_name, FILENAME_TIME_FORMAT, &start) != NULL)
+            this->_file_start = start;
+        this->_setBoundary();
+        this->_offset = end;
+        this->_allocated = end;
+        this->_rows = 0;
+        this->_file_channels = this->_channels;
+        this->_active = true;
+        ESP_LOGI(TAG, "recover(): resuming %s at %llu", file_name, end);
+    }
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// cut the reserve off log files a power cut left it in - the journal naming the active file does not survive one
+esp_err_t Storage::repairFiles(void)
+{
+    SDCard *card = SDCard::instance();
+    SDCardFile *files[MAX_FILE_LIST];
+    uint64_t end;
+    int found = 0;
+    char last;
+
+    SEMAPHORE_TAKE();
+    if (card->mount() != ESP_OK)
+    {
+        SEMAPHORE_GIVE();
+        return ESP_FAIL;
+    }
+    esp_err_t rc = card->listDir(&files[0], &found);
+    for (int i = 0; i < found && rc == ESP_OK; i++)
+    {
+        size_t len = strlen(files[i]->name);
+        if (len <= 4 || strcasecmp(&files[i]->name[len - 4], ".csv") != 0 || files[i]->size == 0)
+            continue;
+        if (this->_active && strcmp(files[i]->name, this->_file_name) == 0)
+            continue;
+        // rows end with a newline, a zero last byte is reserve that was never cut
+        if (card->openFile(files[i]->name, "r") != ESP_OK)
+            continue;
+        bool reserve = (card->seekFile((long)(files[i]->size - 1)) == ESP_OK && card->readFile(&last, 1) == 1 && last == 0);
+        card->closeFile();
+        if (reserve && this->_repair(files[i]->name, &end) != ESP_OK)
+            ESP_LOGE(TAG, "repairFiles(): failed to trim %s", files[i]->name);
+    }
+    card->clearFileList();
+    if (card->unmount() != ESP_OK)
+        ESP_LOGE(TAG, "repairFiles(): card unmount failed");
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// grow the reserves by up to STORAGE_PREALLOC_STEP in a card session of its own, the card is not mounted when they are full
+esp_err_t Storage::preallocate(void)
+{
+    SDCard *card = SDCard::instance();
+
+    SEMAPHORE_TAKE();
+    if (this->_next_checked && this->_reserveFull())
+    {
+        SEMAPHORE_GIVE();
+        return ESP_OK;
+    }
+    if (card->mount() != ESP_OK)
+    {
+        SEMAPHORE_GIVE();
+        return ESP_FAIL;
+    }
+    esp_err_t rc = this->_preallocate(STORAGE_PREALLOC_STEP);
+    if (card->unmount() != ESP_OK)
+        ESP_LOGE(TAG, "preallocate(): card unmount failed");
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// name and data size of the file being written, ESP_ERR_NOT_FOUND if none
+esp_err_t Storage::getActiveFile(char *name, size_t len, uint64_t *size)
+{
+    esp_err_t rc = ESP_OK;
+    if (name == NULL || len < MAX_FILE_NAME)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    if (this->_active)
+    {
+        strncpy(name, this->_file_name, len);
+        *size = this->_offset;
+    }
+    else
+        rc = ESP_ERR_NOT_FOUND;
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// statistics of the active file, ESP_ERR_NOT_FOUND when there is none or they are not current
+esp_err_t Storage::getSummary(FileSummary *summary)
+{
+    esp_err_t rc = ESP_OK;
+    if (summary == NULL)
+        return ESP_ERR_INVALID_ARG;
+    SEMAPHORE_TAKE();
+    if (this->_active && this->_summary_valid)
+    {
+        *summary = this->_summary;
+        summary->size = this->_offset;
+    }
+    else
+        rc = ESP_ERR_NOT_FOUND;
+    SEMAPHORE_GIVE();
+    return rc;
+}
+
+// epoch microseconds of the next time based rotation, INT64_MAX when there is none or no active file
+int64_t Storage::nextRotation(void)
+{
+    SEMAPHORE_TAKE();
+    int64_t rotate_at = this->_active ? this->_rotate_at : INT64_MAX;
+    SEMAPHORE_GIVE();
+    return rotate_at;
+}
+
+// rotation check before writing a @row_len bytes row taken at @time_us
+bool Storage::_needRotation(int64_t time_us, size_t row_len)
+{
+    if (this->_file_channels != this->_channels)
+        return true;
+    if (this->_rows == 0)
+        return false;
+    if (this->_max_size && this->_offset + row_len > this->_max_size)
+        return true;
+    if (this->_max_rows && this->_rows >= this->_max_rows)
+        return true;
+    return time_us >= this->_rotate_at;
+}
+
+// epoch time of the next hour / day boundary after the file start, calendar math done once per file
+void Storage::_setBoundary(void)
+{
+    tm boundary = this->_file_start;
+
+    if (this->_rotation == rotate_none)
+    {
+        this->_rotate_at = INT64_MAX;
+        return;
+    }
+    boundary.tm_sec = 0;
+    boundary.tm_min = 0;
+    if (this->_rotation == rotate_hourly)
+        boundary.tm_hour += 1;
+    else
+    {
+        boundary.tm_hour = 0;
+        boundary.tm_mday += 1;
+    }
+    boundary.tm_isdst = -1;
+    this->_rotate_at = (int64_t)mktime(&boundary) * US_PER_SEC;
+}
+
+// close the active file and start a new one named after the first sample's @time_us
+esp_err_t Storage::_open(int64_t time_us)
+{
+    SDCard *card = SDCard::instance();
+    char file_name[MAX_FILE_NAME];
+    uint64_t size = 0;
+    bool rotating = this->_active;
+
+    if (this->_active)
+        this->_close();
+
+    System::instance()->getTimeString(file_name, sizeof(file_name), FILENAME_FORMAT, time_us);
+    if (rotating)
+    { // a rotation always starts a new file - size or row limits hit within the same second get "_01", "_02" ...
+        size_t stem = strlen(file_name) - 4; // ".csv"
+        for (int n = 1; n <= STORAGE_MAX_SUFFIX && card->getFileSize(file_name, &size) == ESP_OK; n++)
+            snprintf(&file_name[stem], sizeof(file_name) - stem, "_%02d.csv", n);
+    }
+    if (card->getFileSize(file_name, &size) == ESP_OK)
+    { // name taken - continue after its last complete row, reserve left by a power cut is cut off
+        ESP_LOGW(TAG, "_open(): %s exists, appending", file_name);
+        if (this->_repair(file_name, &size) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "_open(): failed to repair %s", file_name);
+            return ESP_FAIL;
+        }
+        this->_offset = size;
+        this->_allocated = size;
+        this->_loadSummary(file_name, size);
+    }
+    else if (this->_next_size > 0 && card->renameFile(STORAGE_NEXT_FILE, file_name) == ESP_OK)
+    { // preallocated file ready
+        this->_offset = 0;
+        this->_allocated = this->_next_size;
+        this->_next_size = 0;
+    }
+    else
+    { // nothing prepared, allocate as we go
+        ESP_LOGW(TAG, "_open(): no preallocated file for %s", file_name);
+        if (card->openFile(file_name, "w") != ESP_OK)
+        {
+            ESP_LOGE(TAG, "_open(): failed to create %s", file_name);
+            return ESP_FAIL;
+        }
+        card->closeFile();
+        this->_offset = 0;
+        this->_allocated = 0;
+    }
+
+    if (this->_offset == 0)
+    {
+        summary_reset(&this->_summary, this->_channels);
+        this->_summary_valid = true;
+    }
+    strncpy(this->_file_name, file_name, sizeof(this->_file_name));
+    time_t start = (time_t)(time_us / US_PER_SEC);
+    localtime_r(&start, &this->_file_start);
+    this->_setBoundary();
+    this->_rows = 0;
+    this->_file_channels = this->_channels;
+    if (this->_resume() != ESP_OK)
+        return ESP_FAIL;
+    this->_active = true;
+    ESP_LOGI(TAG, "_open(): logging to %s (%llu bytes allocated)", file_name, this->_allocated);
+
+    if (this->_offset == 0)
+    { // new file - headers
+        char columns[STORAGE_HEADER_LEN];
+        if (strlen(this->_header))
+            this->_writeRow(this->_header, strlen(this->_header));
+        return this->_writeRow(columns, this->_formatColumns(columns, sizeof(columns)));
+    }
+    return ESP_OK;
+}
+
+// open the active file at the end of its data
+esp_err_t Storage::_resume(void)
+{
+    SDCard *card = SDCard::instance();
+    if (card->openFile(this->_file_name, "r+") != ESP_OK)
+        return ESP_FAIL;
+    if (card->seekFile((long)this->_offset) != ESP_OK)
+    {
+        card->closeFile();
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// close the active file and release the unused reserve
+esp_err_t Storage::_close(void)
+{
+    SDCard *card = SDCard::instance();
+    esp_err_t rc = card->closeFile();
+    this->_active = false;
+    if (this->_allocated > this->_offset)
+    {
+        if (card->truncateFile(this->_file_name, this->_offset) != ESP_OK)
+            rc = ESP_FAIL;
+        else
+            this->_allocated = this->_offset;
+    }
+    if (this->_summary_valid)
+    { // final statistics, the file is complete
+        this->_summary.size = this->_offset;
+        if (summary_save(this->_file_name, &this->_summary) != ESP_OK)
+            rc = ESP_FAIL;
+    }
+    return rc;
+}
+
+//
+esp_err_t Storage::_writeRow(const char *row, size_t len)
+{
+    if (SDCard::instance()->writeFile(row, len) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "_writeRow(): write to %s failed", this->_file_name);
+        return ESP_FAIL;
+    }
+    this->_offset += len;
+    if (this->_offset > this->_allocated)
+        this->_allocated = this->_offset;
+    return ESP_OK;
+}
+
+// active file and next file allocated as far as they should be
+bool Storage::_reserveFull(void)
+{
+    uint64_t active = this->_offset + STORAGE_RESERVE, next = STORAGE_RESERVE;
+
+    if (this->_max_size && active > this->_max_size)
+        active = this->_max_size;
+    if (this->_max_size && next > this->_max_size)
+        next = this->_max_size;
+    return (!this->_active || this->_allocated >= active) && this->_next_size >= next;
+}
+
+// extend the active file and the next file with zeros - at most @budget bytes per call
+esp_err_t Storage::_preallocate(size_t budget)
+{
+    SDCard *card = SDCard::instance();
+    uint64_t target, left;
+    size_t chunk;
+
+    // preallocated file left from the previous run
+    if (!this->_next_checked)
+    {
+        if (card->getFileSize(STORAGE_NEXT_FILE, &this->_next_size) != ESP_OK)
+            this->_next_size = 0;
+        this->_next_checked = true;
+    }
+
+    // 1. reserve ahead of the write position
+    target = this->_offset + STORAGE_RESERVE;
+    if (this->_max_size && target > this->_max_size)
+        target = this->_max_size;
+    if (this->_active && this->_allocated < target && budget > 0)
+    {
+        if (card->openFile(this->_file_name, "a") != ESP_OK)
+            return ESP_FAIL;
+        left = target - this->_allocated;
+        while (left > 0 && budget > 0)
+        {
+            chunk = (left < sizeof(zeros)) ? left : sizeof(zeros);
+            if (chunk > budget)
+                chunk = budget;
+            if (card->writeFile(zeros, chunk) != ESP_OK)
+                break;
+            this->_allocated += chunk;
+            left -= chunk;
+            budget -= chunk;
+        }
+        card->closeFile();
+    }
+
+    // 2. next file, ready for rotation
+    target = STORAGE_RESERVE;
+    if (this->_max_size && target > this->_max_size)
+        target = this->_max_size;
+    if (this->_next_size < target && budget > 0)
+    {
+        if (card->openFile(STORAGE_NEXT_FILE, "a") != ESP_OK)
+            return ESP_FAIL;
+        left = target - this->_next_size;
+        while (left > 0 && budget > 0)
+        {
+            chunk = (left < sizeof(zeros)) ? left : sizeof(zeros);
+            if (chunk > budget)
+                chunk = budget;
+            if (card->writeFile(zeros, chunk) != ESP_OK)
+                break;
+            this->_next_size += chunk;
+            left -= chunk;
+            budget -= chunk;
+        }
+        card->closeFile();
+    }
+    return ESP_OK;
+}
+
+// find the end of the data in @file_name and truncate it to the last complete row
+esp_err_t Storage::_repair(const char *file_name, uint64_t *end)
+{
+    SDCard *card = SDCard::instance();
+    char buff[LINE_BUFFER];
+    uint64_t size = 0, lo = 0, hi, start;
+    ssize_t len;
+
+    if (card->getFileSize(file_name, &size) != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+    if (card->openFile(file_name, "r") != ESP_OK)
+        return ESP_FAIL;
+
+    // rows never contain zeros, the preallocated reserve is all zeros - binary search the boundary
+    hi = size;
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (card->seekFile((long)mid) != ESP_OK || card->readFile(buff, 1) != 1)
+        {
+            card->closeFile();
+            return ESP_FAIL;
+        }
+        if (buff[0] == 0)
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+
+    // drop a partially written last row
+    start = (lo > sizeof(buff)) ? lo - sizeof(buff) : 0;
+    len = 0;
+    if (lo > start && card->seekFile((long)start) == ESP_OK)
+        len = card->readFile(buff, lo - start);
+    card->closeFile();
+    while (len > 0 && buff[len - 1] != '\n')
+        len--;
+    *end = start + len;
+
+    if (*end < size)
+    {
+        ESP_LOGW(TAG, "_repair(): %s cut from %llu to %llu bytes", file_name, size, *end);
+        return card->truncateFile(file_name, *end);
+    }
+    return ESP_OK;
+}
+
+// continue the statistics of an existing file, dropped when its sidecar does not cover exactly @size bytes
+void Storage::_loadSummary(const char *file_name, uint64_t size)
+{
+    this->_summary_valid = (summary_load(file_name, &this->_summary) == ESP_OK && this->_summary.size == size &&
+                            this->_summary.channels == (uint32_t)this->_channels);
+    if (!this->_summary_valid)
+        ESP_LOGW(TAG, "_loadSummary(): no current summary of %s, left to the indexer", file_name);
+}
+
+// count the row of @count samples in the active file's statistics, in the units the row is written in
+void Storage::_addSummary(const Sample *data, int count, int64_t base_us)
+{
+    SensorData sample;
+
+    if (!this->_summary_valid)
+        return;
+    summary_row(&this->_summary, sample_time_us(data, base_us));
+    for (int i = 0; i < count; i++)
+    {
+        int channel = (this->_file_channels == 1) ? 0 : data[i].channel;
+        if (channel >= this->_file_channels)
+            continue;
+        sample_unpack(&data[i], base_us, &sample);
+        tension_unit out = (this->_units == unit_none) ? sample.units : this->_units;
+        summary_add(&this->_summary, channel, tension_convert(sample.tension, sample.units, out), out);
+    }
+}
+
+// ",tension[,peak],units" of @sample in @unit (unit_none - as measured), @peak_column keeps an empty peak field
+static char *put_sample(char *p, const char *end, const SensorData *sample, tension_unit unit, bool peak_column)
+{
+    tension_unit out = (unit == unit_none) ? sample->units : unit;
+    const char *name = tension_unit_name(out);
+    size_t name_len = strlen(name);
+
+    if ((size_t)(end - p) < 2 * TENSION_TEXT_LEN + name_len + 3)
+        return NULL;
+    *p++ = ',';
+    p += tension_format(p, end - p, tension_convert(sample->tension, sample->units, out));
+    if (sample->peak_tension != TENSION_NONE)
+    {
+        *p++ = ',';
+        p += tension_format(p, end - p, tension_convert(sample->peak_tension, sample->units, out));
+    }
+    else if (peak_column)
+        *p++ = ',';
+    *p++ = ',';
+    memcpy(p, name, name_len);
+    return p + name_len;
+}
+
+// CSV row for @count samples sharing a timestamp in the layout of new files, returns row length
+size_t Storage::_formatRow(char *buff, size_t len, const Sample *data, int count, int64_t base_us)
+{
+    size_t n = this->_time_format.format(buff, len, sample_time_us(data, base_us));
+    SensorData unpacked;
+    char *p = buff + n, *end = buff + len - 2; // room for "\n\0"
+
+    if (n == 0)
+        return 0;
+    for (int channel = 0; channel < this->_channels && p != NULL; channel++)
+    {
+        const Sample *sample = (this->_channels == 1) ? data : NULL;
+        for (int i = 0; i < count && sample == NULL; i++)
+        {
+            if (data[i].channel == channel)
+                sample = &data[i];
+        }
+        if (sample != NULL) // single channel files keep the legacy layout without an empty peak
+        {
+            sample_unpack(sample, base_us, &unpacked);
+            p = put_sample(p, end, &unpacked, this->_units, this->_channels > 1);
+        }
+        else if (end - p >= 3)
+        {
+            memcpy(p, ",,,", 3);
+            p += 3;
+        }
+        else
+            p = NULL;
+    }
+    if (p == NULL)
+    {
+        ESP_LOGE(TAG, "_formatRow(): row does not fit %u bytes", len);
+        return 0;
+    }
+    *p++ = '\n';
+    *p = '\0';
+    return p - buff;
+}
+
+// column names line for the active file, returns its length
+size_t Storage::_formatColumns(char *buff, size_t len)
+{
+    int n;
+
+    if (this->_file_channels == 1)
+        n = snprintf(buff, len, "%s", FILE_HEADER);
+    else
+    {
+        n = snprintf(buff, len, "Datetime");
+        for (int channel = 1; channel <= this->_file_channels && n >= 0 && (size_t)n < len; channel++)
+            n += snprintf(buff + n, len - n, FILE_HEADER_CHANNEL, channel, channel, channel);
+        if (n >= 0 && (size_t)n < len)
+            n += snprintf(buff + n, len - n, "\r\n");
+    }
+    if (n < 0)
+        return 0;
+    return ((size_t)n < len) ? (size_t)n : len - 1;
+}
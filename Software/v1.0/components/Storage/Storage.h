@@ -0,0 +1,135 @@
+/*
+
+
+
+
+*/
+
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <time.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+
+#include "System.h"
+#include "TimeFormat.h"
+#include "Sensor.h"
+#include "SDCard.h"
+#include "Settings.h"
+#include "Metrics.h"
+#include "Rollup.h"
+#include "Summary.h"
+#include "Alarm.h"
+
+#define FILE_HEADER "Datetime,Tension,Units\r\n"
+#define FILE_HEADER_CHANNEL ",Tension %d,Peak %d,Units %d" // per channel when logging several
+#define STORAGE_NEXT_FILE ".next.tmp" // preallocated file, renamed on rotation
+#define STORAGE_MAX_SUFFIX 99         // "_NN" names of files rotated within the same second
+#define STORAGE_HEADER_LEN 128
+
+#define STORAGE_RESERVE (128 * 1024)   // bytes kept allocated ahead of the write position
+#define STORAGE_PREALLOC_STEP (16 * 1024) // max bytes preallocated per preallocate() call
+
+enum storage_rotation
+{
+    rotate_none,
+    rotate_hourly,
+    rotate_daily
+};
+
+/*
+  Log file writer
+
+  Rows are written into files that are allocated ahead of time: the next
+  file is filled with zeros in small steps by preallocate(), called from
+  a low priority task between flushes, and the active file is extended
+  the same way. Rows overwrite that reserve at a tracked offset, so FAT
+  allocation stays out of the write path, and a rotation is just a
+  rename of the prepared file. Files are truncated to their data when
+  closed. A file left with its reserve by a power cut is trimmed by
+  repairFiles() at boot, or when _open() continues an existing file.
+  Files are named after their first row's time; a rotation never
+  continues one, limits reached within the same second give the new
+  file a "_NN" suffix.
+
+  With several channels, samples sharing a timestamp are merged into one
+  row with a Tension / Peak / Units column group per channel; a channel
+  without a sample at that time leaves its group empty. One channel
+  keeps the original three column layout.
+
+  Row count, first / last time and per channel min / max / mean of the
+  active file are kept as rows are written and saved next to it as a
+  sidecar at every flush and on rotation, see Summary.h.
+*/
+class Storage
+{
+public:
+    static Storage *instance(void);
+    esp_err_t init(void);
+    esp_err_t loadSettings(void);
+    esp_err_t setHeader(const char *header);
+    esp_err_t setChannels(int channels);
+    esp_err_t write(Sample *data, int len, int64_t base_us, int *written);
+    esp_err_t recover(const char *file_name);
+    esp_err_t repairFiles(void);
+    esp_err_t preallocate(void);
+    esp_err_t getActiveFile(char *name, size_t len, uint64_t *size);
+    esp_err_t getSummary(FileSummary *summary);
+    int64_t nextRotation(void);
+
+private:
+    static Storage *inst;
+    Storage();
+    Storage(const Storage *obj);
+    SemaphoreHandle_t xSemaphore = NULL;
+
+    // rotation policy
+    uint64_t _max_size = 0;  // bytes, 0 - unlimited
+    uint32_t _max_rows = 0;  // rows, 0 - unlimited
+    storage_rotation _rotation = rotate_none;
+    char _header[STORAGE_HEADER_LEN] = {0};
+    int _channels = 1;      // columns of new files
+    int _file_channels = 1; // columns of the active file
+    tension_unit _units = unit_none; // rows converted to this unit, unit_none - as measured
+    TimeFormat _time_format;
+
+    // active file
+    bool _active = false;
+    char _file_name[MAX_FILE_NAME] = {0};
+    tm _file_start;
+    int64_t _rotate_at = INT64_MAX; // epoch microseconds of the next time based rotation
+    uint64_t _offset = 0;    // end of written data
+    uint64_t _allocated = 0; // physical size of the file
+    uint32_t _rows = 0;
+    FileSummary _summary;
+    bool _summary_valid = false; // false - an existing file without a current sidecar, left to the indexer
+    // preallocated next file
+    uint64_t _next_size = 0;
+    bool _next_checked = false;
+
+    bool _needRotation(int64_t time_us, size_t row_len);
+    void _setBoundary(void);
+    esp_err_t _open(int64_t time_us);
+    esp_err_t _resume(void);
+    esp_err_t _close(void);
+    esp_err_t _writeRow(const char *row, size_t len);
+    bool _reserveFull(void);
+    esp_err_t _preallocate(size_t budget);
+    esp_err_t _repair(const char *file_name, uint64_t *end);
+    void _loadSummary(const char *file_name, uint64_t size);
+    void _addSummary(const Sample *data, int count, int64_t base_us);
+    size_t _formatRow(char *buff, size_t len, const Sample *data, int count, int64_t base_us);
+    size_t _formatColumns(char *buff, size_t len);
+};
+
+#endif // Storage.h
@@ -0,0 +1,103 @@
+/*
+
+
+
+
+*/
+
+#include "Summary.h"
+
+static const char *TAG = "Summary";
+
+// sidecar name of @file_name, false when it does not fit MAX_FILE_NAME
+bool summary_name(const char *file_name, char *out, size_t len)
+{
+    size_t name_len = strlen(file_name);
+    if (name_len > 4 && strcasecmp(&file_name[name_len - 4], ".csv") == 0)
+        name_len -= 4;
+    if (len > MAX_FILE_NAME)
+        len = MAX_FILE_NAME;
+    return snprintf(out, len, ".%.*s%s", (int)name_len, file_name, SUMMARY_EXT) < (int)len;
+}
+
+// empty statistics for a file of @channels columns
+void summary_reset(FileSummary *summary, int channels)
+{
+    memset(summary, 0, sizeof(FileSummary));
+    summary->magic = SUMMARY_MAGIC;
+    summary->channels = (channels > 0 && channels <= SENSOR_CHANNELS) ? channels : 1;
+}
+
+// one row at @time_us
+void summary_row(FileSummary *summary, int64_t time_us)
+{
+    if (summary->rows == 0)
+        summary->first_us = time_us;
+    summary->last_us = time_us;
+    summary->rows++;
+}
+
+// one value of a row, after summary_row()
+void summary_add(FileSummary *summary, int channel, tension_t value, tension_unit units)
+{
+    if (channel < 0 || channel >= SENSOR_CHANNELS || value == TENSION_NONE)
+        return;
+    summary_channel *ch = &summary->channel[channel];
+    if (ch->count == 0 || value < ch->min)
+        ch->min = value;
+    if (ch->count == 0 || value > ch->max)
+        ch->max = value;
+    ch->sum += value;
+    ch->units = units;
+    ch->count++;
+}
+
+// mean of @channel rounded to a hundredth, TENSION_NONE without values
+tension_t summary_mean(const FileSummary *summary, int channel)
+{
+    const summary_channel *ch = &summary->channel[channel];
+    if (ch->count == 0)
+        return TENSION_NONE;
+    int64_t half = ch->count / 2;
+    return (tension_t)(((ch->sum >= 0) ? ch->sum + half : ch->sum - half) / (int64_t)ch->count);
+}
+
+// write the sidecar of @file_name, the card is mounted and no file is open
+esp_err_t summary_save(const char *file_name, FileSummary *summary)
+{
+    SDCard *card = SDCard::instance();
+    char name[MAX_FILE_NAME];
+
+    if (!summary_name(file_name, name, sizeof(name)))
+        return ESP_ERR_INVALID_SIZE;
+    summary->magic = SUMMARY_MAGIC;
+    summary->crc = crc32_le(0, (const uint8_t *)summary, offsetof(FileSummary, crc));
+    if (card->openFile(name, "w") != ESP_OK)
+        return ESP_FAIL;
+    esp_err_t rc = card->writeFile((const char *)summary, sizeof(FileSummary));
+    if (card->closeFile() != ESP_OK || rc != ESP_OK)
+    {
+        ESP_LOGE(TAG, "summary_save(): failed to write %s", name);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+// read and check the sidecar of @file_name, the card is mounted and no file is open
+esp_err_t summary_load(const char *file_name, FileSummary *summary)
+{
+    SDCard *card = SDCard::instance();
+    char name[MAX_FILE_NAME];
+    ssize_t len;
+
+    if (!summary_name(file_name, name, sizeof(name)))
+        return ESP_ERR_INVALID_SIZE;
+    if (card->checkFile(name) != ESP_OK || card->openFile(name, "r") != ESP_OK)
+        return ESP_ERR_NOT_FOUND;
+    len = card->readFile((char *)summary, sizeof(FileSummary));
+    card->closeFile();
+    if (len != sizeof(FileSummary) || summary->magic != SUMMARY_MAGIC ||
+        summary->crc != crc32_le(0, (const uint8_t *)summary, offsetof(FileSummary, crc)))
+        return ESP_ERR_INVALID_CRC;
+    return ESP_OK;
+}
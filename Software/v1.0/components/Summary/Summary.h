@@ -0,0 +1,65 @@
+/*
+
+
+
+
+*/
+
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp32/rom/crc.h"
+
+#include "Sensor.h"
+#include "SDCard.h"
+
+#define SUMMARY_MAGIC 0x53554D31
+#define SUMMARY_EXT ".sum" // sidecar of "name.csv" is ".name.sum", hidden from /listdir
+
+// one channel's column of a log file
+struct summary_channel
+{
+    uint32_t count;
+    tension_t min;
+    tension_t max;
+    int64_t sum;
+    uint8_t units; // tension_unit of the last row
+};
+
+// running statistics of one log file, the sidecar layout
+struct FileSummary
+{
+    uint32_t magic;
+    uint64_t size;    // file bytes the statistics cover, a stale sidecar does not match the file size
+    int64_t first_us; // epoch microseconds of the first and last row, 0 - no rows
+    int64_t last_us;
+    uint32_t rows;
+    uint32_t channels;
+    summary_channel channel[SENSOR_CHANNELS];
+    uint32_t crc;
+};
+
+// sidecar name of @file_name, false when it does not fit MAX_FILE_NAME
+bool summary_name(const char *file_name, char *out, size_t len);
+// empty statistics for a file of @channels columns
+void summary_reset(FileSummary *summary, int channels);
+// one row at @time_us
+void summary_row(FileSummary *summary, int64_t time_us);
+// one value of a row, after summary_row()
+void summary_add(FileSummary *summary, int channel, tension_t value, tension_unit units);
+// mean of @channel rounded to a hundredth, TENSION_NONE without values
+tension_t summary_mean(const FileSummary *summary, int channel);
+// write the sidecar of @file_name, the card is mounted and no file is open
+esp_err_t summary_save(const char *file_name, FileSummary *summary);
+// read and check the sidecar of @file_name, the card is mounted and no file is open
+esp_err_t summary_load(const char *file_name, FileSummary *summary);
+
+#endif // Summary.h
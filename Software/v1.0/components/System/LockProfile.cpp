@@ -0,0 +1,135 @@
+/*
+
+
+
+
+*/
+
+#include "LockProfile.h"
+
+static const char *TAG = "LockProfile";
+
+static lock_stats locks[LOCK_PROFILE_MAX] = {};
+static int lock_count = 0;
+static portMUX_TYPE lock_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// table entry of @sem, entered under @name on first use - NULL when the table is full
+static lock_stats *lock_find(SemaphoreHandle_t sem, const char *name)
+{
+    lock_stats *found = NULL;
+
+    // entries are never removed, a handle seen once is found without the spinlock
+    int count = lock_count;
+    for (int i = 0; i < count; i++)
+    {
+        if (locks[i].handle == sem)
+            return &locks[i];
+    }
+    portENTER_CRITICAL(&lock_mux);
+    for (int i = 0; i < lock_count && found == NULL; i++)
+    {
+        if (locks[i].handle == sem)
+            found = &locks[i];
+    }
+    if (found == NULL && lock_count < LOCK_PROFILE_MAX)
+    {
+        found = &locks[lock_count];
+        found->name = (name != NULL) ? name : "";
+        found->handle = sem;
+        lock_count++;
+    }
+    portEXIT_CRITICAL(&lock_mux);
+    return found;
+}
+
+// task name of @task into @out
+static void lock_task_name(TaskHandle_t task, char *out)
+{
+    const char *name = (task != NULL) ? pcTaskGetTaskName(task) : NULL;
+    strncpy(out, (name != NULL) ? name : "", configMAX_TASK_NAME_LEN - 1);
+    out[configMAX_TASK_NAME_LEN - 1] = '\0';
+}
+
+// xSemaphoreTake() of @sem within @ticks, counted under @name
+BaseType_t lock_take(SemaphoreHandle_t sem, TickType_t ticks, const char *name)
+{
+    lock_stats *lock = lock_find(sem, name);
+    int64_t start = esp_timer_get_time();
+    bool contended = false;
+
+    BaseType_t taken = xSemaphoreTake(sem, 0);
+    if (taken != pdTRUE && ticks > 0)
+    {
+        contended = true;
+        taken = xSemaphoreTake(sem, ticks);
+    }
+    if (lock == NULL)
+        return taken;
+
+    int64_t now = esp_timer_get_time();
+    TaskHandle_t holder = NULL;
+    int64_t held_us = 0;
+    portENTER_CRITICAL(&lock_mux);
+    if (taken == pdTRUE)
+    {
+        lock->takes++;
+        lock->contended += contended ? 1 : 0;
+        lock->wait_us += now - start;
+        if (now - start > lock->max_wait_us)
+            lock->max_wait_us = now - start;
+        lock->holder = xTaskGetCurrentTaskHandle();
+        lock->held_since_us = now;
+    }
+    else if (ticks > 0) // a try-take that found it busy is not a timeout
+    {
+        lock->timeouts++;
+        holder = lock->holder;
+        held_us = now - lock->held_since_us;
+    }
+    portEXIT_CRITICAL(&lock_mux);
+
+    if (taken != pdTRUE && ticks > 0)
+    {
+        // copied outside the spinlock, the name is only a hint if the holder just let go
+        lock_task_name(holder, lock->timeout_holder);
+        ESP_LOGE(TAG, "lock_take(): %s timed out, held by %s for %lld ms", lock->name,
+                 lock->timeout_holder[0] ? lock->timeout_holder : "?", held_us / 1000);
+    }
+    return taken;
+}
+
+// xSemaphoreGive() of @sem, ends the hold started by lock_take()
+BaseType_t lock_give(SemaphoreHandle_t sem)
+{
+    lock_stats *lock = lock_find(sem, NULL);
+    if (lock != NULL)
+    {
+        int64_t held_us = esp_timer_get_time() - lock->held_since_us;
+        bool longest = false;
+        portENTER_CRITICAL(&lock_mux);
+        if (lock->holder != NULL)
+        {
+            lock->hold_us += held_us;
+            longest = (held_us > lock->max_hold_us);
+            if (longest)
+                lock->max_hold_us = held_us;
+            lock->holder = NULL;
+        }
+        portEXIT_CRITICAL(&lock_mux);
+        // still ours, the next holder only gets in after the give below
+        if (longest)
+            lock_task_name(xTaskGetCurrentTaskHandle(), lock->max_holder);
+    }
+    return xSemaphoreGive(sem);
+}
+
+// copy of the first @len locks, returns the count
+int lock_get_stats(lock_stats *stats, int len)
+{
+    portENTER_CRITICAL(&lock_mux);
+    if (len > lock_count)
+        len = lock_count;
+    memcpy(stats, locks, len * sizeof(lock_stats));
+    portEXIT_CRITICAL(&lock_mux);
+    return len;
+}
@@ -0,0 +1,70 @@
+/*
+
+
+
+
+*/
+
+#ifndef LOCK_PROFILE_H
+#define LOCK_PROFILE_H
+
+#include <string.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+
+#define LOCK_PROFILE_MAX 32 // mutexes tracked, one per component instance
+
+// counters of one mutex since boot, times in microseconds
+struct lock_stats
+{
+    const char *name;             // TAG of the file that took it first
+    SemaphoreHandle_t handle;
+    uint32_t takes;
+    uint32_t contended;           // takes that had to wait for another holder
+    uint32_t timeouts;            // takes that gave up after SEMAPAHORE_WAIT_MS
+    int64_t wait_us;              // total time spent waiting, successful takes
+    int64_t max_wait_us;
+    int64_t hold_us;              // total time held, completed holds
+    int64_t max_hold_us;
+    TaskHandle_t holder;          // NULL - free
+    int64_t held_since_us;        // esp_timer time of the current take
+    char max_holder[configMAX_TASK_NAME_LEN];     // task of the longest hold
+    char timeout_holder[configMAX_TASK_NAME_LEN]; // holder when the last take timed out
+};
+
+/*
+  Lock profiler
+
+  SEMAPHORE_TAKE() / SEMAPHORE_GIVE() and the direct takes of the
+  component mutexes go through LOCK_TAKE() / LOCK_GIVE(), which count
+  takes, contended takes, timeouts, wait and hold times and the holding
+  task of every mutex in a fixed table - no allocation, a spinlock per
+  update and an esp_timer read on either side. A mutex is entered in the
+  table on its first take under the TAG of that file. A timed out take
+  logs who holds the lock and for how long. lock_get_stats() copies
+  the table for /locks. Built with CONFIG_LOCK_PROFILE, otherwise the
+  macros are the plain FreeRTOS calls.
+*/
+// xSemaphoreTake() of @sem within @ticks, counted under @name
+BaseType_t lock_take(SemaphoreHandle_t sem, TickType_t ticks, const char *name);
+// xSemaphoreGive() of @sem, ends the hold started by lock_take()
+BaseType_t lock_give(SemaphoreHandle_t sem);
+// copy of the first @len locks, returns the count
+int lock_get_stats(lock_stats *stats, int len);
+
+#ifdef CONFIG_LOCK_PROFILE
+#define LOCK_TAKE(sem, ticks) lock_take(sem, ticks, TAG)
+#define LOCK_GIVE(sem) lock_give(sem)
+#else
+#define LOCK_TAKE(sem, ticks) xSemaphoreTake(sem, ticks)
+#define LOCK_GIVE(sem) xSemaphoreGive(sem)
+#endif
+
+#endif // LockProfile.h
@@ -0,0 +1,170 @@
+/*
+
+
+
+
+*/
+
+#include "Status.h"
+
+static const char *TAG = "Status";
+
+static const char *timer_names[STATUS_LEDS] = {"led_ext", "led_red", "led_green"};
+
+/* Null, because instance will be initialized on demand. */
+Status *Status::inst = 0;
+
+//
+Status::Status()
+{
+    this->_leds[extr_led].pin = EXT_LED;
+    this->_leds[intr_led_red].pin = INT_LED_RED;
+    this->_leds[intr_led_green].pin = INT_LED_GRN;
+}
+
+//
+Status *Status::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Status(): creating instance");
+        inst = SINGLETON_NEW(Status);
+    }
+    return inst;
+}
+
+// create the LED timers once the GPIOs are configured, patterns asked for before this start now
+esp_err_t Status::init(void)
+{
+    esp_timer_create_args_t timer_args = {};
+
+    for (int i = 0; i < STATUS_LEDS; i++)
+    {
+        timer_args.callback = &Status::_timerCallback;
+        timer_args.arg = (void *)&this->_leds[i];
+        timer_args.dispatch_method = ESP_TIMER_TASK;
+        timer_args.name = timer_names[i];
+        if (esp_timer_create(&timer_args, &this->_leds[i].timer) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "init(): failed to create the %s timer", timer_names[i]);
+            return ESP_FAIL;
+        }
+    }
+    this->_initialized = true;
+    this->refresh();
+    for (int i = 0; i < STATUS_LEDS; i++)
+        this->_kick((gpio)i);
+    return ESP_OK;
+}
+
+// derive the patterns from the error flags and the alarm state, unchanged patterns keep their phase
+void Status::refresh(void)
+{
+    bool changed[STATUS_LEDS];
+
+    portENTER_CRITICAL(&this->_mux);
+    bool error = (System::instance()->checkError() != ESP_OK);
+    uint16_t half_ms = this->_alarm ? STATUS_ALARM_MS : (error ? STATUS_ERROR_MS : STATUS_HEARTBEAT_MS);
+    changed[extr_led] = this->_setPattern(extr_led, half_ms, half_ms);
+    changed[intr_led_red] = this->_setPattern(intr_led_red, error ? 1 : 0, 0);
+    changed[intr_led_green] = this->_setPattern(intr_led_green, error ? 0 : 1, 0);
+    portEXIT_CRITICAL(&this->_mux);
+    for (int i = 0; i < STATUS_LEDS; i++)
+    {
+        if (changed[i])
+            this->_kick((gpio)i);
+    }
+}
+
+// any tension alarm raised on any channel
+void Status::setAlarm(bool active)
+{
+    portENTER_CRITICAL(&this->_mux);
+    bool changed = (this->_alarm != active);
+    this->_alarm = active;
+    portEXIT_CRITICAL(&this->_mux);
+    if (changed)
+        this->refresh();
+}
+
+// @times toggles of @period_ms on @led, then back to its pattern - returns at once
+esp_err_t Status::flash(gpio led, uint8_t times, uint32_t period_ms)
+{
+    if (led >= STATUS_LEDS || period_ms == 0 || period_ms > UINT16_MAX)
+        return ESP_ERR_INVALID_ARG;
+    portENTER_CRITICAL(&this->_mux);
+    this->_leds[led].flashes = times;
+    this->_leds[led].flash_ms = (uint16_t)period_ms;
+    this->_leds[led].restart = true;
+    portEXIT_CRITICAL(&this->_mux);
+    this->_kick(led);
+    return ESP_OK;
+}
+
+// new base pattern of @led with the lock held, true when the timer has to be fired for it
+bool Status::_setPattern(gpio led, uint16_t on_ms, uint16_t off_ms)
+{
+    status_led *state = &this->_leds[led];
+
+    if (state->on_ms == on_ms && state->off_ms == off_ms)
+        return false;
+    state->on_ms = on_ms;
+    state->off_ms = off_ms;
+    if (state->flashes > 0) // picked up when the flash sequence ends
+        return false;
+    state->restart = true;
+    return true;
+}
+
+// run the next step of @led now
+void Status::_kick(gpio led)
+{
+    if (!this->_initialized)
+        return;
+    esp_timer_stop(this->_leds[led].timer);
+    // fails only when the callback rearmed it meanwhile, that step sees the restart flag
+    esp_timer_start_once(this->_leds[led].timer, 0);
+}
+
+// set @led for its next edge and arm the timer for the one after
+void Status::_step(int led)
+{
+    status_led *state = &this->_leds[led];
+    uint32_t next_ms = 0;
+    bool level;
+
+    portENTER_CRITICAL(&this->_mux);
+    if (state->restart)
+    { // the first edge of a new pattern turns the LED on
+        state->restart = false;
+        state->level = false;
+    }
+    if (state->flashes > 0)
+    {
+        state->flashes--;
+        state->level = !state->level;
+        next_ms = state->flash_ms;
+    }
+    else if (state->on_ms == 0)
+        state->level = false;
+    else if (state->off_ms == 0)
+        state->level = true;
+    else
+    {
+        state->level = !state->level;
+        next_ms = state->level ? state->on_ms : state->off_ms;
+    }
+    level = state->level;
+    portEXIT_CRITICAL(&this->_mux);
+
+    gpio_set_level(state->pin, level);
+    if (next_ms > 0)
+        esp_timer_start_once(state->timer, (uint64_t)next_ms * 1000);
+}
+
+// esp_timer task context, @arg is the LED's status_led
+void Status::_timerCallback(void *arg)
+{
+    Status *status = Status::instance();
+    status->_step((status_led *)arg - status->_leds);
+}
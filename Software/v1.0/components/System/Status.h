@@ -0,0 +1,78 @@
+/*
+
+
+
+
+*/
+
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stdint.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "driver/gpio.h"
+#include "esp_log.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+
+#include "System.h"
+
+#define STATUS_LEDS 3                 // one per enum gpio
+#define STATUS_HEARTBEAT_MS 1000      // external LED half period, no errors
+#define STATUS_ERROR_MS 250           // external LED half period while an error flag is set
+#define STATUS_ALARM_MS 125           // external LED half period while a tension alarm is raised
+
+// timer state of one LED, a base pattern with an optional flash sequence on top
+struct status_led
+{
+    esp_timer_handle_t timer;
+    gpio_num_t pin;
+    uint16_t on_ms;    // base pattern, 0 - off
+    uint16_t off_ms;   // 0 - steady on
+    uint16_t flash_ms; // flash sequence toggle period
+    uint8_t flashes;   // toggles left in the flash sequence, base pattern after
+    bool level;
+    bool restart;      // pattern changed, the next step starts it over
+};
+
+/*
+  Status LEDs
+
+  Each LED has a one shot esp_timer rearmed for its next edge, so a
+  steady LED costs no wakeups and a blinking one only its edges. The
+  pattern follows from the error flags and the tension alarm state:
+  System calls refresh() on every flag transition and Alarm calls
+  setAlarm() on every raise / clear, and a change is applied right away
+  by firing the timer at once. flash() plays a number of toggles on top
+  of the pattern without blocking the caller, e.g. on Wi-Fi events.
+  The timer callbacks run in the esp_timer task and only set pins.
+*/
+class Status
+{
+public:
+    static Status *instance(void);
+    esp_err_t init(void);
+    void refresh(void);
+    void setAlarm(bool active);
+    esp_err_t flash(gpio led, uint8_t times, uint32_t period_ms);
+
+private:
+    static Status *inst;
+    Status();
+    Status(const Status *obj);
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+
+    status_led _leds[STATUS_LEDS] = {};
+    bool _initialized = false;
+    bool _alarm = false; // guarded by _mux like the LED state
+
+    bool _setPattern(gpio led, uint16_t on_ms, uint16_t off_ms);
+    void _kick(gpio led);
+    void _step(int led);
+    static void _timerCallback(void *arg);
+};
+
+#endif // Status.h
@@ -6,6 +6,7 @@
 */
 
 #include "System.h"
+#include "Status.h"
 
 static const char *TAG = "System";
 // static const char *disk_error_msg = "  storage card not found";   //23
@@ -41,7 +42,7 @@ System *System::instance(void)
     if (inst == 0)
     {
         ESP_LOGI(TAG, "creating System instance");
-        inst = new System();
+        inst = SINGLETON_NEW(System);
     }
     return inst;
 }
@@ -73,6 +74,9 @@ esp_err_t System::init(void)
     // init GPIO
     if (this->init_gpio() != ESP_OK)
         return ESP_FAIL;
+    // RTC square wave, system time free runs on esp_timer without it
+    if (this->init_pps() != ESP_OK)
+        ESP_LOGW(TAG, "init(): RTC square wave not available");
     // init spiffs
     if (this->init_spiffs() != ESP_OK)
         return ESP_FAIL;
@@ -114,6 +118,142 @@ esp_err_t System::init_rtc(void)
     return ESP_OK;
 }
 
+// 1 Hz square wave from the RTC on SQW_GPIO, the falling edge marks the seconds rollover
+esp_err_t System::init_pps(void)
+{
+    gpio_config_t io_conf;
+    esp_err_t err;
+
+    if (!this->rtc_initialized)
+        return ESP_FAIL;
+    if (ds3231_set_squarewave_freq(&this->rtc, DS3231_SQWAVE_1HZ) != ESP_OK ||
+        ds3231_enable_squarewave(&this->rtc) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "init_pps(): failed to enable RTC square wave");
+        return ESP_FAIL;
+    }
+    this->_pps_sem = xSemaphoreCreateBinary();
+    if (this->_pps_sem == NULL)
+        return ESP_FAIL;
+
+    io_conf.intr_type = GPIO_INTR_NEGEDGE;
+    io_conf.mode = GPIO_MODE_INPUT;
+    io_conf.pull_down_en = GPIO_PULLDOWN_DISABLE;
+    io_conf.pull_up_en = GPIO_PULLUP_ENABLE; // SQW is open drain
+    io_conf.pin_bit_mask = 1ULL << (uint32_t)SQW_GPIO;
+    if (gpio_config(&io_conf) != ESP_OK)
+        return ESP_FAIL;
+    err = gpio_install_isr_service(0);
+    if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) // already installed
+        return ESP_FAIL;
+    if (gpio_isr_handler_add(SQW_GPIO, System::_ppsISR, this) != ESP_OK)
+        return ESP_FAIL;
+    return ESP_OK;
+}
+
+// timestamp the RTC second edge, discipline is done by the task in waitPPS()
+void IRAM_ATTR System::_ppsISR(void *arg)
+{
+    System *sys = (System *)arg;
+    BaseType_t woken = pdFALSE;
+
+    portENTER_CRITICAL_ISR(&sys->_time_mux);
+    sys->_pps_edge_us = esp_timer_get_time();
+    portEXIT_CRITICAL_ISR(&sys->_time_mux);
+    xSemaphoreGiveFromISR(sys->_pps_sem, &woken);
+    if (woken == pdTRUE)
+        portYIELD_FROM_ISR();
+}
+
+// true while RTC pulses are arriving
+bool System::ppsAvailable(void)
+{
+    int64_t edge;
+    portENTER_CRITICAL(&this->_time_mux);
+    edge = this->_pps_edge_us;
+    portEXIT_CRITICAL(&this->_time_mux);
+    return edge != 0 && esp_timer_get_time() - edge < PPS_LOST_US;
+}
+
+// block until the next RTC second edge and align system time to it - one waiting task only
+esp_err_t System::waitPPS(uint32_t timeout_ms, int64_t *edge_us)
+{
+    int64_t edge, offset, second_us, error = 0;
+    tm rtc_time;
+
+    if (this->_pps_sem == NULL)
+        return ESP_ERR_NOT_SUPPORTED;
+    if (!xSemaphoreTake(this->_pps_sem, pdMS_TO_TICKS(timeout_ms)))
+        return ESP_ERR_TIMEOUT;
+
+    portENTER_CRITICAL(&this->_time_mux);
+    edge = this->_pps_edge_us;
+    offset = this->_epoch_offset;
+    portEXIT_CRITICAL(&this->_time_mux);
+
+    SEMAPHORE_TAKE();
+    // pulses lost in between and the esp_timer rate against the RTC
+    if (this->_pps_prev_us != 0)
+    {
+        int64_t interval = edge - this->_pps_prev_us;
+        int64_t seconds = (interval + US_PER_SEC / 2) / US_PER_SEC;
+        if (seconds > 1)
+            this->_pps.missed += seconds - 1;
+        if (seconds >= 1)
+        {
+            float ppm = (float)(interval - seconds * US_PER_SEC) / seconds;
+            if (this->_pps.edges > 1)
+                this->_pps.drift_ppm += (ppm - this->_pps.drift_ppm) / 16;
+            else
+                this->_pps.drift_ppm = ppm;
+        }
+    }
+    this->_pps_prev_us = edge;
+    this->_pps.edges++;
+
+    if (this->_pps.locked)
+    { // edge belongs to the nearest whole second
+        second_us = (edge + offset + US_PER_SEC / 2) / US_PER_SEC * US_PER_SEC;
+        error = edge + offset - second_us;
+        if (error > PPS_RELOCK_US || error < -PPS_RELOCK_US)
+            this->_pps.locked = false;
+    }
+    if (!this->_pps.locked)
+    { // label the edge from the seconds register, valid until the next rollover
+        if (esp_timer_get_time() - edge > US_PER_SEC / 2 || this->getTimeRTC(&rtc_time) != ESP_OK)
+        {
+            SEMAPHORE_GIVE();
+            return ESP_ERR_INVALID_STATE;
+        }
+        second_us = (int64_t)mktime(&rtc_time) * US_PER_SEC;
+        error = edge + offset - second_us;
+        this->_pps.locked = true;
+        this->_pps.relocks++;
+        ESP_LOGI(TAG, "waitPPS(): locked to RTC, step %lld us", -error);
+    }
+    else if (abs((int32_t)error) > this->_pps.max_offset_us)
+        this->_pps.max_offset_us = abs((int32_t)error);
+    this->_pps.offset_us = (int32_t)error;
+
+    portENTER_CRITICAL(&this->_time_mux);
+    this->_epoch_offset = second_us - edge;
+    portEXIT_CRITICAL(&this->_time_mux);
+    SEMAPHORE_GIVE();
+
+    if (edge_us != NULL)
+        *edge_us = edge;
+    return ESP_OK;
+}
+
+//
+esp_err_t System::getPPSStats(pps_stats *stats)
+{
+    SEMAPHORE_TAKE();
+    *stats = this->_pps;
+    SEMAPHORE_GIVE();
+    return ESP_OK;
+}
+
 // get value of the temp buffer in memory
 float System::getTemp(void)
 {
@@ -132,11 +272,24 @@ esp_err_t System::updateTemp(void)
 //  get system time
 void System::getTime(tm *_time)
 {
-    time_t raw_time = {0};
-    time(&raw_time);
+    time_t raw_time = (time_t)(this->getTimeUs() / US_PER_SEC);
     localtime_r(&raw_time, _time);
 }
 
+// system time in microseconds since epoch - no TZ lock, safe for per sample use
+int64_t System::getTimeUs(void)
+{
+    int64_t time_us;
+    portENTER_CRITICAL(&this->_time_mux);
+    time_us = esp_timer_get_time() + this->_epoch_offset;
+    // PPS phase corrections may step back a few us - never go backwards
+    if (time_us < this->_last_time_us)
+        time_us = this->_last_time_us;
+    this->_last_time_us = time_us;
+    portEXIT_CRITICAL(&this->_time_mux);
+    return time_us;
+}
+
 //
 esp_err_t System::setTime(tm _time)
 {
@@ -148,6 +301,14 @@ esp_err_t System::setTime(tm _time)
     // set system time
     if (settimeofday(&us_epoc, NULL) != 0)
         return ESP_FAIL;
+    portENTER_CRITICAL(&this->_time_mux);
+    this->_epoch_offset = (int64_t)s_epoc * US_PER_SEC - esp_timer_get_time();
+    this->_last_time_us = 0;
+    portEXIT_CRITICAL(&this->_time_mux);
+    // next pulse is labeled from the RTC again
+    SEMAPHORE_TAKE();
+    this->_pps.locked = false;
+    SEMAPHORE_GIVE();
     // set rtc time
     if (this->setTimeRTC(_time) != ESP_OK)
         return ESP_FAIL;
@@ -191,6 +352,28 @@ esp_err_t System::getTimeString(char *buff, size_t len, const char *time_format,
     return ESP_OK;
 }
 
+// format epoch microseconds @time_us, calendar conversion happens only here
+esp_err_t System::getTimeString(char *buff, size_t len, const char *time_format, int64_t time_us)
+{
+    if (len < TIME_LEN)
+        return ESP_ERR_INVALID_ARG;
+    time_t raw_time = (time_t)(time_us / US_PER_SEC);
+    tm _time;
+    localtime_r(&raw_time, &_time);
+    strftime(buff, len, time_format, &_time);
+    return ESP_OK;
+}
+
+// format epoch microseconds @time_us as YYYY-MM-DDTHH:MM:SS.mmm
+esp_err_t System::getTimeStringMs(char *buff, size_t len, int64_t time_us)
+{
+    if (this->getTimeString(buff, len, TIME_FORMAT_JS, time_us) != ESP_OK)
+        return ESP_ERR_INVALID_ARG;
+    size_t end = strlen(buff);
+    snprintf(buff + end, len - end, ".%03d", (int)((time_us % US_PER_SEC) / 1000));
+    return ESP_OK;
+}
+
 //
 esp_err_t System::getTimeStruct(tm *time, const char *str_time)
 {
@@ -302,67 +485,123 @@ esp_err_t System::setIO(gpio io, bool lvl)
     return ESP_OK;
 }
 
-//
+// @times toggles of @delay ms played by the status LED timers, returns at once
 esp_err_t System::blink(gpio io, uint8_t times, uint32_t delay)
 {
-    SEMAPHORE_TAKE();
-    bool state = true;
-    for (uint8_t i = 0; i < times; i++)
-    {
-        if (io == extr_led)
-            gpio_set_level(EXT_LED, state);
-        else if (io == intr_led_green)
-            gpio_set_level(INT_LED_GRN, state);
-        else if (io == intr_led_red)
-            gpio_set_level(INT_LED_RED, state);
-        state = (!state) ? true : false;
-        vTaskDelay(pdMS_TO_TICKS(delay));
-    }
-    SEMAPHORE_GIVE();
-    return ESP_OK;
+    return Status::instance()->flash(io, times, delay);
 }
 
 //
 esp_err_t System::setErrorFlag(error_flag flag)
 {
-    uint64_t mask = 0x1;
-    SEMAPHORE_TAKE();
-    this->error_register |= (mask << flag);
-    SEMAPHORE_GIVE();
+    // hot path - flag already set, nothing to record
+    if (this->error_register.load(std::memory_order_relaxed) & (1UL << flag))
+        return ESP_OK;
+    this->_errorTransition(flag, true);
     return ESP_OK;
 }
 
 //
 esp_err_t System::clearErrorFlag(error_flag flag)
 {
-    uint64_t mask = 0x1;
-    SEMAPHORE_TAKE();
-    this->error_register &= ~(mask << flag);
-    SEMAPHORE_GIVE();
+    if (!(this->error_register.load(std::memory_order_relaxed) & (1UL << flag)))
+        return ESP_OK;
+    this->_errorTransition(flag, false);
     return ESP_OK;
 }
 
 //
 bool System::getErrorFlag(error_flag flag)
 {
-    uint64_t mask = 0x1;
-    SEMAPHORE_TAKE();
-    bool rc = this->error_register & (mask << flag);
-    SEMAPHORE_GIVE();
-    return rc;
+    return this->error_register.load(std::memory_order_relaxed) & (1UL << flag);
 }
 
 //
 esp_err_t System::checkError(void)
 {
-    esp_err_t rc;
-    SEMAPHORE_TAKE();
-    if (this->error_register == 0)
-        rc = ESP_OK;
+    if (this->error_register.load(std::memory_order_relaxed) == 0)
+        return ESP_OK;
+    return ESP_FAIL;
+}
+
+//
+const char *System::getErrorName(error_flag flag)
+{
+    if (flag >= error_flag_num)
+        return "unknown";
+    return errors[flag];
+}
+
+// totals for the first @len flags
+void System::getErrorStats(error_stats *stats, int len)
+{
+    int64_t now = esp_timer_get_time();
+    uint32_t reg;
+
+    if (len > error_flag_num)
+        len = error_flag_num;
+    portENTER_CRITICAL(&this->_error_mux);
+    reg = this->error_register.load(std::memory_order_relaxed);
+    for (int i = 0; i < len; i++)
+    {
+        stats[i].active = reg & (1UL << i);
+        stats[i].count = this->_error_count[i];
+        stats[i].total_us = this->_error_total_us[i];
+        if (stats[i].active)
+            stats[i].total_us += now - this->_error_since_us[i];
+    }
+    portEXIT_CRITICAL(&this->_error_mux);
+}
+
+// copy up to @len latest transitions, oldest first - returns count
+int System::getErrorHistory(error_event *events, int len)
+{
+    int count;
+
+    portENTER_CRITICAL(&this->_error_mux);
+    uint32_t total = this->_error_events;
+    count = (total < ERROR_HISTORY_LEN) ? total : ERROR_HISTORY_LEN;
+    if (count > len)
+        count = len;
+    for (int i = 0; i < count; i++)
+        events[i] = this->_error_history[(total - count + i) % ERROR_HISTORY_LEN];
+    portEXIT_CRITICAL(&this->_error_mux);
+    return count;
+}
+
+// change a flag and log it, the spinlock keeps the ring in order with the register
+void System::_errorTransition(error_flag flag, bool set)
+{
+    uint32_t mask = 1UL << flag, prev;
+    bool changed = false;
+    int64_t time_us = this->getTimeUs();
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&this->_error_mux);
+    if (set)
+        prev = this->error_register.fetch_or(mask);
     else
-        rc = ESP_FAIL;
-    SEMAPHORE_GIVE();
-    return rc;
+        prev = this->error_register.fetch_and(~mask);
+    if (((prev & mask) != 0) != set)
+    { // another task did not get there first
+        if (set)
+        {
+            this->_error_count[flag]++;
+            this->_error_since_us[flag] = now;
+        }
+        else
+            this->_error_total_us[flag] += now - this->_error_since_us[flag];
+        error_event *event = &this->_error_history[this->_error_events % ERROR_HISTORY_LEN];
+        event->time_us = time_us;
+        event->flag = flag;
+        event->set = set;
+        this->_error_events++;
+        changed = true;
+    }
+    portEXIT_CRITICAL(&this->_error_mux);
+    // the status LEDs follow flag changes as they happen
+    if (changed)
+        Status::instance()->refresh();
 }
 
 // print comma separated error message into a buffer
@@ -371,9 +610,9 @@ esp_err_t System::getErrorMsg(char *buff, size_t len)
     if (buff == NULL || len < ERROR_MSG_LEN)
         return ESP_FAIL;
     memset(buff, 0, len);
-    uint64_t mask = 0x1;
-    SEMAPHORE_TAKE();
-    if (this->error_register == 0)
+    uint32_t mask = 0x1;
+    uint32_t reg = this->error_register.load(std::memory_order_relaxed);
+    if (reg == 0)
     {
         snprintf(buff, ERROR_MSG_LEN, "%s,", no_errors);
     }
@@ -381,7 +620,7 @@ esp_err_t System::getErrorMsg(char *buff, size_t len)
     {
         for (int i = 0; i < error_flag_num; i++)
         {
-            if (this->error_register & mask)
+            if (reg & mask)
             {
                 strncat(buff, errors[i], ERROR_MSG_LEN);
                 strncat(buff, ",", ERROR_MSG_LEN);
@@ -404,7 +643,6 @@ esp_err_t System::getErrorMsg(char *buff, size_t len)
     // // no errors
     // if (this->error_register == 0)
     //     strncat(buff, no_errors, len);
-    SEMAPHORE_GIVE();
     return ESP_OK;
 }
 
@@ -414,13 +652,11 @@ esp_err_t System::getErrorMsgColor(char *buff, size_t len)
     if (buff == NULL || len < 9)
         return ESP_FAIL;
     memset(buff, 0, len);
-    SEMAPHORE_TAKE();
 
-    if (this->error_register == 0)
+    if (this->error_register.load(std::memory_order_relaxed) == 0)
         strncpy(buff, "success", len);
     else
         strncpy(buff, "warning", len);
-    SEMAPHORE_GIVE();
     return ESP_OK;
 }
 
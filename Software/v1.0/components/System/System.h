@@ -9,6 +9,8 @@
 #define SYSTEM_H
 
 #include <string.h>
+#include <atomic>
+#include <new>
 #include <math.h>
 #include <fcntl.h>
 #include <sys/time.h>
@@ -21,8 +23,11 @@
 #include "esp_log.h"
 #include "esp_vfs.h"
 #include "esp_spiffs.h"
+#include "esp_timer.h"
 #include "ds3231.h"
 #include "cJSON.h"
+#include "sdkconfig.h"
+#include "LockProfile.h"
 
 #define SEMAPAHORE_WAIT_MS 5000
 
@@ -30,6 +35,11 @@
 #define SCL_GPIO 22
 #define I2C_PORT 0
 #define DS3231_ADDR 0x68 //!< I2C address
+#define SQW_GPIO GPIO_NUM_5 // DS3231 INT/SQW, open drain - bodge wire to J2 pin 8 on rev A
+
+#define PPS_TIMEOUT_MS 1500   // no edge within this time counts as missed
+#define PPS_LOST_US 3000000LL // pulses older than this are not used for scheduling
+#define PPS_RELOCK_US 100000  // phase error that forces a relabel from the RTC
 
 #define ADC_SAMPLES 5
 #define CELL_VOLT_MIN 2.6
@@ -37,12 +47,14 @@
 #define TIME_FORMAT "%Y-%m-%d %H:%M" // YYYY-MM-DD HH:MM
 #define TIME_FORMAT_SEC "%Y-%m-%d %H:%M:%S"
 #define TIME_FORMAT_JS "%Y-%m-%dT%H:%M:%S"
-#define FILENAME_FORMAT "%Y-%m-%d_%H-%M-%S.csv"
+#define FILENAME_TIME_FORMAT "%Y-%m-%d_%H-%M-%S"
+#define FILENAME_FORMAT FILENAME_TIME_FORMAT ".csv"
 #define TIME_LEN 25
+#define US_PER_SEC 1000000LL
 
 #define VERSION "1.0"
 
-#define SETTINGS_BUFFER 254
+#define SETTINGS_BUFFER 1024
 #define SETTINGS_PATH "/spiffs/settings.json"
 
 #define WEB_MOUNT_POINT "/spiffs"
@@ -52,7 +64,7 @@
 #define INT_LED_RED GPIO_NUM_25
 
 #define ERROR_MSG_LEN 512 // runtime error flags
-#define MEM_OVERFLOW_PERC 80.0
+#define ERROR_HISTORY_LEN 32 // flag transitions kept
 
 
 enum error_flag
@@ -73,6 +85,34 @@ enum error_flag
 //     info
 // };
 
+// one error flag set or cleared
+struct error_event
+{
+    int64_t time_us; // epoch microseconds
+    uint8_t flag;    // error_flag
+    bool set;
+};
+
+// per flag totals since boot
+struct error_stats
+{
+    bool active;
+    uint32_t count;   // times the flag was set
+    int64_t total_us; // time spent set, including the current period
+};
+
+// DS3231 1 Hz square wave discipline state
+struct pps_stats
+{
+    bool locked;           // system time aligned to the RTC seconds edge
+    uint32_t edges;        // pulses processed
+    uint32_t missed;       // pulses expected but not seen
+    uint32_t relocks;      // times the second was labeled from the RTC
+    int32_t offset_us;     // phase error of the last pulse before correction
+    int32_t max_offset_us; // largest phase error while locked
+    float drift_ppm;       // esp_timer rate against the RTC, + runs fast
+};
+
 // internal and external LEDs enable
 enum gpio
 {
@@ -89,10 +129,17 @@ public:
     const char *getVersion(void);
     // RTC
     void getTime(tm *time);      // system time
+    int64_t getTimeUs(void);     // system time, epoch microseconds
     esp_err_t setTime(tm _time); // system time
     //esp_err_t updateTime(char *timestr);
     esp_err_t getTimeStruct(tm *time, const char *str_time);
     esp_err_t getTimeString(char *buff, size_t len, const char *time_format, const tm time);
+    esp_err_t getTimeString(char *buff, size_t len, const char *time_format, int64_t time_us);
+    esp_err_t getTimeStringMs(char *buff, size_t len, int64_t time_us);
+    // PPS (RTC square wave)
+    bool ppsAvailable(void);
+    esp_err_t waitPPS(uint32_t timeout_ms, int64_t *edge_us);
+    esp_err_t getPPSStats(pps_stats *stats);
     float getTemp(void);
     esp_err_t updateTemp(void);
     // ADC
@@ -108,6 +155,9 @@ public:
     esp_err_t checkError(void);
     esp_err_t getErrorMsg(char *buff, size_t len);
     esp_err_t getErrorMsgColor(char *buff, size_t len);
+    const char *getErrorName(error_flag flag);
+    void getErrorStats(error_stats *stats, int len);
+    int getErrorHistory(error_event *events, int len);
     // GPIO
     esp_err_t setIO(gpio io, bool lvl);
     esp_err_t blink(gpio io, uint8_t times, uint32_t delay);
@@ -128,6 +178,17 @@ private:
     float temp = 0.0;
     float cvolt = 0.0;
     i2c_dev_t rtc;
+    // epoch = esp_timer + offset, monotonic between time updates
+    int64_t _epoch_offset = 0;
+    portMUX_TYPE _time_mux = portMUX_INITIALIZER_UNLOCKED;
+    int64_t _last_time_us = 0; // keeps getTimeUs() monotonic across phase corrections
+    // PPS, edge time written from the ISR
+    SemaphoreHandle_t _pps_sem = NULL;
+    volatile int64_t _pps_edge_us = 0;
+    int64_t _pps_prev_us = 0;
+    pps_stats _pps = {};
+    esp_err_t init_pps(void);
+    static void _ppsISR(void *arg);
     esp_err_t init_rtc(void);
     esp_err_t getTimeRTC(tm *_time);
     esp_err_t setTimeRTC(tm _time);
@@ -135,7 +196,15 @@ private:
     esp_err_t init_adc(void);
     esp_adc_cal_characteristics_t *adc_chars;
     // LOG
-    uint64_t error_register = 0;
+    // flags are read and written lock free, only transitions take the spinlock
+    std::atomic<uint32_t> error_register{0};
+    portMUX_TYPE _error_mux = portMUX_INITIALIZER_UNLOCKED;
+    error_event _error_history[ERROR_HISTORY_LEN] = {};
+    uint32_t _error_events = 0; // total transitions, ring position
+    uint32_t _error_count[error_flag_num] = {};
+    int64_t _error_total_us[error_flag_num] = {};
+    int64_t _error_since_us[error_flag_num] = {}; // esp_timer time the flag was set
+    void _errorTransition(error_flag flag, bool set);
     // char log_buff[LOG_BUFFER];
     // log_level log_stat = info;
 
@@ -151,7 +220,7 @@ private:
     {                                                                       \
         if (this->xSemaphore != NULL)                                       \
         {                                                                   \
-            if (!xSemaphoreTake(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))  \
+            if (!LOCK_TAKE(this->xSemaphore, SEMAPAHORE_WAIT_MS / portTICK_RATE_MS))       \
             {                                                               \
                 ESP_LOGE(TAG, "SEMAPHORE_TAKE(): failed to take semaphore"); \
                 return ESP_ERR_TIMEOUT;                                     \
@@ -164,7 +233,7 @@ private:
     {                                                                       \
         if (this->xSemaphore != NULL)                                       \
         {                                                                   \
-            if (!xSemaphoreGive(this->xSemaphore))                          \
+            if (!LOCK_GIVE(this->xSemaphore))                               \
             {                                                               \
                 ESP_LOGE(TAG, "SEMAPHORE_GIVE(): failed to give semaphore"); \
                 return ESP_FAIL;                                            \
@@ -172,6 +241,19 @@ private:
         }                                                                   \
     } while (0)
 
+// singletons live in static storage in the static memory mode, on the heap otherwise
+#ifdef CONFIG_STATIC_MEMORY
+template <typename T>
+inline void *singleton_storage(void)
+{
+    alignas(T) static uint8_t storage[sizeof(T)];
+    return storage;
+}
+#define SINGLETON_NEW(type) new (singleton_storage<type>()) type()
+#else
+#define SINGLETON_NEW(type) new type()
+#endif
+
 #define TIME_DEFAULTS() \
     {                   \
         .tm_sec = 0,    \
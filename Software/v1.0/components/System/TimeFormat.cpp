@@ -0,0 +1,156 @@
+/*
+
+
+
+
+*/
+
+#include <string.h>
+
+#include "TimeFormat.h"
+
+#define SEC_PER_DAY 86400
+#define SEC_PER_HOUR 3600
+
+// character offsets in "YYYY-MM-DDTHH:MM:SS.mmm"
+#define POS_MINUTE 14
+#define POS_SECOND 17
+#define POS_MILLI 20
+
+//
+static inline int64_t floor_div(int64_t a, int64_t b)
+{
+    return (a >= 0) ? a / b : -((-a + b - 1) / b);
+}
+
+//
+static inline void put_2(char *p, uint32_t v)
+{
+    p[0] = '0' + v / 10;
+    p[1] = '0' + v % 10;
+}
+
+// days since 1970-01-01 for a proleptic Gregorian date, month 1..12
+int64_t days_from_civil(int64_t year, uint32_t month, uint32_t day)
+{
+    year -= month <= 2;
+    const int64_t era = (year >= 0 ? year : year - 399) / 400;
+    const uint32_t yoe = (uint32_t)(year - era * 400);                          // [0, 399]
+    const uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1; // [0, 365]
+    const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;                   // [0, 146096]
+    return era * 146097 + (int64_t)doe - 719468;
+}
+
+// inverse of days_from_civil
+void civil_from_days(int64_t days, int64_t *year, uint32_t *month, uint32_t *day)
+{
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const uint32_t doe = (uint32_t)(days - era * 146097);                       // [0, 146096]
+    const uint32_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365; // [0, 399]
+    const uint32_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);               // [0, 365]
+    const uint32_t mp = (5 * doy + 2) / 153;                                    // [0, 11]
+    *day = doy - (153 * mp + 2) / 5 + 1;
+    *month = mp < 10 ? mp + 3 : mp - 9;
+    *year = (int64_t)yoe + era * 400 + (*month <= 2);
+}
+
+// tm (taken as UTC) to epoch seconds without mktime, fields must be normalized
+time_t time_from_civil(const tm *time)
+{
+    int64_t days = days_from_civil((int64_t)time->tm_year + 1900, time->tm_mon + 1, time->tm_mday);
+    return (time_t)(days * SEC_PER_DAY + time->tm_hour * SEC_PER_HOUR + time->tm_min * 60 + time->tm_sec);
+}
+
+// epoch seconds to tm (UTC) without gmtime / localtime
+void civil_from_time(time_t epoch, tm *time)
+{
+    int64_t days = floor_div(epoch, SEC_PER_DAY);
+    int64_t rem = (int64_t)epoch - days * SEC_PER_DAY;
+    int64_t year;
+    uint32_t month, day;
+
+    civil_from_days(days, &year, &month, &day);
+    time->tm_year = (int)(year - 1900);
+    time->tm_mon = month - 1;
+    time->tm_mday = day;
+    time->tm_hour = rem / SEC_PER_HOUR;
+    time->tm_min = (rem % SEC_PER_HOUR) / 60;
+    time->tm_sec = rem % 60;
+    time->tm_wday = (int)(((days % 7) + 11) % 7); // 1970-01-01 was a Thursday
+    time->tm_yday = (int)(days - days_from_civil(year, 1, 1));
+    time->tm_isdst = 0;
+}
+
+//
+TimeFormat::TimeFormat()
+{
+    this->invalidate();
+}
+
+// force the next format() to render the full string
+void TimeFormat::invalidate(void)
+{
+    memset(this->_text, 0, sizeof(this->_text));
+    this->_range_start = 0;
+    this->_range_end = 0;
+    this->_minute = -1;
+    this->_second = -1;
+}
+
+// write epoch microseconds @time_us into @buff (>= TIME_FORMAT_MS_LEN), returns string length
+size_t TimeFormat::format(char *buff, size_t len, int64_t time_us)
+{
+    if (buff == NULL || len < TIME_FORMAT_MS_LEN)
+        return 0;
+
+    int64_t epoch = floor_div(time_us, 1000000);
+    uint32_t milli = (uint32_t)((time_us - epoch * 1000000) / 1000);
+
+    if (epoch < this->_range_start || epoch >= this->_range_end)
+        this->_renderHour(epoch);
+
+    uint32_t rem = (uint32_t)(epoch - this->_range_start);
+    int32_t minute = rem / 60;
+    int32_t second = rem % 60;
+    if (minute != this->_minute)
+    {
+        put_2(&this->_text[POS_MINUTE], minute);
+        this->_minute = minute;
+    }
+    if (second != this->_second)
+    {
+        put_2(&this->_text[POS_SECOND], second);
+        this->_second = second;
+    }
+    this->_text[POS_MILLI] = '0' + milli / 100;
+    put_2(&this->_text[POS_MILLI + 1], milli % 100);
+
+    memcpy(buff, this->_text, TIME_FORMAT_MS_LEN);
+    return TIME_FORMAT_MS_LEN - 1;
+}
+
+// render date and hour of the local hour containing @epoch, once per hour
+void TimeFormat::_renderHour(int64_t epoch)
+{
+    time_t raw_time = (time_t)epoch;
+    tm local;
+
+    // one TZ lookup per hour keeps the output identical to strftime across DST changes
+    localtime_r(&raw_time, &local);
+    int64_t offset = (int64_t)time_from_civil(&local) - epoch;
+    int64_t local_epoch = epoch + offset;
+    int64_t hour_start = floor_div(local_epoch, SEC_PER_HOUR) * SEC_PER_HOUR;
+    this->_range_start = hour_start - offset;
+    this->_range_end = this->_range_start + SEC_PER_HOUR;
+
+    uint32_t year = (uint32_t)(local.tm_year + 1900) % 10000;
+    memcpy(this->_text, "0000-00-00T00:00:00.000", TIME_FORMAT_MS_LEN);
+    put_2(&this->_text[0], year / 100);
+    put_2(&this->_text[2], year % 100);
+    put_2(&this->_text[5], local.tm_mon + 1);
+    put_2(&this->_text[8], local.tm_mday);
+    put_2(&this->_text[11], local.tm_hour);
+    this->_minute = 0;
+    this->_second = 0;
+}
@@ -0,0 +1,53 @@
+/*
+
+
+
+
+*/
+
+#ifndef TIME_FORMAT_H
+#define TIME_FORMAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <time.h>
+
+#define TIME_FORMAT_MS_LEN 24 // "YYYY-MM-DDTHH:MM:SS.mmm" + '\0'
+
+// days since 1970-01-01 for a proleptic Gregorian date, month 1..12
+int64_t days_from_civil(int64_t year, uint32_t month, uint32_t day);
+// inverse of days_from_civil
+void civil_from_days(int64_t days, int64_t *year, uint32_t *month, uint32_t *day);
+// tm (taken as UTC) to epoch seconds without mktime, fields must be normalized
+time_t time_from_civil(const tm *time);
+// epoch seconds to tm (UTC) without gmtime / localtime
+void civil_from_time(time_t epoch, tm *time);
+
+/*
+  Cached ISO-8601 formatter
+
+  Renders epoch microseconds as local YYYY-MM-DDTHH:MM:SS.mmm, the same
+  text as strftime(TIME_FORMAT_JS) plus milliseconds. The date and hour
+  are rendered once per local hour, after that only the minute, second
+  and millisecond digits that changed are rewritten. The local time
+  offset is looked up once per hour as well. Not thread safe, each
+  writer keeps its own instance.
+*/
+class TimeFormat
+{
+public:
+    TimeFormat();
+    size_t format(char *buff, size_t len, int64_t time_us);
+    void invalidate(void);
+
+private:
+    char _text[TIME_FORMAT_MS_LEN];
+    int64_t _range_start = 0; // epoch seconds, rendered hour is [start, start + 3600)
+    int64_t _range_end = 0;
+    int32_t _minute = -1;
+    int32_t _second = -1;
+
+    void _renderHour(int64_t epoch);
+};
+
+#endif // TimeFormat.h
@@ -0,0 +1,149 @@
+/*
+
+
+
+
+*/
+
+#include "Trace.h"
+
+static const char *TAG = "Trace";
+
+/* Null, because instance will be initialized on demand. */
+Trace *Trace::inst = 0;
+
+//
+Trace::Trace()
+{
+    memset(this->_events, 0, sizeof(this->_events));
+}
+
+//
+Trace *Trace::instance(void)
+{
+    if (inst == 0)
+    {
+        ESP_LOGI(TAG, "Trace(): creating instance");
+        inst = SINGLETON_NEW(Trace);
+    }
+    return inst;
+}
+
+// add a begin ('B') or end ('E') mark for @name to the running core's ring
+void Trace::record(const char *name, char phase)
+{
+    if (!this->_enabled.load(std::memory_order_relaxed))
+        return;
+    int core = xPortGetCoreID();
+    portENTER_CRITICAL(&this->_mux[core]);
+    if (this->_enabled.load(std::memory_order_relaxed))
+    {
+        TraceEvent *event = &this->_events[core][this->_count[core] % TRACE_EVENTS];
+        event->name = name;
+        event->ccount = xthal_get_ccount();
+        event->tick = xTaskGetTickCount();
+        event->task = xTaskGetCurrentTaskHandle();
+        event->phase = phase;
+        this->_count[core]++;
+    }
+    portEXIT_CRITICAL(&this->_mux[core]);
+}
+
+// pause or resume recording
+void Trace::enable(bool enable)
+{
+    this->_enabled.store(enable, std::memory_order_relaxed);
+    // wait out writers that passed the check before the change
+    for (int i = 0; i < TRACE_CORES; i++)
+    {
+        portENTER_CRITICAL(&this->_mux[i]);
+        portEXIT_CRITICAL(&this->_mux[i]);
+    }
+}
+
+// export both rings as Chrome trace JSON, recording is paused meanwhile
+esp_err_t Trace::write(trace_writer_t writer, void *ctx)
+{
+    char line[TRACE_LINE_LEN];
+    esp_err_t rc = ESP_OK;
+    bool was_enabled = this->_enabled.load(std::memory_order_relaxed);
+
+#ifdef CONFIG_STATIC_MEMORY
+    TaskStatus_t *tasks = this->_tasks;
+#else
+    TaskStatus_t *tasks = (TaskStatus_t *)malloc(TRACE_TASKS_MAX * sizeof(TaskStatus_t));
+    if (tasks == NULL)
+        return ESP_ERR_NO_MEM;
+#endif
+    UBaseType_t task_count = uxTaskGetSystemState(tasks, TRACE_TASKS_MAX, NULL);
+
+    this->enable(false);
+    snprintf(line, sizeof(line), "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    rc = writer(ctx, line, strlen(line));
+    // a process per core, tasks that are not pinned may show up under both
+    for (int core = 0; core < TRACE_CORES && rc == ESP_OK; core++)
+    {
+        snprintf(line, sizeof(line), "%s\n{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"Tension Logger core %d\"}}",
+                 core ? "," : "", core, core);
+        rc = writer(ctx, line, strlen(line));
+        for (UBaseType_t i = 0; i < task_count && rc == ESP_OK; i++)
+        {
+            snprintf(line, sizeof(line), ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+                     core, i + 1, tasks[i].pcTaskName);
+            rc = writer(ctx, line, strlen(line));
+        }
+    }
+
+    for (int core = 0; core < TRACE_CORES && rc == ESP_OK; core++)
+    {
+        uint32_t total = this->_count[core];
+        uint32_t count = (total < TRACE_EVENTS) ? total : TRACE_EVENTS;
+        double time_us = 0;
+        for (uint32_t i = 0; i < count && rc == ESP_OK; i++)
+        {
+            const TraceEvent *event = &this->_events[core][(total - count + i) % TRACE_EVENTS];
+            const TraceEvent *prev = &this->_events[core][(total - count + i - 1) % TRACE_EVENTS];
+            if (i == 0) // cores are aligned on the tick of their oldest event
+                time_us = (double)event->tick * portTICK_PERIOD_MS * 1000;
+            else
+            { // the tick delta tells how many times the cycle counter wrapped
+                uint32_t cycles = event->ccount - prev->ccount;
+                double expected = (double)(event->tick - prev->tick) * portTICK_PERIOD_MS * 1000 * TRACE_CYCLES_PER_US;
+                double wraps = (expected - cycles) / 4294967296.0;
+                wraps = (wraps > 0) ? (double)(int64_t)(wraps + 0.5) : 0;
+                time_us += (cycles + wraps * 4294967296.0) / TRACE_CYCLES_PER_US;
+            }
+            unsigned tid = 0;
+            for (UBaseType_t t = 0; t < task_count && tid == 0; t++)
+            {
+                if (tasks[t].xHandle == event->task)
+                    tid = t + 1;
+            }
+            snprintf(line, sizeof(line), ",\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}",
+                     event->name, event->phase, time_us, core, tid);
+            rc = writer(ctx, line, strlen(line));
+        }
+    }
+    if (rc == ESP_OK)
+        rc = writer(ctx, "\n]}\n", 4);
+    this->enable(was_enabled);
+#ifndef CONFIG_STATIC_MEMORY
+    free(tasks);
+#endif
+    return rc;
+}
+
+//
+static esp_err_t console_write(void *ctx, const char *buff, size_t len)
+{
+    fwrite(buff, 1, len, stdout);
+    return ESP_OK;
+}
+
+// print the trace JSON to the console
+esp_err_t Trace::dump(void)
+{
+    esp_err_t rc = this->write(console_write, NULL);
+    fflush(stdout);
+    return rc;
+}
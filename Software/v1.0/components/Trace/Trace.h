@@ -0,0 +1,91 @@
+/*
+
+
+
+
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <atomic>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp_log.h"
+#include "esp_err.h"
+#include "xtensa/hal.h"
+#include "sdkconfig.h"
+
+#include "System.h"
+
+#define TRACE_EVENTS 256 // per core ring length
+#define TRACE_CORES 2
+#define TRACE_TASKS_MAX 24
+#define TRACE_LINE_LEN 160
+#define TRACE_CYCLES_PER_US CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ // power management is off
+
+// one begin / end mark, 20 bytes
+struct TraceEvent
+{
+    const char *name; // string literal, never copied
+    uint32_t ccount;  // cycle counter of the recording core
+    uint32_t tick;    // FreeRTOS tick, resolves ccount wraps (17.9 s at 240 MHz)
+    TaskHandle_t task;
+    char phase; // 'B' or 'E'
+};
+
+// exported JSON output, called once per line
+typedef esp_err_t (*trace_writer_t)(void *ctx, const char *buff, size_t len);
+
+/*
+  Event tracer
+
+  Begin / end marks go into a ring per core, stamped with that core's
+  cycle counter - recording is a few dozen cycles under the core's
+  spinlock. The export walks each ring oldest first and converts cycle
+  deltas to microseconds; the tick stored with every event aligns the
+  two cores to within one tick and accounts for counter wraps. Output
+  is Chrome / Perfetto trace event JSON, one process per core.
+*/
+class Trace
+{
+public:
+    static Trace *instance(void);
+    void record(const char *name, char phase);
+    void enable(bool enable);
+    esp_err_t write(trace_writer_t writer, void *ctx);
+    esp_err_t dump(void);
+
+private:
+    static Trace *inst;
+    Trace();
+    Trace(const Trace *obj);
+
+    std::atomic<bool> _enabled{true};
+    portMUX_TYPE _mux[TRACE_CORES] = {portMUX_INITIALIZER_UNLOCKED, portMUX_INITIALIZER_UNLOCKED};
+    TraceEvent _events[TRACE_CORES][TRACE_EVENTS];
+    uint32_t _count[TRACE_CORES] = {}; // total events recorded, ring position
+#ifdef CONFIG_STATIC_MEMORY
+    TaskStatus_t _tasks[TRACE_TASKS_MAX]; // export scratch, one export at a time
+#endif
+};
+
+// begin / end pair around the enclosing scope
+class TraceScope
+{
+public:
+    TraceScope(const char *name) : _name(name) { Trace::instance()->record(name, 'B'); }
+    ~TraceScope() { Trace::instance()->record(this->_name, 'E'); }
+
+private:
+    const char *_name;
+};
+
+#define TRACE_SCOPE(name) TraceScope _trace_scope(name)
+
+#endif // Trace.h
@@ -1,6 +1,7 @@
 
 var DataPoints = {
     index: 0,
+    seq: 0, // newest /history sample the chart has
     data: [],
     setpoint: [],
     timestamp: [],
@@ -70,6 +71,39 @@ function addData(chart, labels, data1, data2) {
     chart.update();
 }
 
+// append one point, the oldest drops out after graph_points
+function pushPoint(tension, label, settings) {
+    if (DataPoints.index >= settings.graph_points) {
+        DataPoints.data.shift();
+        DataPoints.timestamp.shift();
+        DataPoints.setpoint.shift();
+    } else {
+        DataPoints.index++;
+    }
+    DataPoints.data.push(tension);
+    DataPoints.timestamp.push(label);
+    DataPoints.setpoint.push(settings.set_point);
+}
+
+// fill the chart from the server's history - the newest points on page load, only the gap after a reconnect
+async function getHistory(LineChart, settings) {
+    if (settings.graph_points == 0)
+        return;
+    let url = historyURL + "?channel=0&since=" + DataPoints.seq;
+    if (DataPoints.seq == 0)
+        url += "&limit=" + settings.graph_points;
+    let history = await getJSON(url);
+    if (history == 0 || !history.hasOwnProperty('samples'))
+        return;
+    let time = 0;
+    for (const row of history.samples) {
+        time += row[0]; // ms delta to the previous row
+        pushPoint(row[2] / history.scale, new Date(time).toTimeString().split(" ")[0], settings);
+    }
+    DataPoints.seq = history.seq;
+    addData(LineChart, DataPoints.timestamp, DataPoints.data, DataPoints.setpoint);
+}
+
 // get data from the server and update the HTML screen
 async function getData(LineChart, settings) {
 
@@ -87,6 +121,14 @@ async function getData(LineChart, settings) {
         if (data.hasOwnProperty('color')) {
             document.getElementById("Status").parentNode.className = 'table-' + data['color'];
         }
+        // raised tension alarms go on top of the status
+        if (data.hasOwnProperty('alarms') && data.alarms.length > 0) {
+            let str = "";
+            for (const rule of data.alarms)
+                str += rule + " tension alarm<br>";
+            document.getElementById("Status").innerHTML = str + document.getElementById("Status").innerHTML;
+            document.getElementById("Status").parentNode.className = 'table-danger';
+        }
         if (data.hasOwnProperty('present')) {
             if (data['present'] == false) {
                 setTimeout(this.getData, (settings.refresh_rate) * 1000, LineChart, settings);
@@ -109,16 +151,9 @@ async function getData(LineChart, settings) {
         else if (perc < 66) document.getElementById("progressBar").className = "progress-bar progress-bar-striped progress-bar-animated";
         else document.getElementById("progressBar").className = "progress-bar progress-bar-striped progress-bar-animated bg-success";
         // add data to the chart
-        if (DataPoints.index >= settings.graph_points) {
-            DataPoints.data.shift();
-            DataPoints.timestamp.shift();
-            DataPoints.setpoint.shift();
-        } else {
-            DataPoints.index++;
-        }
-        DataPoints.data.push(data.tension);
-        DataPoints.timestamp.push(data.timestamp.split(" ")[1]);
-        DataPoints.setpoint.push(settings.set_point);
+        pushPoint(data.tension, data.timestamp.split(" ")[1], settings);
+        if (data.hasOwnProperty('seq'))
+            DataPoints.seq = data.seq;
         //console.log(DataPoints);
         if (settings.graph_points != 0) {
             addData(LineChart, DataPoints.timestamp, DataPoints.data, DataPoints.setpoint);
@@ -128,6 +163,11 @@ async function getData(LineChart, settings) {
         console.error('getData() failed');
         document.getElementById("Status").innerHTML = "failed to get data!";
         document.getElementById("Status").parentNode.className = 'table-danger';
+        // keep trying, the missed samples come from the history once the device answers again
+        setTimeout(async () => {
+            await getHistory(LineChart, settings);
+            await getData(LineChart, settings);
+        }, (settings.refresh_rate) * 1000 + 5000);
     }
 }
 
@@ -143,6 +183,7 @@ async function getData(LineChart, settings) {
     let LineChart = {};
     if (settings.graph_points != 0) {
         LineChart = createChart(settings);
+        await getHistory(LineChart, settings);
     }
     await getData(LineChart, settings);
 
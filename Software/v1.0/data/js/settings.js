@@ -39,7 +39,7 @@ function getValue(parameter) {
 // check if a setting is in range, flag red if not
 function checkSetting(param, min, max) {
     element = document.getElementById("settings-" + param + "-input");
-    value = parseInt(getValue(param));
+    value = parseFloat(getValue(param));
     if (value < min || value > max) {
         addClass(element, ["text-danger", "is-invalid"]);
         return true;
@@ -55,7 +55,7 @@ async function setSettings(e) {
     let pass = false;
     pass = pass | checkSetting("points", 0, 100);
     pass = pass | checkSetting("refresh", 1, 1800);
-    pass = pass | checkSetting("logging", 1, 1800);
+    pass = pass | checkSetting("logging", 0.01, 1800);  // fractions of a second allowed
     if (pass == true) return;
 
     settings = {
@@ -63,7 +63,7 @@ async function setSettings(e) {
         graph_points: parseInt(getValue("points")),
         refresh_rate: parseInt(getValue("refresh")),
         set_point: parseInt(getValue("setpoint")),
-        interval: parseInt(getValue("logging"))
+        interval: parseFloat(getValue("logging"))
     };
     //console.log(settings);
     await sendJSON(getSettingsURL, settings); // send new settings to the server
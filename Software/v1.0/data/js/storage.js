@@ -86,6 +86,18 @@ async function listDir() {
         let funit = (fsize > 1024) ? " GB" : " MB";
         fsize = (fsize > 1024) ? fsize / 1024 : fsize;
         addTableElement(row, "td", fsize.toFixed(2) + funit);
+        // statistics from the file's sidecar, missing until the device has indexed it
+        let peak = "", duration = "";
+        if (data[i].hasOwnProperty('summary')) {
+            const sum = data[i]['summary'];
+            const ch = sum.channels.filter(c => c.count > 0);
+            if (ch.length > 0)
+                peak = Math.max(...ch.map(c => c.max)) + " " + ch[0].units;
+            const secs = Math.round((new Date(sum.last) - new Date(sum.first)) / 1000);
+            duration = Math.floor(secs / 3600) + ":" + String(Math.floor(secs / 60) % 60).padStart(2, "0") + ":" + String(secs % 60).padStart(2, "0");
+        }
+        addTableElement(row, "td", peak);
+        addTableElement(row, "td", duration);
         addTableElement(row, "a", "Download");
         addTableElement(row, "a", "Delete");
         table.appendChild(row);
@@ -17,6 +17,7 @@ const getMemURL = "/memory";
 const filePath = "/sdcard/";
 const datetimeURL = "/datetime";
 const infoURL = "/info";
+const historyURL = "/history";
 
 // post json data to the server
 async function sendJSON(url, data) {
@@ -8,9 +8,22 @@
 #include "Wifi.h"
 #include "Server.h"
 #include "System.h"
+#include "Status.h"
 #include "Sensor.h"
 #include "SDCard.h"
 #include "Settings.h"
+#include "Compression.h"
+#include "Storage.h"
+#include "Journal.h"
+#include "History.h"
+#include "Rollup.h"
+#include "Alarm.h"
+#include "Query.h"
+#include "Summary.h"
+#include "Scheduler.h"
+#include "Metrics.h"
+#include "Trace.h"
+#include "Memory.h"
 
 #include "freertos/freeRTOS.h"
 #include "freertos/task.h"
@@ -26,14 +39,25 @@
 #include <lwip/netdb.h>
 #include <lwip/dns.h>
 
-#define MAIN_TASK_LOOP 1000
 #define SENSOR_TASK_LOOP 10
 #define SENSOR_TASK_SER_TIMEOUT 800
-#define STORAGE_TASK_LOOP 1000
+#define SENSOR_DETECT_FAILURES 10 // failed reads in a row before the line settings are probed again
+#define SENSOR_DETECT_BACKOFF_US (60 * 1000000LL)       // wait after a probe found no gauge, doubled per failed probe
+#define SENSOR_DETECT_BACKOFF_MAX_US (30 * 60 * 1000000LL)
+#define STORAGE_POLL_US 1000000LL   // settings and card check period
+#define STORAGE_FLUSH_US 30000000LL // buffered samples written to the card at least this often
+#define CLOCK_TASK_LOOP 1000
 #define DEBUG_TASK_LOOP 15000
+#define SENSOR_TASK_STACK 4096
+#define STORAGE_TASK_STACK 16384
+#define CLOCK_TASK_STACK 3072
+#define INDEX_TASK_STACK 4096
+#define INDEX_TASK_START_MS 60000 // first pass after boot, once logging runs
+#define INDEX_TASK_LOOP 600000    // files without a current sidecar looked for this often
+#define RESERVE_TASK_STACK 3072
+#define RESERVE_TASK_LOOP 1000    // one STORAGE_PREALLOC_STEP per period while the reserves grow
 #define DATA_POINTS 30
-
-#define FILE_HEADER "Datetime,Tension,Units\r\n"
+#define TICK_MAX_OUT (SENSOR_CHANNELS * COMPRESSION_MAX_OUT) // samples one tick can add
 
 extern "C"
 {
@@ -41,9 +65,36 @@ extern "C"
 }
 void sensor_task(void *pvParameters);
 void storage_task(void *pvParameters);
+void clock_task(void *pvParameters);
 void debug_task(void *pvParameters);
-void saveData(SensorData *data, int len);
+void index_task(void *pvParameters);
+void reserve_task(void *pvParameters);
 void receive_thread(void *pvParameters);
+static void load_line_settings(Sensor *sensor);
+
+// tasks take their stack and TCB from static storage in the static memory mode
+#ifdef CONFIG_STATIC_MEMORY
+#define TASK_STORAGE(task, stack_size, count)           \
+    static StackType_t task##_stack[count][stack_size]; \
+    static StaticTask_t task##_tcb[count]
+#define TASK_CREATE(task, name, stack_size, param, priority, handle, core, index)                           \
+    ((*(handle) = xTaskCreateStaticPinnedToCore(task, name, stack_size, param, priority, task##_stack[index], \
+                                                &task##_tcb[index], core)) != NULL                          \
+         ? pdPASS                                                                                           \
+         : pdFAIL)
+#else
+#define TASK_STORAGE(task, stack_size, count)
+#define TASK_CREATE(task, name, stack_size, param, priority, handle, core, index) \
+    xTaskCreatePinnedToCore(task, name, stack_size, param, priority, handle, core)
+#endif
+
+TASK_STORAGE(sensor_task, SENSOR_TASK_STACK, SENSOR_CHANNELS);
+TASK_STORAGE(storage_task, STORAGE_TASK_STACK, 1);
+TASK_STORAGE(clock_task, CLOCK_TASK_STACK, 1);
+TASK_STORAGE(index_task, INDEX_TASK_STACK, 1);
+TASK_STORAGE(reserve_task, RESERVE_TASK_STACK, 1);
+
+static const char *sensor_task_names[SENSOR_CHANNELS] = {"sensor_task", "sensor_task_1"};
 
 static const char *TAG = "main";
 
@@ -51,6 +102,8 @@ void app_main(void)
 {
     ESP_LOGI(TAG, "app_main(): started");
     BaseType_t xReturned;
+    TaskHandle_t sensor_handle[SENSOR_CHANNELS] = {}, storage_handle = NULL, clock_handle = NULL, index_handle = NULL, reserve_handle = NULL;
+    double channels = 1;
     Wifi myWifi;
     Server myServer;
     System *system = System::instance();
@@ -58,6 +111,14 @@ void app_main(void)
     if (system->init() != ESP_OK)
         system->setErrorFlag(internal_error);
 
+    // LED patterns follow error flags and alarms from here on, nothing polls them
+    if (Status::instance()->init() != ESP_OK)
+        system->setErrorFlag(internal_error);
+
+    // before anything allocates through cJSON
+    if (Memory::instance()->init() != ESP_OK)
+        system->setErrorFlag(internal_error);
+
     if (Settings::instance()->init() != ESP_OK)
         system->setErrorFlag(internal_error);
 
@@ -67,10 +128,18 @@ void app_main(void)
     if (myServer.init() != ESP_OK)
         system->setErrorFlag(internal_error);
 
-    if (Sensor::instance()->init() != ESP_OK)
+    // gauges to read, the UART drivers are installed once - a change needs a restart
+    Settings::instance()->getParameter(&channels, "channels");
+    if (channels < 1 || channels > SENSOR_CHANNELS)
+        channels = 1;
+    for (int i = 0; i < (int)channels; i++)
     {
-        system->setErrorFlag(internal_error);
-        system->setErrorFlag(sensor_not_found);
+        load_line_settings(Sensor::instance(i));
+        if (Sensor::instance(i)->init() != ESP_OK)
+        {
+            system->setErrorFlag(internal_error);
+            system->setErrorFlag(sensor_not_found);
+        }
     }
 
     if (SDCard::instance()->init() != ESP_OK)
@@ -79,31 +148,49 @@ void app_main(void)
         system->setErrorFlag(disk_not_found);
     }
 
+    if (Storage::instance()->init() != ESP_OK)
+        system->setErrorFlag(internal_error);
+
+    if (Journal::instance()->init() != ESP_OK)
+        system->setErrorFlag(internal_error);
+
     if (system->checkError() != ESP_OK)
         ESP_LOGE(TAG, "app_main(): error during initialisation");
 
-    xReturned = xTaskCreatePinnedToCore(
-        sensor_task,              /* Function that implements the task. */
-        "sensor_task",            /* Text name for the task. */
-        4096,                     /* Stack size in words, not bytes. */
-        (void *)1,                /* Parameter passed into the task. */
-        configMAX_PRIORITIES - 3, /* Priority at which the task is created. */
-        (xTaskHandle *)NULL,      /* Used to pass out the created task's handle. */
-        (BaseType_t)1);           /* Core ID ( PRO 0, APP 1 ) */
-    if (xReturned != pdPASS)
-        ESP_LOGE(TAG, "main(): failed to create sensor_task");
-
-    xReturned = xTaskCreatePinnedToCore(
-        storage_task,
-        "storage_task",
-        16384,
-        (void *)1,
-        configMAX_PRIORITIES - 2,
-        (xTaskHandle *)NULL,
-        (BaseType_t)1);
+    // remaining singletons are created while boot may still use the heap
+    Scheduler::instance();
+    Trace::instance();
+    Alarm::instance()->loadSettings();
+
+    // stack size in bytes, parameter, priority, core ( PRO 0, APP 1 ) - one reader task per channel
+    for (int i = 0; i < Sensor::channels(); i++)
+    {
+        xReturned = TASK_CREATE(sensor_task, sensor_task_names[i], SENSOR_TASK_STACK, (void *)Sensor::instance(i),
+                                configMAX_PRIORITIES - 3, &sensor_handle[i], (BaseType_t)1, i);
+        if (xReturned != pdPASS)
+            ESP_LOGE(TAG, "main(): failed to create %s", sensor_task_names[i]);
+    }
+
+    xReturned = TASK_CREATE(storage_task, "storage_task", STORAGE_TASK_STACK, (void *)1,
+                            configMAX_PRIORITIES - 2, &storage_handle, (BaseType_t)1, 0);
     if (xReturned != pdPASS)
         ESP_LOGE(TAG, "main(): failed to create storage_task");
 
+    xReturned = TASK_CREATE(clock_task, "clock_task", CLOCK_TASK_STACK, (void *)1,
+                            configMAX_PRIORITIES - 1, &clock_handle, (BaseType_t)0, 0);
+    if (xReturned != pdPASS)
+        ESP_LOGE(TAG, "main(): failed to create clock_task");
+
+    xReturned = TASK_CREATE(index_task, "index_task", INDEX_TASK_STACK, (void *)1,
+                            tskIDLE_PRIORITY + 1, &index_handle, (BaseType_t)0, 0);
+    if (xReturned != pdPASS)
+        ESP_LOGE(TAG, "main(): failed to create index_task");
+
+    xReturned = TASK_CREATE(reserve_task, "reserve_task", RESERVE_TASK_STACK, (void *)1,
+                            tskIDLE_PRIORITY + 1, &reserve_handle, (BaseType_t)0, 0);
+    if (xReturned != pdPASS)
+        ESP_LOGE(TAG, "main(): failed to create reserve_task");
+
     // xReturned = xTaskCreatePinnedToCore(
     //     debug_task,
     //     "debug_task",
@@ -115,62 +202,181 @@ void app_main(void)
     // if (xReturned != pdPASS)
     //     ESP_LOGE(TAG, "main(): failed to create debug task");
 
-    bool state = false;
-    int delay = MAIN_TASK_LOOP;
-    size_t free_mem = 0, total = 0, used = 0;
-    float mem_perc = 0;
-
+    Memory *memory = Memory::instance();
+    // boot is over, our tasks must not touch the heap from here on (static memory mode)
+    for (int i = 0; i < Sensor::channels(); i++)
+        memory->watchTask(sensor_handle[i]);
+    memory->watchTask(storage_handle);
+    memory->watchTask(clock_handle);
+    memory->watchTask(index_handle);
+    memory->watchTask(reserve_handle);
+    memory->seal();
+
+    // the status LEDs run on their own timers, app_main has nothing left to do
     system->blink(extr_led, 15, 150);
+    vTaskDelete(NULL);
+}
+
+// sensor flags summarize all channels
+static void update_sensor_flags(void)
+{
+    System *system = System::instance();
+    bool not_found = false, invalid = false;
+    sensor_stats stats;
+
+    for (int i = 0; i < Sensor::channels(); i++)
+    {
+        if (Sensor::instance(i)->getStats(&stats) != ESP_OK)
+            continue;
+        not_found |= (stats.status == ESP_ERR_NOT_FOUND);
+        invalid |= (stats.status == ESP_ERR_INVALID_RESPONSE);
+    }
+    if (not_found)
+        system->setErrorFlag(sensor_not_found);
+    else
+        system->clearErrorFlag(sensor_not_found);
+    if (invalid)
+        system->setErrorFlag(parsing_error);
+    else
+        system->clearErrorFlag(parsing_error);
+}
+
+// @time_us is out of reach of @base - move the buffered samples and their journal copy to a base at @time_us
+static esp_err_t rebase_buffer(Journal *journal, Sample *data, int count, int64_t *base, int64_t time_us, const char *file_name)
+{
+    int64_t new_base = sample_base(time_us);
+    if (!sample_rebase(data, count, *base, new_base))
+    {
+        ESP_LOGE(TAG, "rebase_buffer(): buffered samples out of reach, sample dropped");
+        return ESP_ERR_INVALID_ARG;
+    }
+    *base = new_base;
+    journal->commit(file_name, new_base);
+    for (int i = 0; i < count; i++)
+        journal->append(&data[i]);
+    return ESP_OK;
+}
+
+// remove the first @drop samples from the buffer, the journal follows it
+static void drop_front(Journal *journal, Sample *data, int *count, int drop, int64_t base, const char *file_name)
+{
+    *count -= drop;
+    memmove(data, &data[drop], *count * sizeof(Sample));
+    journal->commit(file_name, base);
+    for (int i = 0; i < *count; i++)
+        journal->append(&data[i]);
+}
+
+// no room for another tick while the card fails - drop the oldest samples down to @keep
+static void drop_oldest(Journal *journal, Sample *data, int *count, int keep, int64_t base, const char *file_name)
+{
+    int drop = *count - keep;
+    if (drop <= 0)
+        return;
+    ESP_LOGE(TAG, "drop_oldest(): card not written, %d samples dropped", drop);
+    drop_front(journal, data, count, drop, base, file_name);
+}
+
+// baud rate and frame layout found by the last detection on @sensor's channel
+static void load_line_settings(Sensor *sensor)
+{
+    char key[16];
+    double baud = 0, format = sensor_format_auto;
+
+    snprintf(key, sizeof(key), "baud_%d", sensor->getChannel());
+    if (Settings::instance()->getParameter(&baud, key) == ESP_OK && baud > 0)
+        sensor->setBaud((uint32_t)baud);
+    snprintf(key, sizeof(key), "format_%d", sensor->getChannel());
+    if (Settings::instance()->getParameter(&format, key) == ESP_OK)
+        sensor->setFormat((sensor_format)(int)format);
+}
+
+// probe the line settings of @sensor and keep them for the next boot when they changed
+static esp_err_t detect_line_settings(Sensor *sensor)
+{
+    Settings *settings = Settings::instance();
+    char baud_key[16], format_key[16];
+    double baud = 0, format = sensor_format_auto;
+    sensor_stats stats;
+
+    esp_err_t rc = sensor->detect();
+    if (rc != ESP_OK || sensor->getStats(&stats) != ESP_OK)
+        return rc;
+    snprintf(baud_key, sizeof(baud_key), "baud_%d", sensor->getChannel());
+    snprintf(format_key, sizeof(format_key), "format_%d", sensor->getChannel());
+    settings->getParameter(&baud, baud_key);
+    settings->getParameter(&format, format_key);
+    if ((uint32_t)baud == stats.baud && (int)format == stats.format)
+        return ESP_OK;
+    if (settings->setParameter(baud_key, (double)stats.baud) != ESP_OK ||
+        settings->setParameter(format_key, (double)stats.format) != ESP_OK ||
+        settings->saveToFlash() != ESP_OK)
+        ESP_LOGE(TAG, "detect_line_settings(): channel %d failed to save", sensor->getChannel());
+    return ESP_OK;
+}
+
+// reads one channel, @pvParameters is its Sensor
+void sensor_task(void *pvParameters)
+{
+    Sensor *sensor = (Sensor *)pvParameters;
+    Alarm *alarm = Alarm::instance();
+    double poll = 0, poll_interval = 0.1;
+    SensorData frame = SENSOR_DEFAULTS();
+    sensor_stats stats;
+    int64_t next_detect = 0, backoff = SENSOR_DETECT_BACKOFF_US;
+    esp_err_t rc;
+    ESP_LOGI(TAG, "sensor_task(): channel %d started", sensor->getChannel());
+
+    // polled gauges answer requests sent on a fixed grid, others free run - read once at start
+    Settings::instance()->getParameter(&poll, "poll");
+    Settings::instance()->getParameter(&poll_interval, "poll_interval");
+    sensor->flush();
+    if (poll != 0 && sensor->startPolling(poll_interval) != ESP_OK)
+        ESP_LOGE(TAG, "sensor_task(): channel %d polling not started, free running", sensor->getChannel());
     while (1)
     {
-        state = (!state) ? true : false;
-        system->setIO(extr_led, state);
-        // checking memory overflow
-        free_mem = heap_caps_get_free_size(MALLOC_CAP_8BIT);
-        total = heap_caps_get_total_size(MALLOC_CAP_8BIT);
-        used = total - free_mem;
-        mem_perc = (float)used * 100 / total;
-        if (mem_perc > MEM_OVERFLOW_PERC)
-            system->setErrorFlag(memory_overflow);
-        // checking for any errors
-        if (system->checkError() == ESP_OK)
-        {
-            delay = MAIN_TASK_LOOP;
-            system->setIO(intr_led_red, false);
-            system->setIO(intr_led_green, true);
-        }
+        if (sensor->polling())
+            rc = sensor->poll();
         else
+            rc = sensor->readSerial(SENSOR_TASK_SER_TIMEOUT);
+        // alarms see every frame, not only the ones the storage task samples
+        if (rc == ESP_OK && sensor->getData(&frame) == ESP_OK)
+            alarm->check(&frame);
+        if (rc == ESP_OK) // a gauge answers again, the next loss is probed right away
         {
-            delay = MAIN_TASK_LOOP / 4;
-            system->setIO(intr_led_red, true);
-            system->setIO(intr_led_green, false);
+            next_detect = 0;
+            backoff = SENSOR_DETECT_BACKOFF_US;
+        }
+        update_sensor_flags();
+        // silent or garbled for a while - the gauge baud rate or output format was changed
+        if (sensor->getStats(&stats) == ESP_OK && stats.failures >= SENSOR_DETECT_FAILURES &&
+            esp_timer_get_time() >= next_detect && detect_line_settings(sensor) != ESP_OK)
+        { // nothing connected, probe less and less often
+            next_detect = esp_timer_get_time() + backoff;
+            ESP_LOGD(TAG, "sensor_task(): channel %d next probe in %lld s", sensor->getChannel(), backoff / US_PER_SEC);
+            if (backoff < SENSOR_DETECT_BACKOFF_MAX_US / 2)
+                backoff *= 2;
+            else
+                backoff = SENSOR_DETECT_BACKOFF_MAX_US;
         }
-        vTaskDelay(pdMS_TO_TICKS(delay));
     }
+
     vTaskDelete(NULL);
 }
 
-//
-void sensor_task(void *pvParameters)
+// aligns system time to the RTC square wave, idles when it is not wired
+void clock_task(void *pvParameters)
 {
-    ESP_LOGI(TAG, "sensor_task(): started");
+    ESP_LOGI(TAG, "clock_task(): started");
 
-    Sensor *sensor = Sensor::instance();
     System *system = System::instance();
     esp_err_t rc;
 
-    sensor->flush();
     while (1)
     {
-        rc = sensor->readSerial(SENSOR_TASK_SER_TIMEOUT);
-        if (rc == ESP_ERR_NOT_FOUND)
-            system->setErrorFlag(sensor_not_found);
-        else
-            system->clearErrorFlag(sensor_not_found);
-        if (rc == ESP_ERR_INVALID_RESPONSE)
-            system->setErrorFlag(parsing_error);
-        else
-            system->clearErrorFlag(parsing_error);
+        rc = system->waitPPS(PPS_TIMEOUT_MS, NULL);
+        if (rc == ESP_ERR_NOT_SUPPORTED)
+            vTaskDelay(pdMS_TO_TICKS(CLOCK_TASK_LOOP));
     }
 
     vTaskDelete(NULL);
@@ -181,95 +387,270 @@ void storage_task(void *pvParameters)
 {
     ESP_LOGI(TAG, "storage_task(): started");
 
-    Sensor *sensor = Sensor::instance();
     Settings *_settings = Settings::instance();
-    System *system = System::instance();
     SDCard *card = SDCard::instance();
-    SensorData data_points[DATA_POINTS] = {SENSOR_DEFAULTS()};
-    int sec_count = 0, index = 0, interval_s = 1;
-    double f_interval = 1;
-    char file_name[MAX_FILE_NAME];
-    tm _time = TIME_DEFAULTS();
-    esp_err_t rc;
-
-    snprintf(file_name, sizeof(file_name), "%s", "temporary.csv");
+    Storage *storage = Storage::instance();
+    Journal *journal = Journal::instance();
+    Scheduler *scheduler = Scheduler::instance();
+    Metrics *metrics = Metrics::instance();
+    History *history = History::instance();
+    Rollup *rollup = Rollup::instance();
+    Alarm *alarm = Alarm::instance();
+    Memory *memory = Memory::instance();
+    int buffered_metric = metrics->gauge("storage_buffered_samples", "", "samples waiting for the next card write");
+    int channels = Sensor::channels();
+    Compression compressor[SENSOR_CHANNELS];
+    Sample data_points[DATA_POINTS];
+    SensorData sample = SENSOR_DEFAULTS(), out[COMPRESSION_MAX_OUT];
+    sensor_stats stats;
+    int index = 0, count = 0, kept = 0, written = 0;
+    double interval = 1, interval_set = 0, deadband = 0, deadband_set = 0, max_interval = COMPRESSION_MAX_INTERVAL, max_interval_set = COMPRESSION_MAX_INTERVAL;
+    char header[COMPRESSION_HEADER_LEN], file_name[MAX_FILE_NAME];
+    uint64_t file_size = 0;
+    int64_t deadline = 0, last_poll = 0, last_flush = 0;
+    int64_t base = 0; // epoch microseconds data_points[] count from
+    int64_t rotate_at = INT64_MAX, rotated_at = 0; // next time based file rotation, the last one segments were ended for
+    bool reinit = false, write_failed = false;
+
+    storage->setChannels(channels);
     vTaskDelay(pdMS_TO_TICKS(10 * 1000));
+    // samples journaled before a reset go back into the file that was being written
+    if (journal->getFileName(file_name, sizeof(file_name)) == ESP_OK)
+    {
+        if (storage->recover(file_name) != ESP_OK)
+            ESP_LOGE(TAG, "storage_task(): failed to recover %s", file_name);
+    }
+    // the journal is lost with power, files it does not name may still end in reserve
+    if (storage->repairFiles() != ESP_OK)
+        ESP_LOGE(TAG, "storage_task(): failed to check the log files for reserve");
+    index = journal->restore(data_points, DATA_POINTS, &base);
+    if (index > 0 && storage->write(data_points, index, base, &written) != ESP_OK)
+    { // rows already on the card leave the buffer and the journal, the first flush retries the rest
+        write_failed = true;
+        ESP_LOGE(TAG, "storage_task(): failed to replay %d of %d journaled samples", index - written, index);
+        if (written > 0)
+        {
+            if (storage->getActiveFile(file_name, sizeof(file_name), &file_size) != ESP_OK)
+                file_name[0] = '\0';
+            drop_front(journal, data_points, &index, written, base, file_name);
+        }
+        else if (journal->getFileName(file_name, sizeof(file_name)) != ESP_OK)
+            file_name[0] = '\0';
+    }
+    else
+    {
+        if (index > 0)
+            ESP_LOGI(TAG, "storage_task(): replayed %d journaled samples", index);
+        if (storage->getActiveFile(file_name, sizeof(file_name), &file_size) != ESP_OK)
+            file_name[0] = '\0';
+        base = sample_base(System::instance()->getTimeUs());
+        journal->commit(file_name, base);
+        index = 0;
+    }
+
     while (1)
     {
-        if (!system->getErrorFlag(sensor_not_found) && !system->getErrorFlag(parsing_error))
+        // absolute deadlines - time spent below does not delay the next sample
+        scheduler->wait(&deadline);
+        if (deadline - last_poll >= STORAGE_POLL_US)
+        {
+            last_poll = deadline;
+            _settings->getParameter(&interval, "interval");
+            if (interval != interval_set)
+            {
+                interval_set = interval;
+                scheduler->init(interval);
+            }
+            // compression parameters, re-initialized on change by the channel loop below
+            _settings->getParameter(&deadband, "deadband");
+            _settings->getParameter(&max_interval, "max_interval");
+            if (deadband != deadband_set || max_interval != max_interval_set)
+            {
+                // range checked on the double, the cast below is only defined inside it
+                reinit = (deadband >= 0 && max_interval >= 1 && max_interval <= UINT32_MAX);
+                if (!reinit)
+                { // kept as seen so the error is logged once, the compressors keep their parameters
+                    ESP_LOGE(TAG, "storage_task(): invalid deadband %.2f or max interval %.0f", deadband, max_interval);
+                    deadband_set = deadband;
+                    max_interval_set = max_interval;
+                }
+            }
+            alarm->loadSettings();
+            rotate_at = storage->nextRotation();
+            card->checkCard();
+            // heap fragmentation and trend, sets memory_overflow
+            memory->check();
+        }
+        drop_oldest(journal, data_points, &index, DATA_POINTS - TICK_MAX_OUT, base, file_name);
+        // a compressed segment ends in the file it started in
+        bool rotating = (deadline >= rotate_at && rotate_at != rotated_at);
+        if (rotating)
+            rotated_at = rotate_at; // the boundary stays until the next write opens the new file
+        // every channel is sampled at the deadline, so their rows line up in the file
+        for (int ch = 0; ch < channels; ch++)
         {
-            _settings->getParameter(&f_interval, "interval");
-            interval_s = (int)f_interval;
-            sec_count++;
-            // time to take a reading into internal buffer
-            if (sec_count >= interval_s)
+            Sensor *sensor = Sensor::instance(ch);
+            bool reading = (sensor->getStats(&stats) == ESP_OK && stats.status == ESP_OK && sensor->getData(&sample) == ESP_OK);
+            count = 0;
+            // no reading, new file or new parameters - the sample held back ends the segment now
+            if (!reading || rotating || reinit)
+                count = compressor[ch].flush(&out[0]) ? 1 : 0;
+            if (reinit)
+                compressor[ch].init(deadband, (uint32_t)max_interval);
+            if (reading)
             {
-                sec_count = 0;
-                if (sensor->getData(&data_points[index]) != ESP_OK)
-                    continue;
-                index++;
-                if (index >= (DATA_POINTS / interval_s)) // save operation
+                sample.timestamp = deadline;
+                history->add(&sample);
+                rollup->add(&sample);
+                // nothing is pending after flush() or init(), feed() adds one sample at most
+                count += compressor[ch].feed(&sample, &out[count]);
+            }
+            for (int i = 0; i < count; i++)
+            {
+                if (!sample_pack(&out[i], base, &data_points[index]))
+                { // system time stepped back, or nothing was buffered for weeks
+                    if (rebase_buffer(journal, data_points, index, &base, out[i].timestamp, file_name) != ESP_OK)
+                        continue;
+                    sample_pack(&out[i], base, &data_points[index]);
+                }
+                journal->append(&data_points[index++]);
+            }
+        }
+        if (reinit)
+        {
+            reinit = false;
+            deadband_set = deadband;
+            max_interval_set = max_interval;
+            compressor[0].getHeader(header, sizeof(header));
+            storage->setHeader(header);
+        }
+        metrics->set(buffered_metric, index);
+        // save operation
+        if (last_flush == 0)
+            last_flush = deadline;
+        // after a failed write only the flush period retries, not every tick of a full buffer
+        if (deadline - last_flush >= STORAGE_FLUSH_US || (index > (DATA_POINTS - TICK_MAX_OUT) && !write_failed))
+        {
+            TRACE_SCOPE("storage flush");
+            last_flush = deadline;
+            // samples of this tick wait for the other channels' next tick, which may still add to the row
+            kept = 0;
+            for (int i = 0; i < index; i++)
+            {
+                if (sample_time_us(&data_points[i], base) >= deadline)
+                    kept++;
+                else if (kept > 0)
+                {
+                    Sample older = data_points[i];
+                    memmove(&data_points[i - kept + 1], &data_points[i - kept], kept * sizeof(Sample));
+                    data_points[i - kept] = older;
+                }
+            }
+            if (index - kept > 0)
+            {
+                storage->loadSettings();
+                write_failed = (storage->write(data_points, index - kept, base, &written) != ESP_OK);
+                if (written > 0 && storage->getActiveFile(file_name, sizeof(file_name), &file_size) != ESP_OK)
+                    file_name[0] = '\0';
+                if (write_failed)
+                { // rows already on the card leave the buffer and the journal, the next flush retries the rest
+                    ESP_LOGE(TAG, "storage_task(): failed to write data, %d samples kept", index - written);
+                    if (written > 0)
+                        drop_front(journal, data_points, &index, written, base, file_name);
+                }
+                else
                 {
-                    if (card->mount() == ESP_OK)
-                    {
-                        // 1. check file exists
-                        rc = card->checkFile(file_name);
-                        if (rc == ESP_ERR_NOT_FOUND) // file doesnt exist
-                        {
-                            ESP_LOGI(TAG, "storage_task(): file doesnt exists, creating..");
-                            system->getTime(&_time);
-                            system->getTimeString(file_name, sizeof(file_name), FILENAME_FORMAT, _time);
-                            if (card->openFile(file_name, "w") == ESP_OK)
-                            { // 2. create file write headers
-                                card->writeFile(FILE_HEADER);
-                                saveData(data_points, index);
-                                card->closeFile();
-                            }
-                            else
-                                ESP_LOGE(TAG, "storage_task(): failed to create file");
-                        }
-                        else if (rc == ESP_OK) // file exists
-                        {
-                            //ESP_LOGI(TAG, "storage_task(): file exists, writing..");
-                            if (card->openFile(file_name, "a") == ESP_OK)
-                            {
-                                saveData(data_points, index);
-                                card->closeFile();
-                            }
-                        } // file operation end
-                        if (card->unmount() != ESP_OK)
-                            ESP_LOGE(TAG, "storage_task(): card unmount failed");
-                    } // card mount end
-                    index = 0;
-                } // second counter buff - end
-                if (index >= DATA_POINTS)
-                    index = 0;
-            } // first counter, sec - end
+                    // the base follows the buffer, kept samples are from this tick so offsets stay small
+                    memmove(data_points, &data_points[index - kept], kept * sizeof(Sample));
+                    sample_rebase(data_points, kept, base, sample_base(deadline));
+                    base = sample_base(deadline);
+                    // the journal holds everything not yet on the card
+                    journal->commit(file_name, base);
+                    for (int i = 0; i < kept; i++)
+                        journal->append(&data_points[i]);
+                    index = kept;
+                }
+            }
+            metrics->set(buffered_metric, index);
         }
-        card->checkCard();
-        vTaskDelay(pdMS_TO_TICKS(STORAGE_TASK_LOOP));
     }
     vTaskDelete(NULL);
 }
 
-// function to save sensor data to USB
-void saveData(SensorData *data_points, int len)
+// grows the preallocated reserves of the log files away from the storage task's writes
+void reserve_task(void *pvParameters)
 {
-    System *system = System::instance();
-    SDCard *card = SDCard::instance();
-    char buff[LINE_BUFFER], time_buff[TIME_LEN];
+    ESP_LOGI(TAG, "reserve_task(): started");
+    Storage *storage = Storage::instance();
 
-    for (int i = 0; i < len; i++)
-    { //write data lines
-        system->getTimeString(time_buff, sizeof(time_buff), TIME_FORMAT_JS, data_points[i].timestamp);
-        if (data_points[i].peak_tension == -1)
-            snprintf(buff, sizeof(buff), "%s,%.1f,%s\n", time_buff, data_points[i].tension, data_points[i].units);
-        else
-            snprintf(buff, sizeof(buff), "%s,%.1f,%.1f,%s\n", time_buff, data_points[i].tension, data_points[i].peak_tension, data_points[i].units);
+    while (1)
+    {
+        vTaskDelay(pdMS_TO_TICKS(RESERVE_TASK_LOOP));
+        storage->preallocate();
+    }
+    vTaskDelete(NULL);
+}
+
+// backfill sidecars of log files that have none or a stale one, e.g. files from before summaries
+void index_task(void *pvParameters)
+{
+    ESP_LOGI(TAG, "index_task(): started");
+    static Query query;                                  // too large for the stack
+    static char names[MAX_FILE_LIST][MAX_FILE_NAME];
+    SDCard *card = SDCard::instance();
+    SDCardFile *list[MAX_FILE_LIST];
+    FileSummary summary;
+    char active[MAX_FILE_NAME], sidecar[MAX_FILE_NAME];
+    uint64_t size, active_size;
 
-        //ESP_LOGI(TAG, "storage_task(): %s", buff);
-        card->writeFile(buff);
+    vTaskDelay(pdMS_TO_TICKS(INDEX_TASK_START_MS));
+    while (1)
+    {
+        int count = 0, found = 0, indexed = 0;
+        if (card->mount() == ESP_OK)
+        {
+            if (card->listDir(&list[0], &found) == ESP_OK)
+            {
+                for (int i = 0; i < found; i++)
+                {
+                    size_t len = strlen(list[i]->name);
+                    if (len > 4 && strcasecmp(&list[i]->name[len - 4], ".csv") == 0 &&
+                        summary_name(list[i]->name, sidecar, sizeof(sidecar)))
+                        strncpy(names[count++], list[i]->name, MAX_FILE_NAME);
+                }
+                card->clearFileList();
+            }
+            card->unmount();
+        }
+        for (int i = 0; i < count; i++)
+        {
+            // the active file has its statistics kept by Storage
+            if (Storage::instance()->getActiveFile(active, sizeof(active), &active_size) == ESP_OK && strcmp(active, names[i]) == 0)
+                continue;
+            if (card->mount() != ESP_OK)
+                break;
+            bool sized = (card->getFileSize(names[i], &size) == ESP_OK);
+            bool current = (sized && summary_load(names[i], &summary) == ESP_OK && summary.size == size);
+            card->unmount();
+            if (!sized || current || query.summarize(names[i], &summary) != ESP_OK)
+                continue;
+            if (card->mount() != ESP_OK)
+                break;
+            // saved only when the file did not change during the scan
+            uint64_t scanned = size;
+            if (card->getFileSize(names[i], &size) == ESP_OK && size == scanned)
+            {
+                summary.size = size;
+                if (summary_save(names[i], &summary) == ESP_OK)
+                    indexed++;
+            }
+            card->unmount();
+        }
+        if (indexed > 0)
+            ESP_LOGI(TAG, "index_task(): %d of %d files indexed", indexed, count);
+        vTaskDelay(pdMS_TO_TICKS(INDEX_TASK_LOOP));
     }
+    vTaskDelete(NULL);
 }
 
 //
@@ -0,0 +1,31 @@
+/* Host stand-in for components/Sensor/Sensor.h
+
+   Only what Compression needs - the sample layout and its defaults,
+   without the FreeRTOS and driver headers of the real one.
+*/
+
+#ifndef SENSOR_H
+#define SENSOR_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "Tension.h"
+
+#define US_PER_SEC 1000000LL
+
+#define SENSOR_DEFAULTS()                                                                  \
+    {                                                                                      \
+        .timestamp = 0, .tension = 0, .peak_tension = TENSION_NONE, .units = unit_none, .channel = 0 \
+    }
+
+struct SensorData
+{
+    int64_t timestamp; // epoch microseconds
+    tension_t tension;      // hundredths of units, see Tension.h
+    tension_t peak_tension; // TENSION_NONE when the gauge does not send it
+    tension_unit units;     // unit_none until the first frame
+    uint8_t channel;
+};
+
+#endif // Sensor.h
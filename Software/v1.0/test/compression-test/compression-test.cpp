@@ -0,0 +1,187 @@
+/* Compression host test
+
+   Feeds a ramp, noise, a step and a signal changing units and peak hold
+   through the swinging-door compressor, rebuilds every input sample by
+   linear interpolation between the kept ones and checks the error
+   stays within the deadband, kept samples are never further apart than
+   the max interval and a units or peak change starts a new segment.
+   Runs on the build host, the local Sensor.h / esp_*.h stand in for the
+   ESP-IDF ones:
+
+   g++ -O2 -I. -I../../components/Compression -I../../components/Sensor compression-test.cpp ../../components/Compression/Compression.cpp -o compression-test
+   ./compression-test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "Compression.h"
+
+#define SAMPLES 3000
+#define STEP_US 100000LL            // 10 Hz gauge
+#define START_US 1612800000000000LL // 2021-02-08
+#define MAX_INTERVAL 5              // sec
+
+static SensorData input[SAMPLES];
+static SensorData kept[SAMPLES + COMPRESSION_MAX_OUT];
+static uint32_t seed = 1;
+
+// deterministic noise in [-amplitude, amplitude]
+static tension_t noise(tension_t amplitude)
+{
+    seed = seed * 1103515245 + 12345;
+    return (tension_t)((seed >> 16) % (2 * amplitude + 1)) - amplitude;
+}
+
+static void sample(int i, tension_t tension, tension_unit units, tension_t peak)
+{
+    SensorData data = SENSOR_DEFAULTS();
+    data.timestamp = START_US + i * STEP_US;
+    data.tension = tension;
+    data.units = units;
+    data.peak_tension = peak;
+    input[i] = data;
+}
+
+static bool same_state(const SensorData *a, const SensorData *b)
+{
+    return a->units == b->units && a->peak_tension == b->peak_tension;
+}
+
+// everything through feed() and a final flush(), returns the kept count
+static int compress(double deadband)
+{
+    Compression compression;
+    int count = 0;
+    compression.init(deadband, MAX_INTERVAL);
+    for (int i = 0; i < SAMPLES; i++)
+        count += compression.feed(&input[i], &kept[count]);
+    if (compression.flush(&kept[count]))
+        count++;
+    return count;
+}
+
+// kept sample with the timestamp and state of @data, -1 when not kept
+static int find_kept(int count, const SensorData *data)
+{
+    for (int k = 0; k < count; k++)
+        if (kept[k].timestamp == data->timestamp && same_state(&kept[k], data))
+            return k;
+    return -1;
+}
+
+static int check_signal(const char *name, double deadband)
+{
+    int errors = 0;
+    int count = compress(deadband);
+    double bound = deadband * TENSION_SCALE + 1e-6;
+
+    for (int k = 1; k < count; k++)
+    {
+        if (kept[k].timestamp <= kept[k - 1].timestamp && same_state(&kept[k], &kept[k - 1]))
+        {
+            if (errors++ < 10)
+                printf("%s: kept %d out of order\n", name, k);
+        }
+        if (kept[k].timestamp - kept[k - 1].timestamp > MAX_INTERVAL * US_PER_SEC)
+        {
+            if (errors++ < 10)
+                printf("%s: kept %d and %d %.1f s apart\n", name, k - 1, k,
+                       (double)(kept[k].timestamp - kept[k - 1].timestamp) / US_PER_SEC);
+        }
+    }
+
+    // every input between the kept samples of its own segment around it
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        int before = -1, after = -1;
+        for (int k = 0; k < count; k++)
+        {
+            if (!same_state(&kept[k], &input[i]))
+                continue;
+            if (kept[k].timestamp <= input[i].timestamp)
+                before = k;
+            else if (after < 0)
+                after = k;
+        }
+        double rebuilt;
+        if (before >= 0 && kept[before].timestamp == input[i].timestamp)
+            rebuilt = kept[before].tension;
+        else if (before >= 0 && after >= 0)
+            rebuilt = kept[before].tension + (double)(kept[after].tension - kept[before].tension) *
+                                                 (input[i].timestamp - kept[before].timestamp) /
+                                                 (kept[after].timestamp - kept[before].timestamp);
+        else
+        {
+            if (errors++ < 10)
+                printf("%s: sample %d not covered by kept samples\n", name, i);
+            continue;
+        }
+        if (fabs(rebuilt - input[i].tension) > bound)
+        {
+            if (errors++ < 10)
+                printf("%s: sample %d %d rebuilt as %.2f, deadband %.2f\n", name, i, input[i].tension,
+                       rebuilt, deadband * TENSION_SCALE);
+        }
+    }
+    printf("%-8s %4d of %d samples kept\n", name, count, SAMPLES);
+    return errors;
+}
+
+static int check_ramp(void)
+{
+    for (int i = 0; i < SAMPLES; i++)
+        sample(i, 1000 + 37 * i, unit_lbf, TENSION_NONE);
+    return check_signal("ramp", 0.5);
+}
+
+static int check_noise(void)
+{
+    for (int i = 0; i < SAMPLES; i++)
+        sample(i, 5000 + noise(300), unit_lbf, TENSION_NONE);
+    return check_signal("noise", 1.0);
+}
+
+static int check_step(void)
+{
+    for (int i = 0; i < SAMPLES; i++)
+        sample(i, (i < SAMPLES / 2 ? 5000 : 8000) + noise(20), unit_lbf, TENSION_NONE);
+    return check_signal("step", 0.5);
+}
+
+// both sides of every units / peak change are kept, the first after it in its new state
+static int check_state(void)
+{
+    const int changes[] = {SAMPLES / 3, 2 * SAMPLES / 3};
+    int errors = 0;
+
+    for (int i = 0; i < SAMPLES; i++)
+    {
+        tension_unit units = i < changes[0] ? unit_lbf : unit_n;
+        tension_t peak = i < changes[1] ? TENSION_NONE : 25000;
+        sample(i, 2000 + 3 * i + noise(10), units, peak);
+    }
+    errors += check_signal("state", 0.5);
+
+    int count = compress(0.5);
+    for (size_t c = 0; c < sizeof(changes) / sizeof(changes[0]); c++)
+    {
+        int last = find_kept(count, &input[changes[c] - 1]);
+        int first = find_kept(count, &input[changes[c]]);
+        if (last < 0 || first != last + 1)
+        {
+            if (errors++ < 10)
+                printf("state: change at %d kept as %d, %d\n", changes[c], last, first);
+        }
+    }
+    return errors;
+}
+
+int main()
+{
+    int errors = check_ramp() + check_noise() + check_step() + check_state();
+    printf("mismatches: %d\n", errors);
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
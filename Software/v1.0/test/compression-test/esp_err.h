@@ -0,0 +1,11 @@
+/* Host stand-in for the ESP-IDF error codes Compression returns */
+
+#ifndef ESP_ERR_H
+#define ESP_ERR_H
+
+typedef int esp_err_t;
+
+#define ESP_OK 0
+#define ESP_ERR_INVALID_ARG 0x102
+
+#endif // esp_err.h
@@ -0,0 +1,11 @@
+/* Host stand-in for the ESP-IDF log macros, errors go to stdout */
+
+#ifndef ESP_LOG_H
+#define ESP_LOG_H
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) printf("E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ((void)(tag))
+
+#endif // esp_log.h
@@ -0,0 +1,66 @@
+#!/usr/bin/env python3
+"""Soak test collector - polls /metrics and appends every sample to a CSV.
+
+    python3 scrape.py http://192.168.4.1 soak.csv --period 10 [--locks]
+"""
+
+import argparse
+import csv
+import json
+import time
+import urllib.request
+
+LOCK_FIELDS = ("takes", "contended", "timeouts", "wait_us", "max_wait_us",
+               "hold_us", "max_hold_us", "held_us")
+
+
+def scrape(url):
+    with urllib.request.urlopen(url + "/metrics", timeout=10) as rsp:
+        text = rsp.read().decode()
+    for line in text.splitlines():
+        if not line or line.startswith("#"):
+            continue
+        series, value = line.rsplit(" ", 1)
+        yield series, value
+
+
+def scrape_locks(url):
+    """/locks as series named like the metrics, lock_<field>{name="...",n="..."}"""
+    with urllib.request.urlopen(url + "/locks", timeout=10) as rsp:
+        locks = json.loads(rsp.read().decode()).get("locks", [])
+    seen = {}
+    for lock in locks:
+        # a component with several instances (Sensor) has one lock each
+        n = seen[lock["name"]] = seen.get(lock["name"], -1) + 1
+        labels = '{name="%s",n="%d"}' % (lock["name"], n)
+        for field in LOCK_FIELDS:
+            yield "lock_" + field + labels, lock[field]
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("url")
+    parser.add_argument("out")
+    parser.add_argument("--period", type=float, default=10.0)
+    parser.add_argument("--locks", action="store_true",
+                        help="also collect /locks, the mutex contention counters")
+    args = parser.parse_args()
+
+    with open(args.out, "a", newline="") as f:
+        writer = csv.writer(f)
+        while True:
+            now = time.strftime("%Y-%m-%dT%H:%M:%S")
+            try:
+                for series, value in scrape(args.url):
+                    writer.writerow([now, series, value])
+                if args.locks:
+                    for series, value in scrape_locks(args.url):
+                        writer.writerow([now, series, value])
+            except OSError as err:
+                writer.writerow([now, "scrape_error", str(err)])
+            f.flush()
+            time.sleep(args.period)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,133 @@
+/* Tension host test
+
+   Checks fixed point parsing, formatting and unit conversion against
+   strtod / printf / double math and compares the speed of a row's
+   tension fields with the former sscanf + "%.1f" path. Runs on the
+   build host:
+
+   g++ -O2 -I../../components/Sensor tension-test.cpp ../../components/Sensor/Tension.cpp -o tension-test
+   ./tension-test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <chrono>
+
+#include "Tension.h"
+
+#define VALUES 2000000
+#define FRAME "  123.4\tlbf\t 0"
+
+static const double newtons[unit_count] = {0.0, 4.4482216152605, 1.0, 9.80665};
+
+static int check_round_trip(void)
+{
+    char text[32], out[TENSION_TEXT_LEN];
+    int errors = 0;
+    for (int32_t v = -2000000; v <= 2000000; v += 7)
+    {
+        snprintf(text, sizeof(text), "%.2f", v / 100.0);
+        tension_t parsed = 0;
+        if (!tension_parse(text, strlen(text), &parsed) || parsed != v)
+        {
+            if (errors++ < 10)
+                printf("parse mismatch: %s -> %d\n", text, parsed);
+        }
+        tension_format(out, sizeof(out), v);
+        if (strcmp(text, out))
+        {
+            if (errors++ < 10)
+                printf("format mismatch: %s != %s\n", text, out);
+        }
+    }
+    return errors;
+}
+
+static int check_rounding(void)
+{
+    const char *text[] = {"1.005", "-1.005", "12.344", "0.1", "7", ".5", "+3.10"};
+    const tension_t expected[] = {101, -101, 1234, 10, 700, 50, 310};
+    const char *invalid[] = {"", "-", "abc", "1.2.3", "1e3", "99999999", "12lbf"};
+    int errors = 0;
+    for (size_t i = 0; i < sizeof(text) / sizeof(text[0]); i++)
+    {
+        tension_t v = 0;
+        if (!tension_parse(text[i], strlen(text[i]), &v) || v != expected[i])
+        {
+            errors++;
+            printf("rounding mismatch: %s -> %d\n", text[i], v);
+        }
+    }
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        tension_t v = 0;
+        if (tension_parse(invalid[i], strlen(invalid[i]), &v))
+        {
+            errors++;
+            printf("accepted invalid: %s\n", invalid[i]);
+        }
+    }
+    return errors;
+}
+
+static int check_convert(void)
+{
+    int errors = 0;
+    for (int from = unit_lbf; from < unit_count; from++)
+    {
+        for (int to = unit_lbf; to < unit_count; to++)
+        {
+            for (int32_t v = -10000000; v <= 10000000; v += 997)
+            {
+                double expected = round(v * newtons[from] / newtons[to]);
+                tension_t got = tension_convert(v, (tension_unit)from, (tension_unit)to);
+                if (fabs(got - expected) > 1)
+                {
+                    if (errors++ < 10)
+                        printf("convert mismatch: %d %s -> %d %s, expected %.0f\n", v,
+                               tension_unit_name((tension_unit)from), got, tension_unit_name((tension_unit)to), expected);
+                }
+            }
+        }
+    }
+    return errors;
+}
+
+static double bench(bool fixed)
+{
+    char units[5], out[32];
+    unsigned sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < VALUES; i++)
+    {
+        if (fixed)
+        {
+            tension_t v;
+            tension_parse("123.4", 5, &v);
+            tension_unit u = tension_unit_parse("lbf", 3);
+            tension_format(out, sizeof(out), tension_convert(v + i % 100, u, u));
+        }
+        else
+        {
+            float v;
+            sscanf(FRAME, "%f %4s", &v, units);
+            snprintf(out, sizeof(out), "%.1f", v + i % 100);
+        }
+        sum += out[1];
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (sum == 0)
+        printf("\n");
+    return std::chrono::duration<double, std::nano>(end - start).count() / VALUES;
+}
+
+int main()
+{
+    int errors = check_round_trip() + check_rounding() + check_convert();
+    printf("mismatches: %d\n", errors);
+    printf("sscanf / %%.1f: %.1f ns/value\n", bench(false));
+    printf("fixed point:   %.1f ns/value\n", bench(true));
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+/* TimeFormat host test
+
+   Checks the cached formatter and the civil date helpers against
+   strftime / gmtime and compares their speed. Runs on the build host:
+
+   g++ -O2 -I../../components/System time-format-test.cpp ../../components/System/TimeFormat.cpp -o time-format-test
+   TZ=UTC ./time-format-test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <chrono>
+
+#include "TimeFormat.h"
+
+#define TIME_FORMAT_JS "%Y-%m-%dT%H:%M:%S"
+#define ROWS 2000000
+#define START_US 1612800000000000LL // 2021-02-08
+#define STEP_US 1000250LL           // ~1 s logging interval with jitter
+
+static int reference(char *buff, size_t len, int64_t time_us)
+{
+    time_t raw_time = (time_t)(time_us / 1000000);
+    tm _time;
+    localtime_r(&raw_time, &_time);
+    size_t n = strftime(buff, len, TIME_FORMAT_JS, &_time);
+    return n + snprintf(buff + n, len - n, ".%03d", (int)((time_us % 1000000) / 1000));
+}
+
+static int check_civil(void)
+{
+    int errors = 0;
+    for (int64_t t = -2000000000LL; t < 4000000000LL; t += 86399 * 7)
+    {
+        time_t raw_time = (time_t)t;
+        tm a, b;
+        gmtime_r(&raw_time, &a);
+        civil_from_time(raw_time, &b);
+        if (a.tm_year != b.tm_year || a.tm_mon != b.tm_mon || a.tm_mday != b.tm_mday ||
+            a.tm_hour != b.tm_hour || a.tm_min != b.tm_min || a.tm_sec != b.tm_sec ||
+            a.tm_wday != b.tm_wday || a.tm_yday != b.tm_yday || time_from_civil(&b) != raw_time)
+        {
+            if (errors++ < 10)
+                printf("civil mismatch at %lld\n", (long long)t);
+        }
+    }
+    return errors;
+}
+
+static int check_format(void)
+{
+    TimeFormat format;
+    char a[32], b[32];
+    int errors = 0;
+    for (int64_t i = 0, t = START_US; i < ROWS; i++, t += STEP_US)
+    {
+        reference(a, sizeof(a), t);
+        format.format(b, sizeof(b), t);
+        if (strcmp(a, b))
+        {
+            if (errors++ < 10)
+                printf("format mismatch: %s != %s\n", a, b);
+        }
+    }
+    return errors;
+}
+
+static double bench(bool cached)
+{
+    TimeFormat format;
+    char buff[32];
+    unsigned sum = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int64_t i = 0, t = START_US; i < ROWS; i++, t += STEP_US)
+    {
+        if (cached)
+            format.format(buff, sizeof(buff), t);
+        else
+            reference(buff, sizeof(buff), t);
+        sum += buff[18];
+    }
+    auto end = std::chrono::steady_clock::now();
+    if (sum == 0)
+        printf("\n");
+    return std::chrono::duration<double, std::nano>(end - start).count() / ROWS;
+}
+
+int main()
+{
+    int errors = check_civil() + check_format();
+    printf("mismatches: %d\n", errors);
+    printf("strftime:   %.1f ns/row\n", bench(false));
+    printf("TimeFormat: %.1f ns/row\n", bench(true));
+    return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}